@@ -43,6 +43,7 @@ import numpy as np
 from pyparsing import commaSeparatedList
 import pylab
 import os
+import mmap
 
 from pyrap.quanta import quantity
 import ctypes
@@ -51,6 +52,8 @@ import helpers.channel_indexer as channel_indexer
 import helpers.command_line_options as command_line_options
 import helpers.facet_list_parser as facet_list_parser
 import helpers.stokes as stokes
+import helpers.fft_utils as fft_utils
+import helpers.execution_planner as execution_planner
 import bullseye_mo.library_loader as library_loader
 from helpers import timer
 from helpers import png_export
@@ -79,8 +82,67 @@ if __name__ == "__main__":
   '''
   gridded_vis = None
   sampling_funct = None
+  dirty_images = None
+  psf_images = None
   ms_names = commaSeparatedList.parseString(parser_args['input_ms'])
 
+  '''
+  the CPU back end computes uniform / robust imaging weights per visibility before gridding. This needs the weight density
+  of all the data being imaged, so the data is read twice unless it all fits in a single chunk (the GPU back end instead
+  divides the gridded visibilities by the gridded sampling function after gridding)
+  '''
+  compute_imaging_weights = parser_args['sample_weighting'] != 'natural' and parser_args['use_back_end'] == 'CPU'
+  weight_uniformly_after_gridding = parser_args['sample_weighting'] == 'uniform' and parser_args['use_back_end'] == 'GPU'
+  separate_weighting_pass = compute_imaging_weights and (len(ms_names) > 1 or parser_args['no_chunks'] > 1 or 
+							 parser_args['memory_budget'] > 0) #the execution plan may split the data into more chunks
+  imaging_passes = (['weighting'] if separate_weighting_pass else []) + ['gridding']
+
+  '''
+  tuned FFTW plans are kept between runs (the library names the wisdom files after the grid geometry)
+  '''
+  fft_wisdom_dir = None
+  if parser_args['fft_wisdom_dir'] != '':
+    fft_wisdom_dir = os.path.expanduser(parser_args['fft_wisdom_dir'])
+    if not os.path.isdir(fft_wisdom_dir):
+      os.makedirs(fft_wisdom_dir)
+
+  '''
+  out-of-core grids live in memory-mapped scratch files, which the inversion streams through slice by slice
+  '''
+  grid_scratch_dir = None
+  if parser_args['grid_scratch_dir'] != '':
+    grid_scratch_dir = os.path.expanduser(parser_args['grid_scratch_dir'])
+    if not os.path.isdir(grid_scratch_dir):
+      os.makedirs(grid_scratch_dir)
+    if not parser_args['tiled_grid_layout']:
+      print "Hint: the tiled grid layout (--tiled_grid_layout) keeps the pages touched while gridding out-of-core grids local"
+  '''
+  tiled grids are page aligned, so that every tile takes up whole pages: the grids are zeroed lazily and then only take up 
+  memory for the tiles that the gridder writes to (sparse uv coverage)
+  '''
+  grid_alignment = mmap.PAGESIZE if parser_args['tiled_grid_layout'] else 64
+  if grid_scratch_dir != None:
+    allocate_grid = lambda shape,dtype: fft_utils.mapped_zeros(shape,dtype,grid_scratch_dir)
+  else:
+    allocate_grid = lambda shape,dtype: fft_utils.aligned_zeros(shape,dtype,grid_alignment)
+
+  '''
+  spectral cubes can be imaged a group of output channels at a time, which bounds the memory taken up by the grids and images
+  independently of the number of output channels (see --cube_memory_budget). All the passes over all the measurement sets 
+  are repeated for every group. The groups are only known once the cube dimensions have been worked out from the first 
+  measurement set
+  '''
+  cube_channel_groups = None
+  plan = None #execution plan for the memory budget (see --memory_budget)
+  cube_writers = {} #FITS cubes (per facet) still being written out
+  mosaic_writer = None #FITS cube of the stitched facets
+  def imaging_schedule():
+    group_index = 0
+    while cube_channel_groups == None or group_index < len(cube_channel_groups):
+      for imaging_pass,ms_index,ms in [(p,i,ms) for p in imaging_passes for i,ms in enumerate(ms_names)]:
+	yield (group_index,imaging_pass,ms_index,ms)
+      group_index += 1
+
   '''
   General strategy for IO and processing:
     for all measurement sets:
@@ -102,10 +164,11 @@ if __name__ == "__main__":
     #end for ms
     compact and finalize grids
     write out to disk (either png or FITS)
-    optionally stitch together using montage
+    repeat all of the above for every group of cube channels (when imaging a large cube a group at a time)
+    optionally stitch the facets together
   '''
-  for ms_index,ms in enumerate(ms_names):
-    print "NOW IMAGING %s" % ms
+  for group_index,imaging_pass,ms_index,ms in imaging_schedule():
+    print "NOW %s %s" % ("IMAGING" if imaging_pass == 'gridding' else "COMPUTING IMAGING WEIGHT DENSITIES FOR",ms)
     data = data_set_loader.data_set_loader(ms,read_jones_terms=parser_args['do_jones_corrections'])
     data.read_head()
     
@@ -170,6 +233,8 @@ if __name__ == "__main__":
 	raise argparse.ArgumentTypeError("Need at least two facets to perform stitching")
       if parser_args['output_format'] != 'fits':
 	raise argparse.ArgumentTypeError("Facet output format must be of type FITS")
+      if parser_args['mosaic_feather_width'] < 0:
+	raise argparse.ArgumentTypeError("The mosaic feather width must be non-negative")
 
     facet_centres = facet_list_parser.create_facet_centre_list(parser_args,data,num_facet_centres)
     facet_list_parser.print_facet_centre_list(facet_centres,num_facet_centres)
@@ -182,6 +247,78 @@ if __name__ == "__main__":
     if (parser_args['conv_sup']*2 + 1) >= min(parser_args['npix_l'],parser_args['npix_m']):
       raise argparse.ArgumentTypeError("Full convolution support must be smaller than the grid size")
     '''
+    residual imaging subtracts the model inside the gridder, which only the CPU back end supports
+    '''
+    if parser_args['subtract_model_column'] != None and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("Model subtraction (--subtract_model_column) is only supported by the CPU back end")
+    '''
+    baseline dependent averaging merges timestamps, so the (per timestamp) jones corrections can only be applied when
+    averaging per facet (the corrections are then applied before averaging)
+    '''
+    if parser_args['baseline_dependent_averaging'] > 0 and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("Baseline dependent averaging is only supported by the CPU back end")
+    if parser_args['coalesce_visibilities'] and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("Coalescing visibilities is only supported by the CPU back end")
+    if parser_args['facet_blocking'] and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("Facet blocking is only supported by the CPU back end")
+    if parser_args['tiled_grid_layout'] and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("The tiled grid layout is only supported by the CPU back end")
+    if parser_args['planar_grid_layout'] and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("The planar grid layout is only supported by the CPU back end")
+    if parser_args['planar_grid_layout'] and parser_args['tiled_grid_layout']:
+      raise argparse.ArgumentTypeError("The planar and tiled grid layouts cannot be combined")
+    if (parser_args['sample_weighting'] == 'robust' or parser_args['super_uniform_scale'] != 1) and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("Robust and super-uniform weighting are only supported by the CPU back end")
+    if parser_args['super_uniform_scale'] < 1:
+      raise argparse.ArgumentTypeError("The super-uniform weighting scale must be at least 1")
+    if parser_args['super_uniform_scale'] != 1 and parser_args['sample_weighting'] == 'natural':
+      raise argparse.ArgumentTypeError("Super-uniform weighting requires uniform or robust weighting (--sample_weighting)")
+    if parser_args['fused_psf_gridding'] and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("Fused PSF gridding is only supported by the CPU back end")
+    if parser_args['fused_psf_gridding'] and (parser_args['planar_grid_layout'] or parser_args['average_per_facet'] or
+					      parser_args['coalesce_visibilities'] or parser_args['facet_blocking']):
+      raise argparse.ArgumentTypeError("Fused PSF gridding cannot be combined with the planar grid layout, per facet averaging, coalescing or facet blocking")
+    if parser_args['hermitian_grids'] and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("Hermitian half-plane grids are only supported by the CPU back end")
+    if parser_args['hermitian_grids'] and (parser_args['tiled_grid_layout'] or parser_args['planar_grid_layout'] or parser_args['fused_psf_gridding']):
+      raise argparse.ArgumentTypeError("Hermitian half-plane grids cannot be combined with the tiled or planar grid layouts or fused PSF gridding")
+    if parser_args['psf_cutout'] > 0 and parser_args['use_back_end'] != 'CPU':
+      raise argparse.ArgumentTypeError("PSF cutouts are only supported by the CPU back end")
+    if parser_args['psf_cutout'] > 0 and parser_args['fused_psf_gridding']:
+      raise argparse.ArgumentTypeError("PSF cutouts cannot be combined with fused PSF gridding")
+    if parser_args['psf_cutout'] < 0 or parser_args['psf_cutout'] > min(parser_args['npix_l'],parser_args['npix_m']):
+      raise argparse.ArgumentTypeError("The PSF cutout must be between 0 (full size) and the image size")
+    if parser_args['psf_cutout'] > 0 and (parser_args['conv_sup']*2 + 1) >= parser_args['psf_cutout']:
+      raise argparse.ArgumentTypeError("Full convolution support must be smaller than the PSF cutout")
+    if parser_args['memory_budget'] < 0 or parser_args['cube_memory_budget'] < 0:
+      raise argparse.ArgumentTypeError("Memory budgets cannot be negative")
+    if parser_args['memory_budget'] > 0 and parser_args['cube_memory_budget'] > 0:
+      raise argparse.ArgumentTypeError("The execution plan (--memory_budget) picks the groups of cube channels, do not also specify --cube_memory_budget")
+    if parser_args['average_per_facet'] and (parser_args['baseline_dependent_averaging'] <= 0 or num_facet_centres == 0):
+      raise argparse.ArgumentTypeError("Averaging per facet requires faceting and a baseline dependent averaging tolerance (--baseline_dependent_averaging)")
+    if parser_args['baseline_dependent_averaging'] > 0 and parser_args['do_jones_corrections'] and not parser_args['average_per_facet']:
+      raise argparse.ArgumentTypeError("Baseline dependent averaging can only be combined with jones corrections when averaging per facet (--average_per_facet)")
+    '''
+    facets with their own geometry are only gridded by the default CPU gridder, into row-major grids
+    '''
+    if parser_args['facet_geometry'] != None:
+      if num_facet_centres == 0 or len(parser_args['facet_geometry']) != num_facet_centres:
+	raise argparse.ArgumentTypeError("Specify one facet geometry (--facet_geometry) for each of the %d facets" % num_facet_centres)
+      if parser_args['use_back_end'] != 'CPU':
+	raise argparse.ArgumentTypeError("Per-facet geometry is only supported by the CPU back end")
+      if (parser_args['wplanes'] > 1 or parser_args['psf_cutout'] > 0 or parser_args['tiled_grid_layout'] or parser_args['planar_grid_layout'] or
+	  parser_args['hermitian_grids'] or parser_args['average_per_facet'] or parser_args['coalesce_visibilities'] or parser_args['facet_blocking']):
+	raise argparse.ArgumentTypeError("Per-facet geometry cannot be combined with w-projection, PSF cutouts, the tiled, planar or Hermitian grid "
+					 "layouts, per facet averaging, coalescing or facet blocking")
+      if (parser_args['stitch_facets'] or parser_args['memory_budget'] > 0 or parser_args['cube_memory_budget'] > 0 or
+	  grid_scratch_dir != None):
+	raise argparse.ArgumentTypeError("Per-facet geometry cannot be combined with facet stitching, memory budgets or out-of-core grids")
+      for (facet_npix_l,facet_npix_m,facet_cell_l,facet_cell_m) in parser_args['facet_geometry']:
+	if (parser_args['conv_sup']*2 + 1) >= min(facet_npix_l,facet_npix_m):
+	  raise argparse.ArgumentTypeError("Full convolution support must be smaller than the size of every facet")
+	if facet_cell_l <= 0 or facet_cell_m <= 0:
+	  raise argparse.ArgumentTypeError("Facet cell sizes must be positive")
+    '''
     populate the channels to be imaged:
     '''
     (channels_to_image,enabled_channels) = channel_indexer.parse_channels_to_be_imaged(parser_args['channel_select'],data)
@@ -198,6 +335,10 @@ if __name__ == "__main__":
     cube_delta_wavelength = 0
     if parser_args['output_format'] == "png" and not parser_args['average_all']:
       raise argparse.ArgumentTypeError("Cannot output cube in png format. Try averaging all channels together (--average_all), or use FITS format")
+    if parser_args['native_fits_export'] and parser_args['output_format'] != "fits":
+      raise argparse.ArgumentTypeError("The native FITS export (--native_fits_export) requires the FITS output format")
+    if parser_args['compress_fits'] and not parser_args['native_fits_export']:
+      raise argparse.ArgumentTypeError("Compressed FITS images (--compress_fits) are only written by the native FITS export. Add --native_fits_export")
     if parser_args['average_spw_channels'] and parser_args['average_all']:
       raise argparse.ArgumentTypeError("Both --average_spw_channels and --average_all are enabled. These are mutually exclusive")
     elif len(channels_to_image) > 1 and not (parser_args['average_spw_channels'] or parser_args['average_all']):
@@ -222,7 +363,7 @@ if __name__ == "__main__":
     '''
     sampling_function_channel_grid_index = None
     sampling_function_channel_count = 0
-    if parser_args['output_psf'] or (parser_args['sample_weighting'] == 'uniform'):
+    if parser_args['output_psf'] or weight_uniformly_after_gridding:
       sampling_function_channel_grid_index,sampling_function_channel_count = channel_indexer.compute_sampling_function_grid_indicies(data,channels_to_image,enabled_channels)
     '''
     Work out how many (pixels) to pad the images with. Filtering normally doesn't cut
@@ -233,24 +374,146 @@ if __name__ == "__main__":
     padding_per_edge_l = int(np.ceil(parser_args['npix_l'] * (-1.0+parser_args['image_padding']) * 0.5))
     npix_m = parser_args['npix_m'] + padding_per_edge_m * 2
     npix_l = parser_args['npix_l'] + padding_per_edge_l * 2
-    m_left_margin = padding_per_edge_l
-    m_right_margin = parser_args['npix_m'] + padding_per_edge_m
-    l_left_margin = padding_per_edge_l
-    l_right_margin = parser_args['npix_l'] + padding_per_edge_l
     '''
-    allocate enough memory to compute image and or facets (only before gridding the first MS)
+    when planning for a memory budget the padded sizes are rounded up to sizes with only small prime factors, which FFTW 
+    inverts fastest (the inversion crops the window centred on the phase centre, so the padding doesn't have to be symmetric)
+    '''
+    fft_size_multiple = 32 if parser_args['tiled_grid_layout'] else 2
+    if parser_args['memory_budget'] > 0:
+      npix_m = execution_planner.fft_friendly_size(npix_m,fft_size_multiple)
+      npix_l = execution_planner.fft_friendly_size(npix_l,fft_size_multiple)
+    if parser_args['tiled_grid_layout'] and (npix_l % 32 != 0 or npix_m % 32 != 0):
+      raise argparse.ArgumentTypeError("The tiled grid layout requires padded image dimensions (%d x %d) that are multiples of 32" % (npix_l,npix_m))
+    '''
+    PSF cutouts are padded in the same way, but cover only psf_cutout pixels around the centre of the PSF
     '''
+    psf_out_npix_l = parser_args['npix_l'] if parser_args['psf_cutout'] == 0 else parser_args['psf_cutout']
+    psf_out_npix_m = parser_args['npix_m'] if parser_args['psf_cutout'] == 0 else parser_args['psf_cutout']
+    psf_padding_per_edge_l = int(np.ceil(psf_out_npix_l * (-1.0+parser_args['image_padding']) * 0.5))
+    psf_padding_per_edge_m = int(np.ceil(psf_out_npix_m * (-1.0+parser_args['image_padding']) * 0.5))
+    psf_npix_l = psf_out_npix_l + psf_padding_per_edge_l * 2
+    psf_npix_m = psf_out_npix_m + psf_padding_per_edge_m * 2
+    if parser_args['memory_budget'] > 0:
+      psf_npix_m = execution_planner.fft_friendly_size(psf_npix_m,fft_size_multiple)
+      psf_npix_l = execution_planner.fft_friendly_size(psf_npix_l,fft_size_multiple)
+    if parser_args['tiled_grid_layout'] and (psf_npix_l % 32 != 0 or psf_npix_m % 32 != 0):
+      raise argparse.ArgumentTypeError("The tiled grid layout requires padded PSF cutout dimensions (%d x %d) that are multiples of 32" % (psf_npix_l,psf_npix_m))
+    if parser_args['hermitian_grids'] and (npix_l % 2 != 0 or npix_m % 2 != 0 or psf_npix_l % 2 != 0 or psf_npix_m % 2 != 0):
+      raise argparse.ArgumentTypeError("Hermitian half-plane grids require even padded image and PSF dimensions (%d x %d and %d x %d)" % 
+				       (npix_l,npix_m,psf_npix_l,psf_npix_m))
     num_facet_grids = 1 if (num_facet_centres == 0) else num_facet_centres
-    if not parser_args['do_jones_corrections']:
-	if gridded_vis == None:
-	  gridded_vis = np.zeros([num_facet_grids,cube_chan_dim_size,len(correlations_to_grid),npix_l,npix_m],dtype=base_types.grid_type)
-    else:
-	if gridded_vis == None:
-	  gridded_vis = np.zeros([num_facet_grids,cube_chan_dim_size,4,npix_l,npix_m],dtype=base_types.grid_type)
+    '''
+    facets may each have their own size and resolution (--facet_geometry). They are padded in the same way as above, and
+    their grids and images are packed one after the other into flat buffers, which the library finds through the offset 
+    table of the facet descriptors
+    '''
+    facet_image_shapes = [(parser_args['npix_l'],parser_args['npix_m'])] * num_facet_grids
+    facet_cell_sizes = [(parser_args['cell_l'],parser_args['cell_m'])] * num_facet_grids
+    facet_grid_shapes = [(npix_l,npix_m)] * num_facet_grids
+    facet_psf_shapes = [(psf_out_npix_l,psf_out_npix_m)] * num_facet_grids
+    if parser_args['facet_geometry'] != None:
+      facet_image_shapes = [(g[0],g[1]) for g in parser_args['facet_geometry']]
+      facet_cell_sizes = [(g[2],g[3]) for g in parser_args['facet_geometry']]
+      facet_grid_shapes = [(l + int(np.ceil(l * (-1.0+parser_args['image_padding']) * 0.5)) * 2,
+			    m + int(np.ceil(m * (-1.0+parser_args['image_padding']) * 0.5)) * 2) for (l,m) in facet_image_shapes]
+      facet_psf_shapes = facet_image_shapes #the PSF of every facet is made on its own grid
+    '''
+    restrict the channels being gridded to those of the current group of cube channels
+    '''
+    if cube_channel_groups == None:
+      bytes_per_cube_channel = execution_planner.bytes_per_cube_channel(num_facet_grids,npix_l,npix_m,parser_args['npix_l'],parser_args['npix_m'],
+									 4 if parser_args['do_jones_corrections'] else len(correlations_to_grid),
+									 parser_args['super_uniform_scale'] if compute_imaging_weights else 0)
+      bytes_per_sampling_function = 0
+      if parser_args['output_psf'] or weight_uniformly_after_gridding:
+	bytes_per_sampling_function = execution_planner.bytes_per_sampling_function(num_facet_grids,psf_npix_l,psf_npix_m,
+										    psf_out_npix_l,psf_out_npix_m,parser_args['output_psf'])
+      if parser_args['memory_budget'] > 0:
+	resident_chunks = (execution_planner.RESIDENT_CHUNKS_WHEN_AVERAGING if parser_args['baseline_dependent_averaging'] > 0 else
+			   execution_planner.RESIDENT_CHUNKS)
+	plan = execution_planner.make_execution_plan(parser_args['memory_budget'] * execution_planner.MIB,data._no_rows,no_chunks,
+						     execution_planner.bytes_per_chunk_row(data,parser_args['subtract_model_column'] != None),
+						     resident_chunks,channel_grid_index,enabled_channels,cube_chan_dim_size,
+						     bytes_per_cube_channel,bytes_per_sampling_function,conv._conv_FIR.nbytes)
+	plan.print_plan(npix_l,npix_m,psf_npix_l,psf_npix_m,resident_chunks)
+	cube_channel_groups = plan._cube_channel_groups
+      else:
+	cube_channel_groups = channel_indexer.compute_cube_channel_groups(channel_grid_index,enabled_channels,cube_chan_dim_size,
+									  bytes_per_cube_channel,bytes_per_sampling_function,
+									  parser_args['cube_memory_budget'] * execution_planner.MIB)
+      if len(cube_channel_groups) > 1:
+	print "IMAGING THE CUBE IN %d GROUPS OF CHANNELS" % len(cube_channel_groups)
+    if plan != None: #every measurement set is read in chunks that fit the plan
+      no_chunks = plan.no_chunks_for(data._no_rows)
+      chunk_size = int(np.ceil(data._no_rows / float(no_chunks)))
+    (group_lbound,group_ubound) = cube_channel_groups[group_index]
+    cube_group_size = group_ubound - group_lbound
+    (enabled_channels,channel_grid_index,
+     sampling_function_channel_grid_index,sampling_function_channel_count) = channel_indexer.select_cube_channel_group(cube_channel_groups[group_index],
+															channel_grid_index,enabled_channels,
+															sampling_function_channel_grid_index)
+    group_channels_to_image = [c for c in channels_to_image if enabled_channels[c]]
+    if len(cube_channel_groups) > 1:
+      print "GRIDDING CUBE CHANNELS %d TO %d" % (group_lbound,group_ubound - 1)
 
-    if parser_args['output_psf'] or (parser_args['sample_weighting'] == 'uniform'):
-      if sampling_funct == None:
-	sampling_funct = np.zeros([num_facet_grids,sampling_function_channel_count,1,npix_l,npix_m],dtype=base_types.psf_type)
+    '''
+    allocate enough memory to compute image and or facets (only before gridding the first MS of every group of cube channels)
+    '''
+    if parser_args['facet_geometry'] == None:
+      if not parser_args['do_jones_corrections']:
+	  if gridded_vis == None:
+	    gridded_vis = allocate_grid([num_facet_grids,cube_group_size,len(correlations_to_grid),npix_l,npix_m],base_types.grid_type)
+      else:
+	  if gridded_vis == None:
+	    gridded_vis = allocate_grid([num_facet_grids,cube_group_size,4,npix_l,npix_m],base_types.grid_type)
+
+      if parser_args['output_psf'] or weight_uniformly_after_gridding:
+	if sampling_funct == None:
+	  sampling_funct = allocate_grid([num_facet_grids,sampling_function_channel_count,1,psf_npix_l,psf_npix_m],base_types.psf_type)
+
+      '''
+      the inversion only writes out the unpadded window of every image
+      '''
+      if dirty_images == None:
+	dirty_images = np.zeros([num_facet_grids,cube_group_size,parser_args['npix_l'],parser_args['npix_m']],np.float32)
+      if parser_args['output_psf'] and psf_images == None:
+	psf_images = np.zeros([num_facet_grids,sampling_function_channel_count,psf_out_npix_l,psf_out_npix_m],np.float32)
+      dirty_image_buffer = dirty_images
+      psf_image_buffer = psf_images
+    elif gridded_vis == None:
+      '''
+      every facet starts on a 64 byte boundary (a multiple of 8 cells), so that FFTW can use its SIMD codelets on all of them.
+      The images of the facets are views of the flat image buffers
+      '''
+      no_grid_correlations = 4 if parser_args['do_jones_corrections'] else len(correlations_to_grid)
+      facet_grid_offsets = np.cumsum([0] + [(cube_group_size * no_grid_correlations * l * m + 7) // 8 * 8 for (l,m) in facet_grid_shapes])
+      facet_sampling_function_offsets = np.cumsum([0] + [(sampling_function_channel_count * l * m + 7) // 8 * 8 for (l,m) in facet_grid_shapes])
+      facet_image_offsets = np.cumsum([0] + [cube_group_size * l * m for (l,m) in facet_image_shapes])
+      facet_psf_image_offsets = np.cumsum([0] + [sampling_function_channel_count * l * m for (l,m) in facet_psf_shapes])
+      gridded_vis = allocate_grid([facet_grid_offsets[-1]],base_types.grid_type)
+      if parser_args['output_psf'] or weight_uniformly_after_gridding:
+	sampling_funct = allocate_grid([facet_sampling_function_offsets[-1]],base_types.psf_type)
+      dirty_image_buffer = np.zeros([facet_image_offsets[-1]],np.float32)
+      dirty_images = [dirty_image_buffer[facet_image_offsets[f]:facet_image_offsets[f+1]].reshape(cube_group_size,l,m)
+		      for f,(l,m) in enumerate(facet_image_shapes)]
+      if parser_args['output_psf']:
+	psf_image_buffer = np.zeros([facet_psf_image_offsets[-1]],np.float32)
+	psf_images = [psf_image_buffer[facet_psf_image_offsets[f]:facet_psf_image_offsets[f+1]].reshape(sampling_function_channel_count,l,m)
+		      for f,(l,m) in enumerate(facet_psf_shapes)]
+
+    '''
+    the images are normalized, combined into the requested stokes term and grid corrected by the backend while they
+    are being written out
+    '''
+    stokes_correlation_weights = stokes.create_stokes_correlation_weights(parser_args['do_jones_corrections'],data,
+									  correlations_to_grid,feeds_in_use,parser_args['pol'])
+    with filter_creation_timer:
+      grid_correction_l = conv.detaper(npix_l,parser_args['npix_l'])
+      grid_correction_m = conv.detaper(npix_m,parser_args['npix_m'])
+      psf_grid_correction_l = conv.detaper(psf_npix_l,psf_out_npix_l)
+      psf_grid_correction_m = conv.detaper(psf_npix_m,psf_out_npix_m)
+      facet_grid_corrections = [(conv.detaper(grid_l,l),conv.detaper(grid_m,m))
+				for ((grid_l,grid_m),(l,m)) in zip(facet_grid_shapes,facet_image_shapes)]
 
     '''
     initiate the backend imaging library
@@ -269,7 +532,7 @@ if __name__ == "__main__":
     params.should_invert_jones_terms = ctypes.c_bool(parser_args['do_jones_corrections']) #this ensures a deep copy
     params.imaging_field = ctypes.c_uint(parser_args['field_id']) #this ensures a deep copy
     params.channel_grid_indicies = channel_grid_index.ctypes.data_as(ctypes.c_void_p) #this won't change between chunks
-    params.cube_channel_dim_size = ctypes.c_size_t(cube_chan_dim_size) #this won't change between chunks
+    params.cube_channel_dim_size = ctypes.c_size_t(cube_group_size) #this won't change between chunks
     params.output_buffer = gridded_vis.ctypes.data_as(ctypes.c_void_p) #we never do 2 computes at the same time (or the reduction is handled at the C++ implementation level)
     params.baseline_count = ctypes.c_size_t(data._no_baselines) #this ensures a deep copy
     params.number_of_polarization_terms = ctypes.c_size_t(data._no_polarization_correlations) #this ensures a deep copy
@@ -279,14 +542,44 @@ if __name__ == "__main__":
     params.antenna_count = ctypes.c_size_t(data._no_antennae) #this ensures a deep copy
     params.enabled_channels = enabled_channels.ctypes.data_as(ctypes.c_void_p) #this won't change between chunks
     params.reference_wavelengths = data._chan_wavelengths.ctypes.data_as(ctypes.c_void_p) #this is part of the header of the MS and must stay constant between chunks
-    params.should_grid_sampling_function = ctypes.c_bool(parser_args['output_psf'] or (parser_args['sample_weighting'] == 'uniform'))
-    if parser_args['output_psf'] or (parser_args['sample_weighting'] == 'uniform'):
+    params.should_grid_sampling_function = ctypes.c_bool(parser_args['output_psf'] or weight_uniformly_after_gridding)
+    if parser_args['output_psf'] or weight_uniformly_after_gridding:
       params.sampling_function_buffer = sampling_funct.ctypes.data_as(ctypes.c_void_p) #we never do 2 computes at the same time (or the reduction is handled at the C++ implementation level)
       params.sampling_function_channel_grid_indicies = sampling_function_channel_grid_index.ctypes.data_as(ctypes.c_void_p) #this won't change between chunks
       params.sampling_function_channel_count = ctypes.c_size_t(sampling_function_channel_count) #this won't change between chunks
+    params.psf_nx = ctypes.c_size_t(psf_npix_m) #this ensures a deep copy
+    params.psf_ny = ctypes.c_size_t(psf_npix_l) #this ensures a deep copy
+    params.image_buffer = dirty_image_buffer.ctypes.data_as(ctypes.c_void_p)
+    params.image_nx = ctypes.c_size_t(parser_args['npix_m']) #this ensures a deep copy
+    params.image_ny = ctypes.c_size_t(parser_args['npix_l']) #this ensures a deep copy
+    if parser_args['output_psf']:
+      params.psf_image_buffer = psf_image_buffer.ctypes.data_as(ctypes.c_void_p)
+    params.psf_image_nx = ctypes.c_size_t(psf_out_npix_m) #this ensures a deep copy
+    params.psf_image_ny = ctypes.c_size_t(psf_out_npix_l) #this ensures a deep copy
+    params.stokes_correlation_weights = stokes_correlation_weights.ctypes.data_as(ctypes.c_void_p)
+    params.grid_correction_x = grid_correction_m.ctypes.data_as(ctypes.c_void_p)
+    params.grid_correction_y = grid_correction_l.ctypes.data_as(ctypes.c_void_p)
+    params.psf_grid_correction_x = psf_grid_correction_m.ctypes.data_as(ctypes.c_void_p)
+    params.psf_grid_correction_y = psf_grid_correction_l.ctypes.data_as(ctypes.c_void_p)
 
     params.num_facet_centres = ctypes.c_size_t(max(1,num_facet_centres)) #stays constant between strides
     params.facet_centres = facet_centres.ctypes.data_as(ctypes.c_void_p)
+    if parser_args['facet_geometry'] != None:
+      facet_geometries = (gridding_parameters.facet_geometry * num_facet_grids)()
+      for f,g in enumerate(facet_geometries):
+	g.nx = facet_grid_shapes[f][1]
+	g.ny = facet_grid_shapes[f][0]
+	g.cell_size_x = facet_cell_sizes[f][1]
+	g.cell_size_y = facet_cell_sizes[f][0]
+	g.image_nx = facet_image_shapes[f][1]
+	g.image_ny = facet_image_shapes[f][0]
+	g.grid_correction_x = facet_grid_corrections[f][1].ctypes.data_as(ctypes.c_void_p)
+	g.grid_correction_y = facet_grid_corrections[f][0].ctypes.data_as(ctypes.c_void_p)
+	g.grid_offset = int(facet_grid_offsets[f])
+	g.sampling_function_grid_offset = int(facet_sampling_function_offsets[f])
+	g.image_offset = int(facet_image_offsets[f])
+	g.psf_image_offset = int(facet_psf_image_offsets[f])
+      params.facet_geometries = ctypes.cast(facet_geometries,ctypes.c_void_p)
 
     if len(correlations_to_grid) == 1 and not parser_args['do_jones_corrections']:
 	pol_index = data._polarization_correlations.tolist().index(correlations_to_grid[0])
@@ -301,6 +594,49 @@ if __name__ == "__main__":
     #pass in the necessary parameters for w-projection
     params.wplanes = ctypes.c_size_t(parser_args['wplanes'])
     params.wmax_est = base_types.uvw_ctypes_convert_type(w_max)
+    #the averaging tolerance applies at the edge of the imaged field (the furthest facet edge when faceting)
+    params.averaging_smearing_tolerance = base_types.uvw_ctypes_convert_type(parser_args['baseline_dependent_averaging'])
+    field_radius = max([np.sqrt((l*cell_l*0.5)**2 + (m*cell_m*0.5)**2) for ((l,m),(cell_l,cell_m)) in zip(facet_grid_shapes,facet_cell_sizes)])
+    if num_facet_centres != 0:
+      field_radius += np.max(np.sqrt(np.sum((facet_centres - data._field_centres[parser_args['field_id'],0,:])**2,axis=1)))
+    params.averaging_field_radius = base_types.uvw_ctypes_convert_type(field_radius)
+    params.should_average_per_facet = ctypes.c_bool(parser_args['average_per_facet'])
+    params.should_coalesce_visibilities = ctypes.c_bool(parser_args['coalesce_visibilities'])
+    params.should_block_facets = ctypes.c_bool(parser_args['facet_blocking'])
+    params.should_tile_grids = ctypes.c_bool(parser_args['tiled_grid_layout'])
+    params.should_use_planar_grids = ctypes.c_bool(parser_args['planar_grid_layout'])
+    params.should_use_robust_weighting = ctypes.c_bool(parser_args['sample_weighting'] == 'robust')
+    params.weighting_robustness = base_types.uvw_ctypes_convert_type(parser_args['robustness'])
+    params.weighting_density_scale = ctypes.c_size_t(parser_args['super_uniform_scale'])
+    params.should_fuse_sampling_function = ctypes.c_bool(parser_args['fused_psf_gridding'])
+    params.fft_planning_rigour = ctypes.c_size_t(['estimate','measure','patient'].index(parser_args['fft_planning']))
+    params.fft_wisdom_directory = fft_wisdom_dir
+    params.should_grid_half_plane = ctypes.c_bool(parser_args['hermitian_grids'])
+    params.should_stream_grids = ctypes.c_bool(grid_scratch_dir != None)
+    '''
+    the library can write the FITS images itself, each facet as soon as it has been inverted (the group of cube channels
+    being imaged is written into cubes that are created by the first group)
+    '''
+    if parser_args['native_fits_export']:
+      image_prefixes = [parser_args['output_prefix'] if num_facet_centres == 0 else parser_args['output_prefix']+"_facet"+str(f)
+			for f in range(0, max(1,num_facet_centres))]
+      fits_image_names = (ctypes.c_char_p * len(image_prefixes))(*[prefix+'.fits' for prefix in image_prefixes])
+      params.fits_image_names = ctypes.cast(fits_image_names,ctypes.c_void_p)
+      if parser_args['output_psf']:
+	fits_psf_names = (ctypes.c_char_p * (len(image_prefixes) * len(group_channels_to_image)))(*[prefix+('.spw%d.ch%d.psf.fits' % (c / data._no_channels,c % data._no_channels))
+												  for prefix in image_prefixes for c in group_channels_to_image])
+	params.fits_psf_names = ctypes.cast(fits_psf_names,ctypes.c_void_p)
+	fits_psf_wavelengths = np.array([data._chan_wavelengths[c / data._no_channels,c % data._no_channels] for c in group_channels_to_image],dtype=np.float64)
+	params.fits_psf_wavelengths = fits_psf_wavelengths.ctypes.data_as(ctypes.c_void_p)
+      params.should_compress_fits = ctypes.c_bool(parser_args['compress_fits'])
+      params.fits_polarization = ctypes.c_int(fits_export.FITS_POLARIZATION_CLASSIFIERS[parser_args['pol']])
+      fits_image_centres = facet_centres if num_facet_centres != 0 else data._field_centres[parser_args['field_id'],0:1,:].astype(base_types.uvw_type)
+      fits_image_centres = np.ascontiguousarray(fits_image_centres)
+      params.fits_image_centres = fits_image_centres.ctypes.data_as(ctypes.c_void_p)
+      params.fits_reference_wavelength = ctypes.c_double(cube_first_wavelength)
+      params.fits_delta_wavelength = ctypes.c_double(cube_delta_wavelength)
+      params.fits_cube_channel_dim_size = ctypes.c_size_t(cube_chan_dim_size)
+      params.fits_first_cube_channel = ctypes.c_size_t(group_lbound)
     libimaging.initLibrary(ctypes.byref(params))
 
     '''
@@ -314,7 +650,8 @@ if __name__ == "__main__":
       chunk_linecount = chunk_ubound - chunk_lbound
       print "READING CHUNK %d OF %d" % (chunk_index+1,no_chunks)
       data.read_data(start_row=chunk_lbound,no_rows=chunk_linecount,data_column = parser_args['data_column'],
-		       do_romein_baseline_ordering=(parser_args['use_back_end'] == 'GPU'))
+		       do_romein_baseline_ordering=(parser_args['use_back_end'] == 'GPU'),
+		       model_column = parser_args['subtract_model_column'])
 
       '''
       after the compute of the previous cycle finishes make deep copies and
@@ -324,6 +661,8 @@ if __name__ == "__main__":
 
       arr_data_cpy = data._arr_data #gridding will operate on deep copied memory
       params.visibilities = arr_data_cpy.ctypes.data_as(ctypes.c_void_p)
+      arr_model_data_cpy = data._arr_model_data #gridding will operate on deep copied memory
+      params.model_visibilities = arr_model_data_cpy.ctypes.data_as(ctypes.c_void_p) if arr_model_data_cpy is not None else None
       arr_uvw_cpy = data._arr_uvw #gridding will operate on deep copied memory
       params.uvw_coords = arr_uvw_cpy.ctypes.data_as(ctypes.c_void_p)
       arr_weights_cpy = data._arr_weights #gridding will operate on deep copied memory
@@ -346,11 +685,20 @@ if __name__ == "__main__":
       params.antenna_2_ids = arr_antenna_2_cpy.ctypes.data_as(ctypes.c_void_p)
       arr_time_indicies_cpy = data._time_indicies #gridding will operate with deep copied data
       params.timestamp_ids = arr_time_indicies_cpy.ctypes.data_as(ctypes.c_void_p)
+      if imaging_pass == 'weighting': #only accumulate the weight densities, everything is gridded in the next pass
+	libimaging.accumulate_imaging_weight_densities(ctypes.byref(params))
+	continue
+      if compute_imaging_weights: #replace the natural weights with imaging weights (before any averaging)
+	if not separate_weighting_pass:
+	  libimaging.accumulate_imaging_weight_densities(ctypes.byref(params))
+	libimaging.apply_imaging_weights(ctypes.byref(params))
       if parser_args['use_back_end'] == 'GPU':
 	with data_set_loader.data_set_loader.time_to_load_chunks:
 	  starting_indexes = np.zeros([data._no_baselines+1],dtype=np.intp) #this must be n(n-1)/2+n+1 since we want to be able to compute the number of timestamps for the last baseline
 	  params.baseline_starting_indexes = starting_indexes.ctypes.data_as(ctypes.c_void_p)
 	  libimaging.repack_input_data(ctypes.byref(params))
+      if parser_args['baseline_dependent_averaging'] > 0 and not parser_args['average_per_facet']:
+	libimaging.average_baselines(ctypes.byref(params))
       '''
       no need to grid more than one of the correlations if the user isn't interrested in imaging one of the stokes terms (I,Q,U,V) or the stokes terms are the correlation products:
       '''
@@ -375,133 +723,143 @@ if __name__ == "__main__":
 	  else: #skip the jones corrections
 	    libimaging.facet_4_cor(ctypes.byref(params))
       '''
-      Now grid the psfs
+      Now grid the psfs (unless they were gridded along with the visibilities)
       '''
-      if parser_args['output_psf'] or (parser_args['sample_weighting'] == 'uniform'):
+      if (parser_args['output_psf'] or weight_uniformly_after_gridding) and not parser_args['fused_psf_gridding']:
 	if (num_facet_centres == 0):
 	  libimaging.grid_sampling_function(ctypes.byref(params))
 	else:
 	  libimaging.facet_sampling_function(ctypes.byref(params))
 
-  '''
-  before compacting everything we better normalize
-  '''
-  if parser_args['sample_weighting'] == 'uniform':
-    libimaging.weight_uniformly(ctypes.byref(params))
-  libimaging.normalize(ctypes.byref(params))
+    '''
+    the current group of cube channels is complete once all the passes over all the measurement sets are done
+    '''
+    if imaging_pass != imaging_passes[-1] or ms_index != len(ms_names) - 1:
+      continue
 
-  '''
-  Compute the stokes term from the gridded visibilities (here we're passing a view)
-  '''
-  command_line_options.create_stokes_term_from_gridded_vis(parser_args['do_jones_corrections'],
-                                                           data,
-                                                           correlations_to_grid,
-                                                           feeds_in_use,
-                                                           gridded_vis.view(),
-                                                           parser_args['pol'])
+    '''
+    reduce the normalization terms before finalizing
+    '''
+    if weight_uniformly_after_gridding:
+      libimaging.weight_uniformly(ctypes.byref(params))
+    libimaging.normalize(ctypes.byref(params))
 
-  '''
-  now compact all the grids per facet into continuous blocks [channels,nx,ny]
-  ie. remove the extra temporary correlation term grids per facet. There will
-  still be some space left between the facets
-  '''
-  if parser_args['pol'] in ["I","Q","U","V"]:
-    for f in range(0,max(1,num_facet_centres)):
-      for c in range(0,cube_chan_dim_size):
-	shift_count = (len(correlations_to_grid) - 1) * c # there are pol-1 blank spaces between channel grids
-	nf = shift_count % len(correlations_to_grid)
-	nc = shift_count / len(correlations_to_grid)
-	gridded_vis[f,nc,nf,:,:] = gridded_vis[f,c,0,:,:]
+    '''
+    now finalize images (normalize, combine the correlations into the stokes term, invert and grid correct)
+    '''
+    libimaging.finalize(ctypes.byref(params))
 
-  '''
-  now finalize images
-  '''
-  libimaging.finalize(ctypes.byref(params))
+    if parser_args['output_psf']:
+      libimaging.finalize_psf(ctypes.byref(params))
 
-  if parser_args['output_psf']:
-    libimaging.finalize_psf(ctypes.byref(params))
+    '''
+    finally we can write to disk (the dirty image cubes are written a group of channels at a time)
+    '''
+    for f in range(0, max(1,num_facet_centres)):
+      image_prefix = parser_args['output_prefix'] if num_facet_centres == 0 else parser_args['output_prefix']+"_facet"+str(f)
+      if parser_args['output_format'] == 'png':
+	png_export.png_export(dirty_images[f][0,:,:],image_prefix,None)
+	if parser_args['open_default_viewer']:
+	  os.system("xdg-open %s.png" % image_prefix)
+	if parser_args['output_psf']:
+	  for i,c in enumerate(group_channels_to_image):
+	    psf = psf_images[f][i,:,:]
+	    psf /= np.max(psf)
+	    spw_no = c / data._no_channels
+	    chan_no = c % data._no_channels
+	    png_export.png_export(psf,
+				  image_prefix+('.spw%d.ch%d.psf' % (spw_no,chan_no)),None)
+
+      elif parser_args['native_fits_export']: #the library has already written out the FITS cubes and PSFs of this group
+	if group_index == len(cube_channel_groups) - 1 and parser_args['open_default_viewer']:
+	  os.system("xdg-open %s.fits" % image_prefix)
+      else: #export to FITS cube
+	ra = data._field_centres[parser_args['field_id'],0,0]
+	dec = data._field_centres[parser_args['field_id'],0,1]
+	(npix_out_l,npix_out_m) = facet_image_shapes[f]
+	(cell_l,cell_m) = facet_cell_sizes[f]
+	offset_coord_l = (0 if num_facet_centres == 0 else facet_centres[f,0] - ra) / cell_l
+	centre_coord_l = (npix_out_l * 0.5 + 1) + offset_coord_l
+	offset_coord_m = (0 if num_facet_centres == 0 else facet_centres[f,1] - dec) / cell_m
+	centre_coord_m = (npix_out_m * 0.5 + 1) - offset_coord_m
+	if f not in cube_writers:
+	  cube_writers[f] = fits_export.fits_cube_writer(image_prefix+'.fits',
+							 npix_out_l,npix_out_m,
+							 quantity(cell_l,'arcsec'),quantity(cell_m,'arcsec'),
+							 centre_coord_l,centre_coord_m,
+							 quantity(ra,'arcsec'),
+							 quantity(dec,'arcsec'),
+							 parser_args['pol'],
+							 cube_first_wavelength,
+							 cube_delta_wavelength,
+							 cube_chan_dim_size,
+							 dirty_images[f].dtype)
+	cube_writers[f].write_channels(dirty_images[f][:,:,:])
+	if group_index == len(cube_channel_groups) - 1:
+	  cube_writers.pop(f).close()
+	  if parser_args['open_default_viewer']:
+	    os.system("xdg-open %s.fits" % image_prefix)
+	if parser_args['output_psf']:
+	  for i,c in enumerate(group_channels_to_image):
+	    psf = psf_images[f][i:i+1,:,:]
+	    psf /= np.max(psf)
+	    spw_no = c / data._no_channels
+	    chan_no = c % data._no_channels
+	    ra = data._field_centres[parser_args['field_id'],0,0]
+	    dec = data._field_centres[parser_args['field_id'],0,1]
+	    (psf_npix_out_l,psf_npix_out_m) = facet_psf_shapes[f]
+	    offset_coord_l = (0 if num_facet_centres == 0 else facet_centres[f,0] - ra) / cell_l
+	    centre_coord_l = (psf_npix_out_l * 0.5 + 1) + offset_coord_l
+	    offset_coord_m = (0 if num_facet_centres == 0 else facet_centres[f,1] - dec) / cell_m
+	    centre_coord_m = (psf_npix_out_m * 0.5 + 1) - offset_coord_m
+	    fits_export.save_to_fits_image(image_prefix+('.spw%d.ch%d.psf.fits' % (spw_no,chan_no)),
+					   psf_npix_out_l,psf_npix_out_m,
+					   quantity(cell_l,'arcsec'),quantity(cell_m,'arcsec'),
+					   centre_coord_l,centre_coord_m,
+					   quantity(ra,'arcsec'),
+					   quantity(dec,'arcsec'),
+					   parser_args['pol'],
+					   data._chan_wavelengths[spw_no,chan_no],
+					   0,
+					   1,
+					   psf)
 
-  '''
-  finally we can write to disk
-  '''
-  for f in range(0, max(1,num_facet_centres)):
-    image_prefix = parser_args['output_prefix'] if num_facet_centres == 0 else parser_args['output_prefix']+"_facet"+str(f)
-    if parser_args['output_format'] == 'png':
-      offset = len(correlations_to_grid)*npix_l*npix_l*f*np.dtype(np.float32).itemsize
-      dirty = np.ctypeslib.as_array(ctypes.cast(gridded_vis.ctypes.data + offset, ctypes.POINTER(ctypes.c_float)),
-				    shape=(npix_l,npix_m))
-      png_export.png_export(dirty[l_left_margin:l_right_margin,m_left_margin:m_right_margin],image_prefix,None)
-      if parser_args['open_default_viewer']:
-	os.system("xdg-open %s.png" % image_prefix)
-      if parser_args['output_psf']:
-	for i,c in enumerate(channels_to_image):
-	  offset = npix_m*npix_l*f*np.dtype(np.float32).itemsize
-	  psf = np.ctypeslib.as_array(ctypes.cast(sampling_funct.ctypes.data + offset, ctypes.POINTER(ctypes.c_float)),
-				      shape=(npix_l,npix_m))
-	  psf /= np.max(psf)
-	  spw_no = c / data._no_channels
-	  chan_no = c % data._no_channels
-	  png_export.png_export(psf[l_left_margin:l_right_margin,m_left_margin:m_right_margin],
-				image_prefix+('.spw%d.ch%d.psf' % (spw_no,chan_no)),None)
-
-    else: #export to FITS cube
-      ra = data._field_centres[parser_args['field_id'],0,0]
-      dec = data._field_centres[parser_args['field_id'],0,1]
-      offset_coord_l = (0 if num_facet_centres == 0 else facet_centres[f,0] - ra) / parser_args['cell_l']
-      centre_coord_l = (parser_args['npix_l'] * 0.5 + 1) + offset_coord_l
-      offset_coord_m = (0 if num_facet_centres == 0 else facet_centres[f,1] - dec) / parser_args['cell_m']
-      centre_coord_m = (parser_args['npix_m'] * 0.5 + 1) - offset_coord_m
-      offset = cube_chan_dim_size*len(correlations_to_grid)*npix_l*npix_m*f*np.dtype(np.float32).itemsize
-      dirty = np.ctypeslib.as_array(ctypes.cast(gridded_vis.ctypes.data + offset, ctypes.POINTER(ctypes.c_float)),
-				    shape=(cube_chan_dim_size,npix_l,npix_m))
-
-      fits_export.save_to_fits_image(image_prefix+'.fits',
-				     parser_args['npix_l'],parser_args['npix_m'],
-				     quantity(parser_args['cell_l'],'arcsec'),quantity(parser_args['cell_m'],'arcsec'),
-				     centre_coord_l,centre_coord_m,
-				     quantity(ra,'arcsec'),
-				     quantity(dec,'arcsec'),
-				     parser_args['pol'],
-				     cube_first_wavelength,
-				     cube_delta_wavelength,
-				     cube_chan_dim_size,
-				     dirty[:,l_left_margin:l_right_margin,m_left_margin:m_right_margin])
-      if parser_args['open_default_viewer']:
-	os.system("xdg-open %s.fits" % image_prefix)
-      if parser_args['output_psf']:
-	for i,c in enumerate(channels_to_image):
-	  offset = i*npix_l*npix_m*f*np.dtype(np.float32).itemsize
-	  psf = np.ctypeslib.as_array(ctypes.cast(sampling_funct.ctypes.data + offset, ctypes.POINTER(ctypes.c_float)),
-				      shape=(1,npix_l,npix_m))
-	  psf /= np.max(psf)
-	  spw_no = c / data._no_channels
-	  chan_no = c % data._no_channels
-	  ra = data._field_centres[parser_args['field_id'],0,0]
-	  dec = data._field_centres[parser_args['field_id'],0,1]
-	  offset_coord_l = (0 if num_facet_centres == 0 else facet_centres[f,0] - ra) / parser_args['cell_l']
-	  centre_coord_l = (parser_args['npix_l'] * 0.5 + 1) + offset_coord_l
-	  offset_coord_m = (0 if num_facet_centres == 0 else facet_centres[f,1] - dec) / parser_args['cell_m']
-	  centre_coord_m = (parser_args['npix_m'] * 0.5 + 1) - offset_coord_m
-	  fits_export.save_to_fits_image(image_prefix+('.spw%d.ch%d.psf.fits' % (spw_no,chan_no)),
-					 parser_args['npix_l'],parser_args['npix_m'],
-					 quantity(parser_args['cell_l'],'arcsec'),quantity(parser_args['cell_m'],'arcsec'),
-					 centre_coord_l,centre_coord_m,
-					 quantity(ra,'arcsec'),
-					 quantity(dec,'arcsec'),
-					 parser_args['pol'],
-					 data._chan_wavelengths[spw_no,chan_no],
-					 0,
-					 1,
-					 psf[:,l_left_margin:l_right_margin,m_left_margin:m_right_margin])
+    '''
+    stitch the facets of this group of cube channels together (in memory, straight from the facet images)
+    '''
+    if parser_args['stitch_facets']: #we've already checked that there are multiple facets before this line
+      params.mosaic_feather_width = ctypes.c_size_t(parser_args['mosaic_feather_width'])
+      libimaging.compute_mosaic_size(ctypes.byref(params))
+      mosaic = np.empty([cube_group_size,params.mosaic_ny,params.mosaic_nx],np.float32)
+      params.mosaic_buffer = mosaic.ctypes.data_as(ctypes.c_void_p)
+      libimaging.mosaic_facets(ctypes.byref(params))
+      if mosaic_writer == None:
+	print "STITCHING %d FACETS INTO A %d x %d MOSAIC" % (num_facet_centres,params.mosaic_nx,params.mosaic_ny)
+	mosaic_writer = fits_export.fits_cube_writer(parser_args['output_prefix']+'.combined.fits',
+						     params.mosaic_nx,params.mosaic_ny,
+						     quantity(parser_args['cell_l'],'arcsec'),quantity(parser_args['cell_m'],'arcsec'),
+						     params.mosaic_nx * 0.5 + 1,params.mosaic_ny * 0.5 + 1,
+						     quantity(data._field_centres[parser_args['field_id'],0,0],'arcsec'),
+						     quantity(data._field_centres[parser_args['field_id'],0,1],'arcsec'),
+						     parser_args['pol'],
+						     cube_first_wavelength,
+						     cube_delta_wavelength,
+						     cube_chan_dim_size,
+						     mosaic.dtype)
+      mosaic_writer.write_channels(mosaic)
+      if group_index == len(cube_channel_groups) - 1:
+	mosaic_writer.close()
+	if parser_args['open_default_viewer']:
+	  os.system("xdg-open %s.combined.fits" % parser_args['output_prefix'])
 
-  '''
-  attempt to stitch the facets together:
-  '''
-  if parser_args['stitch_facets']: #we've already checked that there are multiple facets before this line
-    print "ATTEMPTING TO MOSAIC FACETS USING MONTAGE (MUST BE IN ENV PATH)"
-    facet_list_parser.output_mosaic(parser_args['output_prefix'],num_facet_centres)
-    if parser_args['open_default_viewer']:
-	os.system("xdg-open %s.combined.fits" % parser_args['output_prefix'])
+    '''
+    release the grids of this group before the next group of cube channels is imaged
+    '''
+    libimaging.releaseLibrary()
+    gridded_vis = None
+    sampling_funct = None
+    dirty_images = None
+    psf_images = None
 
   print "FINISHED WORK SUCCESSFULLY"
   total_run_time.stop()
@@ -511,7 +869,9 @@ if __name__ == "__main__":
   print "\t\tData loading and conversion time: %f secs" % data_set_loader.data_set_loader.time_to_load_chunks.elapsed()
   libimaging.get_gridding_walltime.restype = ctypes.c_double
   libimaging.get_inversion_walltime.restype = ctypes.c_double
+  libimaging.get_fft_planning_walltime.restype = ctypes.c_double
   print "\t\tGridding time: %f secs" % libimaging.get_gridding_walltime()
+  print "\tFFT planning time: %f secs" % libimaging.get_fft_planning_walltime()
   print "\tFourier inversion time: %f secs" % libimaging.get_inversion_walltime()
   print "\tTotal runtime: %f secs" % total_run_time.elapsed()
   libimaging.releaseLibrary()
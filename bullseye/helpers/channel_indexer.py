@@ -150,4 +150,57 @@ def compute_sampling_function_grid_indicies(data,channels_to_image,enabled_chann
     sampling_function_channel_grid_index[c] = current_grid
     if enabled_channels[c]:
       current_grid += 1
-  return (sampling_function_channel_grid_index,sampling_function_channel_count)
\ No newline at end of file
+  return (sampling_function_channel_grid_index,sampling_function_channel_count)
+def compute_cube_channel_bytes(channel_grid_index,enabled_channels,cube_chan_dim_size,
+			       bytes_per_cube_channel,bytes_per_sampling_function):
+  '''
+  Memory taken up by the grids and images of each cube channel: every enabled channel gridded into a cube channel adds
+  a sampling function
+  '''
+  sampling_functions_per_cube_channel = np.bincount(channel_grid_index[enabled_channels],minlength=cube_chan_dim_size)
+  return bytes_per_cube_channel + sampling_functions_per_cube_channel * bytes_per_sampling_function
+
+def compute_cube_channel_groups(channel_grid_index,enabled_channels,cube_chan_dim_size,
+				bytes_per_cube_channel,bytes_per_sampling_function,memory_budget):
+  '''
+  Splits the cube into groups of consecutive cube channels whose grids and images take up no more than memory_budget bytes
+  (each group holds at least one cube channel). A memory budget of 0 images the whole cube at once
+  '''
+  cube_channel_bytes = compute_cube_channel_bytes(channel_grid_index,enabled_channels,cube_chan_dim_size,
+						  bytes_per_cube_channel,bytes_per_sampling_function)
+  cube_channel_groups = []
+  group_lbound = 0
+  group_bytes = 0
+  for g in range(0,cube_chan_dim_size):
+    if memory_budget > 0 and g > group_lbound and group_bytes + cube_channel_bytes[g] > memory_budget:
+      cube_channel_groups.append((group_lbound,g))
+      group_lbound = g
+      group_bytes = 0
+    group_bytes += cube_channel_bytes[g]
+  cube_channel_groups.append((group_lbound,cube_chan_dim_size))
+  return cube_channel_groups
+
+def compute_cube_channel_group_bytes(cube_channel_groups,channel_grid_index,enabled_channels,
+				     bytes_per_cube_channel,bytes_per_sampling_function):
+  '''
+  Memory taken up by the grids and images of each group of cube channels
+  '''
+  cube_channel_bytes = compute_cube_channel_bytes(channel_grid_index,enabled_channels,cube_channel_groups[-1][1],
+						  bytes_per_cube_channel,bytes_per_sampling_function)
+  return [int(np.sum(cube_channel_bytes[l:u])) for l,u in cube_channel_groups]
+
+def select_cube_channel_group(cube_channel_group,channel_grid_index,enabled_channels,sampling_function_channel_grid_index):
+  '''
+  Restricts the enabled channels to those gridded into the given group of cube channels and renumbers their grids (and
+  sampling function grids) from the start of the group
+  '''
+  (group_lbound,group_ubound) = cube_channel_group
+  group_enabled_channels = enabled_channels & (channel_grid_index >= group_lbound) & (channel_grid_index < group_ubound)
+  group_channel_grid_index = np.where(group_enabled_channels,channel_grid_index - group_lbound,0).astype(np.intp)
+  if sampling_function_channel_grid_index is None:
+    return (group_enabled_channels,group_channel_grid_index,None,0)
+  sampling_function_lbound = np.min(sampling_function_channel_grid_index[group_enabled_channels])
+  group_sampling_function_channel_grid_index = np.where(group_enabled_channels,
+							sampling_function_channel_grid_index - sampling_function_lbound,0).astype(np.intp)
+  return (group_enabled_channels,group_channel_grid_index,group_sampling_function_channel_grid_index,
+	  int(np.count_nonzero(group_enabled_channels)))
@@ -48,6 +48,10 @@ def build_command_line_options_parser():
   parser.add_argument('--output_prefix', help='Prefix for the output FITS images. Facets will be indexed as [prefix_1.fits ... prefix_n.fits]', type=str, default='out.bullseye')
   parser.add_argument('--facet_centres', help='List of coordinate tupples indicating facet centres (RA,DEC).'
 		      'If none are specified and n_facet_l and/or n_facet_m are not set, the default pointing centre will be used', type=coords, nargs='+', default=None)
+  parser.add_argument('--facet_geometry', help='Gives every facet its own size and resolution, as one (npix_l,npix_m,cell_l,cell_m) tupple per facet '
+					      'in the order of the facet centres (eg. small high resolution facets on calibrators alongside a coarse '
+					      'facet over the whole field). All the facets are still imaged in a single pass over the data. Default: '
+					      'every facet is npix_l x npix_m pixels of cell_l x cell_m', type=facet_geometry, nargs='+', default=None)
   parser.add_argument('--npix_l', help='Number of facet pixels in l', type=int, default=256)
   parser.add_argument('--npix_m', help='Number of facet pixels in m', type=int, default=256)
   parser.add_argument('--cell_l', help='Size of a pixel in l (arcsecond)', type=float, default=1)
@@ -57,25 +61,71 @@ def build_command_line_options_parser():
   parser.add_argument('--conv_sup', help='Specify gridding convolution function half support area (number of convolution function cells)', type=int, default=5)
   parser.add_argument('--conv_oversamp', help='Specify gridding convolution function oversampling multiplier', type=int, default=63)
   parser.add_argument('--output_format', help='Specify image output format', choices=["fits","png"], default="fits")
+  parser.add_argument('--native_fits_export', help='Lets the imaging library write the FITS images and PSFs itself, each facet as soon as it has been '
+						   'inverted and all the facets in parallel', type=bool, default=False)
+  parser.add_argument('--compress_fits', help='Writes Rice tile-compressed FITS images (requires --native_fits_export)', type=bool, default=False)
   parser.add_argument('--no_chunks', help='Specify number of chunks to split measurement set into (useful to handle large measurement sets / overlap io and compute)', type=int, default=10)
   parser.add_argument('--field_id', help='Specify the id of the field (pointing) to image', type=int, default=0)
   parser.add_argument('--data_column', help='Specify the measurement set data column being imaged', type=str, default='DATA')
+  parser.add_argument('--subtract_model_column', help='Specify a model data column to subtract from the data column while gridding (creates a residual image). Default off', type=str, default=None)
   parser.add_argument('--do_jones_corrections',help='Enables applying corrective jones terms per facet. Requires number of'
 						    ' facet centers to be the same as the number of directions in the calibration.',type=bool,default=False)
   parser.add_argument('--n_facets_l', help='Automatically add coordinates for this number of facets in l', type=int, default=0)
   parser.add_argument('--n_facets_m', help='Automatically add coordinates for this number of facets in m', type=int, default=0)
-  parser.add_argument('--stitch_facets', help='Will attempt to stitch facets together using Montage', type=bool, default=False)
+  parser.add_argument('--stitch_facets', help='Stitches the facets together into a single image (the facets are resampled onto the plane of the phase '
+					      'centre and blended in memory, and written out to \'prefix\'.combined.fits)', type=bool, default=False)
+  parser.add_argument('--mosaic_feather_width', help='Number of pixels over which the facets are feathered into each other where they overlap '
+						     'when stitching them together', type=int, default=16)
   parser.add_argument('--channel_select', help="Specify list of spectral windows and channels to image, each with the format 'spw index':'comma-seperated list of channels, "
 					       "for example --channel_select 0:1,3~5,7 will select channels 1,3,4,5,7 from spw 0. Default all",
 		      type=channel_range, nargs='+', default=None)
   parser.add_argument('--average_spw_channels', help='Averages selected channels in each spectral window', type=bool, default=False)
   parser.add_argument('--average_all', help='Averages all selected channels together into a single image', type=bool, default=False)
+  parser.add_argument('--baseline_dependent_averaging', help='Enables baseline dependent time and frequency averaging of the data before gridding. Specifies the maximum '
+							      'phase drift (in radians) allowed at the edge of the imaged field. Default 0 (disabled)', type=float, default=0)
+  parser.add_argument('--average_per_facet', help='Rotates the data to each facet centre before doing baseline dependent averaging, so that the tolerance only '
+						   'has to hold over a facet. Permits much longer averaging intervals when imaging many small facets', type=bool, default=False)
+  parser.add_argument('--coalesce_visibilities', help='Sums consecutive visibilities of a baseline that land on the same grid cell, kernel offset and w-plane '
+						       'before convolving them (useful with dense uv coverage)', type=bool, default=False)
+  parser.add_argument('--facet_blocking', help='Reads each block of data only once and grids it into a batch of facets per thread, instead of streaming all '
+					       'the data once per facet (reduces memory traffic when imaging many facets)', type=bool, default=False)
+  parser.add_argument('--tiled_grid_layout', help='Stores the uv grids in 32x32 cell tiles while gridding (reduces TLB and cache misses on very large grids). '
+						  'Tiles only take up memory once they are gridded to, so grids with sparse uv coverage (long baselines, '
+						  'high resolution facets) stay sparse until they are inverted. The image dimensions must be multiples of 32', 
+		      type=bool, default=False)
+  parser.add_argument('--planar_grid_layout', help='Stores the real and imaginary components of the uv grids in seperate planes while gridding '
+						   '(lets the AVX gridders accumulate with plain fused multiply-adds)', type=bool, default=False)
+  parser.add_argument('--hermitian_grids', help='Only grids the half of the uv plane with non-negative u, folding the conjugate baselines onto it, and '
+					       'inverts it with complex-to-real FFTs (halves the grid memory touched and the FFT work). The padded '
+					       'image dimensions must be even', type=bool, default=False)
   parser.add_argument('--output_psf',help='Outputs the Point Spread Function (per channel)',type=bool,default=False)
-  parser.add_argument('--sample_weighting',help='Specify weighting technique in use.',choices=['natural','uniform'], default='natural')
+  parser.add_argument('--psf_cutout',help='Only computes the Point Spread Function over this many pixels (per axis) around its centre, by gridding it '
+					   'at a coarser uv cell size. Default 0 (full size)', type=int, default=0)
+  parser.add_argument('--fused_psf_gridding',help='Grids the Point Spread Function in the same pass over the data as the visibilities, sharing the '
+						   'uv coordinate and convolution kernel computations', type=bool, default=False)
+  parser.add_argument('--sample_weighting',help='Specify weighting technique in use.',choices=['natural','uniform','robust'], default='natural')
+  parser.add_argument('--robustness',help='Briggs robustness parameter used by robust weighting (-2 is close to uniform, 2 is close to natural weighting)',
+		      type=float, default=0)
+  parser.add_argument('--super_uniform_scale',help='Counts the weight density over boxes of this many uv cells per axis when weighting uniformly '
+						   'or robustly (super-uniform weighting when > 1)', type=int, default=1)
   parser.add_argument('--open_default_viewer',help='Uses \'xdg-open\' to fire up the user\'s image viewer of choice.',default=False)
   parser.add_argument('--use_back_end',help='Switch between \'CPU\' or \'GPU\' imaging library.', choices=['CPU','GPU'], default='CPU')
   parser.add_argument('--precision',help='Force bullseye to use single / double precision when gridding', choices=['single','double'], default='single')
   parser.add_argument('--wplanes',help='Number of w-planes to use (1 disables w-projection)', type=int, default=1)
+  parser.add_argument('--fft_planning',help='Sets how much effort FFTW spends on finding fast Fourier inversion plans (\'measure\' and \'patient\' '
+					  'time candidate plans when the library starts up)', choices=['estimate','measure','patient'], default='measure')
+  parser.add_argument('--fft_wisdom_dir',help='Directory where tuned FFTW plans are stored and reused between runs (an empty string disables this)',
+		      default='~/.cache/bullseye')
+  parser.add_argument('--grid_scratch_dir',help='Keeps the uv grids in memory-mapped scratch files in this directory (preferably on fast local '
+						 'storage) instead of RAM, for facet sets larger than memory. An empty string keeps the grids in RAM',
+		      default='')
+  parser.add_argument('--cube_memory_budget',help='Images spectral cubes a group of output channels at a time, so that the grids and images of '
+						   'each group fit in this many MiB (the data is read once per group and the FITS cubes are written '
+						   'as the groups complete). 0 images all the channels at once', type=float, default=0)
+  parser.add_argument('--memory_budget',help='Plans the imaging to fit in this many MiB of RAM: picks the number of chunks, the groups of cube '
+					    'channels imaged together and FFT friendly padded grid sizes, and prints the plan before any grids '
+					    'are allocated. 0 disables planning (--no_chunks and --cube_memory_budget are then used as given)', 
+		      type=float, default=0)
   parser.add_argument('--image_padding',help='Sets the FFT edge padding factor (the edge of the image should be ignored/cut)', type=float, default=1.20)
   parser_args = vars(parser.parse_args())
   return (parser,parser_args)
@@ -43,4 +43,14 @@ def coords(s):
         ra, dec = map(float, sT[1:len(sT)-1].split(','))
         return ra, dec
     except:
-        raise argparse.ArgumentTypeError("Coordinates must be ra,dec tupples")
\ No newline at end of file
+        raise argparse.ArgumentTypeError("Coordinates must be ra,dec tupples")
+
+def facet_geometry(s):
+    try:
+	sT = s.strip()
+        npix_l, npix_m, cell_l, cell_m = map(float, sT[1:len(sT)-1].split(','))
+        if npix_l != int(npix_l) or npix_m != int(npix_m):
+	  raise ValueError()
+        return int(npix_l), int(npix_m), cell_l, cell_m
+    except:
+        raise argparse.ArgumentTypeError("Facet geometries must be npix_l,npix_m,cell_l,cell_m tupples")
@@ -178,30 +178,32 @@ class data_set_loader(object):
       Arguments:
       start_row moves the reading cursor in the primary table
       no_rows specifies the number of rows to read (-1 == "read all")
+      model_column optionally specifies a model data column to read alongside the data column (for residual imaging)
       Assumes read_head has been called prior to this call
     '''
-    def read_data(self,start_row=0,no_rows=-1,data_column = "DATA",do_romein_baseline_ordering = False):
+    def read_data(self,start_row=0,no_rows=-1,data_column = "DATA",do_romein_baseline_ordering = False,model_column = None):
 	print "READING UVW VALUES, DATA, WEIGHTS AND FLAGS"
+	data_columns = data_column if model_column == None else data_column+","+model_column
         casa_ms_table = table(self._MSName,ack=False,readonly=True)        
         time_ordered_ms_table = None
         if self._should_read_jones_terms or do_romein_baseline_ordering:
 	  with data_set_loader.time_to_load_chunks:
 	    try:
-	      chopped_ms_table = taql("SELECT UVW,"+data_column+",WEIGHT_SPECTRUM,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
-	      time_ordered_ms_table = taql("SELECT UVW,"+data_column+",WEIGHT_SPECTRUM,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $chopped_ms_table ORDERBY TIME")
+	      chopped_ms_table = taql("SELECT UVW,"+data_columns+",WEIGHT_SPECTRUM,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
+	      time_ordered_ms_table = taql("SELECT UVW,"+data_columns+",WEIGHT_SPECTRUM,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $chopped_ms_table ORDERBY TIME")
 	      c = time_ordered_ms_table.getcol("WEIGHT_SPECTRUM")
 	      chopped_ms_table.close()
 	    except:
-	      chopped_ms_table = taql("SELECT UVW,"+data_column+",WEIGHT,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
-	      time_ordered_ms_table = taql("SELECT UVW,"+data_column+",WEIGHT,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $chopped_ms_table ORDERBY TIME")
+	      chopped_ms_table = taql("SELECT UVW,"+data_columns+",WEIGHT,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
+	      time_ordered_ms_table = taql("SELECT UVW,"+data_columns+",WEIGHT,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $chopped_ms_table ORDERBY TIME")
 	      chopped_ms_table.close()
 	else: #since we're not doing jones corrections or gpu imaging let's leave the table unordered (shaves a lot of time off the data loading)
 	  with data_set_loader.time_to_load_chunks:
 	    try:
-	      time_ordered_ms_table = taql("SELECT UVW,"+data_column+",WEIGHT_SPECTRUM,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
+	      time_ordered_ms_table = taql("SELECT UVW,"+data_columns+",WEIGHT_SPECTRUM,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
 	      c = time_ordered_ms_table.getcol("WEIGHT_SPECTRUM")
 	    except:
-	      time_ordered_ms_table = taql("SELECT UVW,"+data_column+",WEIGHT,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
+	      time_ordered_ms_table = taql("SELECT UVW,"+data_columns+",WEIGHT,FLAG,FLAG_ROW,DATA_DESC_ID,ANTENNA1,ANTENNA2,FIELD_ID,TIME FROM $casa_ms_table LIMIT $no_rows OFFSET $start_row")
 	no_rows = casa_ms_table.nrows() if no_rows==-1 else no_rows
         assert(no_rows > 0) #table is the empty set
         '''
@@ -216,6 +218,10 @@ class data_set_loader(object):
         '''
         with data_set_loader.time_to_load_chunks:
 	  self._arr_data = time_ordered_ms_table.getcol(data_column).astype(base_types.visibility_type)
+	self._arr_model_data = None
+	if model_column != None:
+	  with data_set_loader.time_to_load_chunks:
+	    self._arr_model_data = time_ordered_ms_table.getcol(model_column).astype(base_types.visibility_type)
         '''
             the weights column has dimensions: [0...obs_time_range*baselines-1][0...num_correlations-1]
             However this column only contains the averages accross all channels. The weight_spectrum column
@@ -0,0 +1,170 @@
+'''
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+'''
+
+import numpy as np
+import bullseye_mo.base_types as base_types
+import helpers.channel_indexer as channel_indexer
+
+MIB = 1024.0**2
+'''
+FFTW is fastest on sizes made up of small prime factors
+'''
+FFT_FRIENDLY_FACTORS = [2,3,5,7]
+'''
+gridding one chunk overlaps with reading the next one, so two chunks are resident while imaging (three when the 
+chunk is also averaged: the library keeps the averaged copy of the previous chunk)
+'''
+RESIDENT_CHUNKS = 2
+RESIDENT_CHUNKS_WHEN_AVERAGING = 3
+'''
+when the grids of the whole cube don't fit alongside the chunks requested on the command line, this fraction of
+the budget is set aside for the chunks and the rest is spent on the grids of each group of cube channels
+'''
+CHUNK_BUDGET_FRACTION = 0.25
+
+def is_fft_friendly(n):
+  for f in FFT_FRIENDLY_FACTORS:
+    while n % f == 0:
+      n /= f
+  return n == 1
+
+def fft_friendly_size(minimum_size,multiple_of=2):
+  '''
+  Smallest size of at least minimum_size that is a multiple of multiple_of and only has small prime factors
+  '''
+  n = int(np.ceil(minimum_size / float(multiple_of))) * multiple_of
+  while not is_fft_friendly(n):
+    n += multiple_of
+  return n
+
+def bytes_per_chunk_row(data,has_model_column):
+  '''
+  Memory taken up by each row of a chunk (see data_set_loader.read_data)
+  '''
+  samples = data._no_channels * data._no_polarization_correlations
+  return (samples * np.dtype(base_types.visibility_type).itemsize * (2 if has_model_column else 1) + #visibilities (and model)
+	  samples * np.dtype(base_types.weight_type).itemsize + #weight spectrum
+	  samples * np.dtype(np.bool_).itemsize + #flags
+	  3 * np.dtype(base_types.uvw_type).itemsize + #uvw coordinates
+	  np.dtype(np.bool_).itemsize + #row flags
+	  4 * np.dtype(np.int32).itemsize + #spw, field and antenna ids
+	  np.dtype(np.intp).itemsize) #timestamp indicies
+
+def bytes_per_cube_channel(num_facet_grids,npix_l,npix_m,image_npix_l,image_npix_m,no_grid_correlations,weight_density_scale = 0):
+  '''
+  Memory taken up by the grids and images of every cube channel (over all the facets). Imaging weights add a density 
+  grid of npix / weight_density_scale cells per axis (0 if no imaging weights are computed)
+  '''
+  channel_bytes = num_facet_grids * (npix_l * npix_m * np.dtype(base_types.grid_type).itemsize * no_grid_correlations +
+				     image_npix_l * image_npix_m * np.dtype(np.float32).itemsize)
+  if weight_density_scale > 0:
+    channel_bytes += (int(np.ceil(npix_l / float(weight_density_scale))) * int(np.ceil(npix_m / float(weight_density_scale))) *
+		      np.dtype(np.float64).itemsize)
+  return channel_bytes
+
+def bytes_per_sampling_function(num_facet_grids,psf_npix_l,psf_npix_m,psf_image_npix_l,psf_image_npix_m,output_psf):
+  '''
+  Memory taken up by the grids (and PSF images) of every sampling function channel (over all the facets)
+  '''
+  return num_facet_grids * (psf_npix_l * psf_npix_m * np.dtype(base_types.psf_type).itemsize +
+			    (psf_image_npix_l * psf_image_npix_m * np.dtype(np.float32).itemsize if output_psf else 0))
+
+class execution_plan(object):
+  '''
+  Chunking of the measurement sets and grouping of the cube channels that keeps the imaging within a memory budget
+  '''
+  def __init__(self,memory_budget,no_chunks,max_chunk_rows,chunk_bytes,cube_channel_groups,group_bytes,kernel_bytes):
+    self._memory_budget = memory_budget
+    self._no_chunks = no_chunks
+    self._max_chunk_rows = max_chunk_rows
+    self._chunk_bytes = chunk_bytes
+    self._cube_channel_groups = cube_channel_groups
+    self._group_bytes = group_bytes
+    self._kernel_bytes = kernel_bytes
+
+  def no_chunks_for(self,no_rows):
+    '''
+    Number of chunks to read a measurement set of no_rows rows in (at least the number planned for the first one)
+    '''
+    return max(self._no_chunks,int(np.ceil(no_rows / float(self._max_chunk_rows))))
+
+  def predicted_peak_memory(self):
+    return self._kernel_bytes + self._chunk_bytes + max(self._group_bytes)
+
+  def print_plan(self,npix_l,npix_m,psf_npix_l,psf_npix_m,resident_chunks):
+    print "EXECUTION PLAN FOR A MEMORY BUDGET OF %.1f MiB:" % (self._memory_budget / MIB)
+    print "\tPADDED GRID SIZE %d x %d (PSF %d x %d)" % (npix_l,npix_m,psf_npix_l,psf_npix_m)
+    print "\t%d CHUNKS PER MEASUREMENT SET (AT MOST %d ROWS, %.1f MiB FOR %d RESIDENT CHUNKS)" % (self._no_chunks,self._max_chunk_rows,
+												 self._chunk_bytes / MIB,resident_chunks)
+    print "\t%d GROUPS OF CUBE CHANNELS (AT MOST %d CHANNELS, %.1f MiB OF GRIDS AND IMAGES PER GROUP)" % (len(self._cube_channel_groups),
+													   max([u - l for l,u in self._cube_channel_groups]),
+													   max(self._group_bytes) / MIB)
+    print "\tCONVOLUTION KERNEL %.1f MiB" % (self._kernel_bytes / MIB)
+    print "\tPREDICTED PEAK MEMORY %.1f MiB" % (self.predicted_peak_memory() / MIB)
+    if self.predicted_peak_memory() > self._memory_budget:
+      print "\tWARNING: THE PLAN EXCEEDS THE MEMORY BUDGET (A SINGLE CUBE CHANNEL DOES NOT FIT). REDUCE THE IMAGE SIZE, PADDING OR NUMBER OF FACETS"
+
+def make_execution_plan(memory_budget,no_rows,no_chunks,row_bytes,resident_chunks,
+			channel_grid_index,enabled_channels,cube_chan_dim_size,
+			cube_channel_bytes,sampling_function_bytes,kernel_bytes):
+  '''
+  Splits the memory budget (in bytes) between the resident chunks and the grids: the chunks requested on the command line 
+  are kept if the grids of the whole cube fit alongside them. Otherwise the chunks get at most CHUNK_BUDGET_FRACTION of the
+  budget (more if the whole cube then fits) and the cube is imaged in groups of channels that fit in the rest.
+  '''
+  available = max(0,memory_budget - kernel_bytes)
+  whole_cube = channel_indexer.compute_cube_channel_groups(channel_grid_index,enabled_channels,cube_chan_dim_size,
+							   cube_channel_bytes,sampling_function_bytes,0)
+  whole_cube_bytes = channel_indexer.compute_cube_channel_group_bytes(whole_cube,channel_grid_index,enabled_channels,
+								      cube_channel_bytes,sampling_function_bytes)[0]
+  requested_chunk_rows = int(np.ceil(no_rows / float(no_chunks)))
+  if whole_cube_bytes + requested_chunk_rows * row_bytes * resident_chunks <= available:
+    max_chunk_rows = requested_chunk_rows
+  else:
+    chunk_budget = max(available - whole_cube_bytes,available * CHUNK_BUDGET_FRACTION)
+    max_chunk_rows = max(1,min(requested_chunk_rows,int(chunk_budget / (row_bytes * resident_chunks))))
+  no_chunks = int(np.ceil(no_rows / float(max_chunk_rows)))
+  max_chunk_rows = int(np.ceil(no_rows / float(no_chunks))) #spread the rows evenly over the chunks
+  chunk_bytes = max_chunk_rows * row_bytes * resident_chunks
+  cube_channel_groups = channel_indexer.compute_cube_channel_groups(channel_grid_index,enabled_channels,cube_chan_dim_size,
+								    cube_channel_bytes,sampling_function_bytes,
+								    max(1,available - chunk_bytes))
+  group_bytes = channel_indexer.compute_cube_channel_group_bytes(cube_channel_groups,channel_grid_index,enabled_channels,
+								 cube_channel_bytes,sampling_function_bytes)
+  return execution_plan(memory_budget,no_chunks,max_chunk_rows,chunk_bytes,cube_channel_groups,group_bytes,kernel_bytes)
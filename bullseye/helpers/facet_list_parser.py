@@ -42,8 +42,6 @@ from pyrap.quanta import quantity
 import numpy as np
 import sys
 import os
-from os.path import *
-import shutil
 
 def compute_number_of_facet_centres(parser_args):
   num_facet_centres = parser_args['n_facets_l'] * parser_args['n_facets_m']
@@ -76,93 +74,3 @@ def print_facet_centre_list(facet_centres,num_facet_centres):
       print "REQUESTED FACET CENTRES:"
       for i,c in enumerate(facet_centres):
 	print "\tFACET %d RA: %s DEC: %s" % (i,quantity(c[0],'arcsec').get('deg'),quantity(c[1],'arcsec').get('deg'))
-
-'''
-This uses Montage:
-Montage: a grid portal and software toolkit for science-grade astronomical image mosaicking
-Jacob, Katz, Berriman, Good, Laity, Deelman, Kasselman, Singh, Su Prince, Williams
-Int. J. Computational Science and Engineering (2006)
-'''
-def output_mosaic(output_prefix,num_facet_centres):
-  file_names = [basename(output_prefix + '_facet' + str(i) + '.fits') for i in range(0,num_facet_centres)]
-  facet_image_list_filename = dirname(output_prefix) + '/facets.lst'
-  f_file_list = open(facet_image_list_filename,'w')
-  f_file_list.writelines(["|%sfname|\n" % (" "*(max([len(item) for item in file_names])-5)),
-			  "|%schar|\n" % (" "*(max([len(item) for item in file_names])-4))
-			 ])
-  f_file_list.writelines([" %s\n" % item for item in file_names])
-  f_file_list.close()
-  #Closely follow Montage's recipy for creating a background-corrected mosaic
-  #http://montage.ipac.caltech.edu/docs/how.html
-  montage_unprojected_img_table = dirname(output_prefix) + '/facets.montage.tbl'
-  os.system('mImgtbl -t %s %s %s' % (facet_image_list_filename,
-				     dirname(output_prefix),
-				     montage_unprojected_img_table
-				    )
-	   )
-  montage_proj_template_hdr = dirname(output_prefix) + '/projected_template.hdr'
-  os.system('mMakeHdr %s %s' % (montage_unprojected_img_table,
-				montage_proj_template_hdr
-			       )
-	   )
-  proj_dir = dirname(output_prefix) + '/projected_facets'
-  if exists(proj_dir):
-    shutil.rmtree(proj_dir)
-  os.makedirs(proj_dir)
-  montage_stats_file = dirname(output_prefix) + '/stats.tbl'
-  os.system('mProjExec -p %s %s %s %s %s' % (dirname(output_prefix),
-					     montage_unprojected_img_table,
-					     montage_proj_template_hdr,
-					     proj_dir,
-					     montage_stats_file
-					    )
-	   )
-  montage_projected_img_table = dirname(output_prefix) + '/facets.montage.proj.tbl'
-  os.system('mImgtbl %s %s' % (proj_dir,
-			       montage_projected_img_table
-			      )
-	   )
-  #montage_diffs_table = dirname(output_prefix) + '/overlap.tbl'
-  #os.system('mOverlaps %s %s' % (montage_projected_img_table,
-				 #montage_diffs_table
-				#)
-	   #)
-  #diffs_dir = dirname(output_prefix) + '/overlaps'
-  #if exists(diffs_dir):
-    #shutil.rmtree(diffs_dir)
-  #os.makedirs(diffs_dir)
-  #os.system('mDiffExec -p %s %s %s %s' % (proj_dir,
-					  #montage_diffs_table,
-					  #montage_proj_template_hdr,
-					  #diffs_dir
-					 #)
-	   #)
-  #montage_fit_table = dirname(output_prefix) + '/fit.tbl'
-  #os.system('mFitExec %s %s %s' % (montage_diffs_table,
-				   #montage_fit_table,
-				   #diffs_dir,
-				   #)
-	   #)
-  #montage_corrections_table = dirname(output_prefix) + '/combine.tbl'
-  #os.system('mBgModel %s %s %s' % (montage_projected_img_table,
-				   #montage_fit_table,
-				   #montage_corrections_table
-				  #)
-	   #)
-  #corrections_dir = dirname(output_prefix) + '/corrections'
-  #if exists(corrections_dir):
-    #shutil.rmtree(corrections_dir)
-  #os.makedirs(corrections_dir)
-  #os.system('mBgExec -p %s %s %s %s' % (proj_dir,
-					#montage_projected_img_table,
-					#montage_corrections_table,
-					#corrections_dir
-				       #)
-	   #)
-  montage_combined_img = output_prefix + '.combined.fits'
-  os.system('mAdd -a mean -p %s %s %s %s' % (proj_dir,
-					     montage_projected_img_table,
-					     montage_proj_template_hdr,
-					     montage_combined_img
-					    )
-	   )
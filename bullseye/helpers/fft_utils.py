@@ -39,6 +39,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 
 import scipy.fftpack
 import numpy as np
+import tempfile
 
 F2=scipy.fftpack.fft2
 iF2=scipy.fftpack.ifft2
@@ -52,3 +53,20 @@ def fft2(A):
 def ifft2(A):    
     FA=Fs(iF2(iFs(A)))*np.float64(A.size)
     return FA
+
+def aligned_zeros(shape,dtype,alignment=64):
+    '''
+    Allocates a zeroed array starting on an alignment-byte boundary, so that FFTW can use its SIMD codelets on it
+    '''
+    nbytes = int(np.prod(shape)) * np.dtype(dtype).itemsize
+    buf = np.zeros(nbytes + alignment,dtype=np.uint8)
+    start = (-buf.ctypes.data) % alignment
+    return buf[start:start + nbytes].view(dtype).reshape(shape)
+
+def mapped_zeros(shape,dtype,directory):
+    '''
+    Allocates a zeroed array in a memory-mapped scratch file in directory (out-of-core grids for facet sets that do not fit
+    in RAM). The file is sparse, so pages only take up space once they are written to, and is deleted when the array
+    is released. Mappings start on a page boundary, so the array is aligned for FFTW as well.
+    '''
+    return np.memmap(tempfile.TemporaryFile(dir=directory),dtype=dtype,mode='w+',shape=tuple(shape))
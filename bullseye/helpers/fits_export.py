@@ -37,6 +37,7 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 '''
 
+import os
 import pyfits
 from pyrap.quanta import quantity
 import numpy as np
@@ -71,6 +72,35 @@ M. R. Calabretta, E. W. Greisen
 A&A 395 (3) 1077-1122 (2002)
 DOI: 10.1051/0004-6361:20021327
 '''
+def append_coordinate_cards(header,
+			    cell_l,cell_m,
+			    centre_px_l,centre_px_m,
+			    pointing_ra,pointing_dec,
+			    polarization_term,
+			    ref_wavelength,
+			    delta_wavelength):
+  header.append(("CRPIX1",centre_px_l,"Pixel coordinate of reference point"))
+  header.append(("CDELT1",-cell_m.get_value("deg"),"step per m pixel"))
+  header.append(("CTYPE1","RA---SIN","Orthog projection"))
+  header.append(("CRVAL1",pointing_ra.get_value("deg"),"RA value"))
+  header.append(("CUNIT1","deg","units are always degrees"))
+  header.append(("CRPIX2",centre_px_m,"Pixel coordinate of reference point"))
+  header.append(("CDELT2",cell_l.get_value("deg"),"step per l pixel"))
+  header.append(("CTYPE2","DEC--SIN","Orthog projection"))
+  header.append(("CRVAL2",pointing_dec.get_value("deg"),"DEC value"))
+  header.append(("CUNIT2","deg","units are always degrees"))
+  header.append(("CRPIX3",1,"Pixel coordinate of reference point"))
+  header.append(("CDELT3",1,"dummy value"))
+  header.append(("CTYPE3","STOKES","Polarization"))
+  header.append(("CRVAL3",FITS_POLARIZATION_CLASSIFIERS[polarization_term],"Polarization identifier"))
+  header.append(("CUNIT3"," ","Polarization term is unitless"))
+  header.append(("CRPIX4",1,"Pixel coordinate of reference point"))
+  header.append(("CDELT4",delta_wavelength,"dummy velocity value"))
+  header.append(("CTYPE4","WAVELENGTH","Wavelength in metres"))
+  header.append(("CRVAL4",ref_wavelength,"first wavelength in the cube"))
+  header.append(("CUNIT4","m","wavelength in m"))
+  #header.append(("LONPOLE",180 if pointing_dec.get_value("deg") < 0 else 0,"Native longitude of celestial pole"))
+
 def save_to_fits_image(name,size_l,size_m,
 		   cell_l,cell_m,
 		   centre_px_l,centre_px_m,
@@ -86,26 +116,52 @@ def save_to_fits_image(name,size_l,size_m,
     raise Exception("Expected float or double typed data but got %s" % data.dtype)
   fortran_ordered_data = data.astype(data.dtype,order="F",copy=False).reshape(cube_channel_dim_size,1,size_m,size_l)
   pri_hdr = pyfits.PrimaryHDU(fortran_ordered_data,do_not_scale_image_data=True)
-  pri_hdr.header.append(("CRPIX1",centre_px_l,"Pixel coordinate of reference point"))
-  pri_hdr.header.append(("CDELT1",-cell_m.get_value("deg"),"step per m pixel"))
-  pri_hdr.header.append(("CTYPE1","RA---SIN","Orthog projection"))
-  pri_hdr.header.append(("CRVAL1",pointing_ra.get_value("deg"),"RA value"))
-  pri_hdr.header.append(("CUNIT1","deg","units are always degrees"))
-  pri_hdr.header.append(("CRPIX2",centre_px_m,"Pixel coordinate of reference point"))
-  pri_hdr.header.append(("CDELT2",cell_l.get_value("deg"),"step per l pixel"))
-  pri_hdr.header.append(("CTYPE2","DEC--SIN","Orthog projection"))
-  pri_hdr.header.append(("CRVAL2",pointing_dec.get_value("deg"),"DEC value"))
-  pri_hdr.header.append(("CUNIT2","deg","units are always degrees"))
-  pri_hdr.header.append(("CRPIX3",1,"Pixel coordinate of reference point"))
-  pri_hdr.header.append(("CDELT3",1,"dummy value"))
-  pri_hdr.header.append(("CTYPE3","STOKES","Polarization"))
-  pri_hdr.header.append(("CRVAL3",FITS_POLARIZATION_CLASSIFIERS[polarization_term],"Polarization identifier"))
-  pri_hdr.header.append(("CUNIT3"," ","Polarization term is unitless"))
-  pri_hdr.header.append(("CRPIX4",1,"Pixel coordinate of reference point"))
-  pri_hdr.header.append(("CDELT4",delta_wavelength,"dummy velocity value"))
-  pri_hdr.header.append(("CTYPE4","WAVELENGTH","Wavelength in metres"))
-  pri_hdr.header.append(("CRVAL4",ref_wavelength,"first wavelength in the cube"))
-  pri_hdr.header.append(("CUNIT4","m","wavelength in m"))
-  #pri_hdr.header.append(("LONPOLE",180 if pointing_dec.get_value("deg") < 0 else 0,"Native longitude of celestial pole"))
+  append_coordinate_cards(pri_hdr.header,cell_l,cell_m,centre_px_l,centre_px_m,pointing_ra,pointing_dec,
+			  polarization_term,ref_wavelength,delta_wavelength)
   fits = pyfits.HDUList([pri_hdr])
-  fits.writeto(name,clobber=True)
\ No newline at end of file
+  fits.writeto(name,clobber=True)
+
+class fits_cube_writer(object):
+  '''
+  Writes a FITS cube (with the same layout as save_to_fits_image) a group of channels at a time, so that the
+  whole cube never has to be held in memory. The groups must be written in channel order.
+  '''
+  def __init__(self,name,size_l,size_m,
+	       cell_l,cell_m,
+	       centre_px_l,centre_px_m,
+	       pointing_ra,pointing_dec,
+	       polarization_term,
+	       ref_wavelength,
+	       delta_wavelength,
+	       cube_channel_dim_size,
+	       dtype):
+    if not (dtype == np.float32 or dtype == np.float64):
+      raise Exception("Expected float or double typed data but got %s" % np.dtype(dtype))
+    self._size_l = size_l
+    self._size_m = size_m
+    self._dtype = np.dtype(dtype)
+    header = pyfits.Header()
+    header.append(("SIMPLE",True,"conforms to FITS standard"))
+    header.append(("BITPIX",-32 if self._dtype == np.float32 else -64,"array data type"))
+    header.append(("NAXIS",4,"number of array dimensions"))
+    header.append(("NAXIS1",size_l))
+    header.append(("NAXIS2",size_m))
+    header.append(("NAXIS3",1))
+    header.append(("NAXIS4",cube_channel_dim_size))
+    header.append(("EXTEND",True))
+    append_coordinate_cards(header,cell_l,cell_m,centre_px_l,centre_px_m,pointing_ra,pointing_dec,
+			    polarization_term,ref_wavelength,delta_wavelength)
+    if os.path.exists(name): #the streaming HDU would otherwise be appended to the old file as an extension
+      os.remove(name)
+    self._hdu = pyfits.StreamingHDU(name,header)
+
+  def write_channels(self,data):
+    if data.dtype != self._dtype:
+      raise Exception("Expected %s typed data but got %s" % (self._dtype,data.dtype))
+    if data.size % (self._size_l*self._size_m) != 0:
+      raise Exception("Data size must be a multiple of size_l * size_m")
+    no_channels = data.size / (self._size_l*self._size_m)
+    self._hdu.write(np.ascontiguousarray(data).reshape(no_channels,1,self._size_m,self._size_l))
+
+  def close(self):
+    self._hdu.close()
@@ -36,6 +36,7 @@ You should have received a copy of the GNU General Public License
 along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 '''
+import numpy as np
 
 pol_options = {'I' : 1, 'Q' : 2, 'U' : 3, 'V' : 4, 'RR' : 5, 'RL' : 6, 'LR' : 7, 'LL' : 8, 'XX' : 9, 'XY' : 10, 'YX' : 11, 'YY' : 12} # as per Stokes.h in casacore, the rest is left unimplemented
 '''
@@ -87,86 +88,23 @@ def find_necessary_correlations_indexes(should_do_jones_corrections,required_pol
 See Smirnov I (2011) for description on conversion between correlation terms and stokes params for linearly polarized feeds
 See Synthesis Imaging II (1999) Pg. 9 for a description on conversion between correlation terms and stokes params for circularly polarized feeds
 '''
-def create_stokes_term_from_gridded_vis(should_do_jones_corrections,data,correlations_to_grid,feeds_in_use,gridded_vis,wanted_polarization):
-  if should_do_jones_corrections:
-    if feeds_in_use == 'circular':		#circular correlation products
-      if wanted_polarization == "I":
-	IpV = data._polarization_correlations.tolist().index(pol_options['RR'])
-	ImV = data._polarization_correlations.tolist().index(pol_options['LL'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpV,:,:] + gridded_vis[:,:,ImV,:,:])/2)
-      elif wanted_polarization == "V":
-	IpV = data._polarization_correlations.tolist().index(pol_options['RR'])
-	ImV = data._polarization_correlations.tolist().index(pol_options['LL'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpV,:,:] - gridded_vis[:,:,ImV,:,:])/2)
-      elif wanted_polarization == "Q":
-	QpiU = data._polarization_correlations.tolist().index(pol_options['RL'])
-	QmiU = data._polarization_correlations.tolist().index(pol_options['LR'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,QpiU,:,:] + gridded_vis[:,:,QmiU,:,:])/2)
-      elif wanted_polarization == "U":
-	QpiU = data._polarization_correlations.tolist().index(pol_options['RL'])
-	QmiU = data._polarization_correlations.tolist().index(pol_options['LR'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,QpiU,:,:] - gridded_vis[:,:,QmiU,:,:])/2)
-      elif wanted_polarization in ['RR','RL','LR','LL']:
-	pass #already stored in gridded_vis[:,0,:,:]
-    elif feeds_in_use == 'linear':		#linear correlation products
-      if wanted_polarization == "I":
-	IpQ = data._polarization_correlations.tolist().index(pol_options['XX'])
-	ImQ = data._polarization_correlations.tolist().index(pol_options['YY'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpQ,:,:] + gridded_vis[:,:,ImQ,:,:])/2)
-      elif wanted_polarization == "Q":
-	IpQ = data._polarization_correlations.tolist().index(pol_options['XX'])
-	ImQ = data._polarization_correlations.tolist().index(pol_options['YY'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpQ,:,:] - gridded_vis[:,:,ImQ,:,:])/2)
-      elif wanted_polarization == "U":
-	UpiV = data._polarization_correlations.tolist().index(pol_options['XY'])
-	UmiV = data._polarization_correlations.tolist().index(pol_options['YX'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,UpiV,:,:] + gridded_vis[:,:,UmiV,:,:])/2)
-      elif wanted_polarization == "V":
-	UpiV = data._polarization_correlations.tolist().index(pol_options['XY'])
-	UmiV = data._polarization_correlations.tolist().index(pol_options['YX'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,UpiV,:,:] - gridded_vis[:,:,UmiV,:,:])/2)
-      elif wanted_polarization in ['XX','XY','YX','YY']:
-	pass #already stored in gridded_vis[:,0,:,:]
-    else:
-      pass #any cases not stated here should be flagged by sanity checks on the program arguement list
+stokes_term_combinations = {
+    'circular' : {'I' : ('RR','LL',1), 'V' : ('RR','LL',-1), 'Q' : ('RL','LR',1), 'U' : ('RL','LR',-1)},
+    'linear'   : {'I' : ('XX','YY',1), 'Q' : ('XX','YY',-1), 'U' : ('XY','YX',1), 'V' : ('XY','YX',-1)}
+}
+
+'''
+The backend combines the normalized correlation grids into the wanted stokes term (or correlation) while finalizing the 
+images: image = sum_corr(weight[corr] * grid[corr]). This computes those weights for the correlations being gridded 
+(all the correlations of the measurement set when doing jones corrections).
+'''
+def create_stokes_correlation_weights(should_do_jones_corrections,data,correlations_to_grid,feeds_in_use,wanted_polarization):
+  correlations = data._polarization_correlations.tolist() if should_do_jones_corrections else correlations_to_grid
+  weights = np.zeros([len(correlations)],dtype=np.float64)
+  if feeds_in_use in stokes_term_combinations and wanted_polarization in stokes_term_combinations[feeds_in_use]:
+    first,second,sign = stokes_term_combinations[feeds_in_use][wanted_polarization]
+    weights[correlations.index(pol_options[first])] = 0.5
+    weights[correlations.index(pol_options[second])] = 0.5 * sign
   else:
-    if feeds_in_use == 'circular':		#circular correlation products
-      if wanted_polarization == "I":
-	IpV = correlations_to_grid.index(pol_options['RR'])
-	ImV = correlations_to_grid.index(pol_options['LL'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpV,:,:] + gridded_vis[:,:,ImV,:,:])/2)
-      elif wanted_polarization == "V":
-	IpV = correlations_to_grid.index(pol_options['RR'])
-	ImV = correlations_to_grid.index(pol_options['LL'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpV,:,:] - gridded_vis[:,:,ImV,:,:])/2)
-      elif wanted_polarization == "Q":
-	QpiU = correlations_to_grid.index(pol_options['RL'])
-	QmiU = correlations_to_grid.index(pol_options['LR'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,QpiU,:,:] + gridded_vis[:,:,QmiU,:,:])/2)
-      elif wanted_polarization == "U":
-	QpiU = correlations_to_grid.index(pol_options['RL'])
-	QmiU = correlations_to_grid.index(pol_options['LR'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,QpiU,:,:] - gridded_vis[:,:,QmiU,:,:])/2)
-      elif wanted_polarization in ['RR','RL','LR','LL']:
-	pass #already stored in gridded_vis[:,0,:,:]
-    elif feeds_in_use == 'linear':		#linear correlation products
-      if wanted_polarization == "I":
-	IpQ = correlations_to_grid.index(pol_options['XX'])
-	ImQ = correlations_to_grid.index(pol_options['YY'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpQ,:,:] + gridded_vis[:,:,ImQ,:,:])/2)
-      elif wanted_polarization == "Q":
-	IpQ = correlations_to_grid.index(pol_options['XX'])
-	ImQ = correlations_to_grid.index(pol_options['YY'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,IpQ,:,:] - gridded_vis[:,:,ImQ,:,:])/2)
-      elif wanted_polarization == "U":
-	UpiV = correlations_to_grid.index(pol_options['XY'])
-	UmiV = correlations_to_grid.index(pol_options['YX'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,UpiV,:,:] + gridded_vis[:,:,UmiV,:,:])/2)
-      elif wanted_polarization == "V":
-	UpiV = correlations_to_grid.index(pol_options['XY'])
-	UmiV = correlations_to_grid.index(pol_options['YX'])
-	gridded_vis[:,:,0,:,:] = ((gridded_vis[:,:,UpiV,:,:] - gridded_vis[:,:,UmiV,:,:])/2)
-      elif wanted_polarization in ['XX','XY','YX','YY']:
-	pass #already stored in gridded_vis[:,0,:,:]
-    else:
-      pass #any cases not stated here should be flagged by sanity checks on the program arguement list
\ No newline at end of file
+    weights[0] = 1 #the wanted correlation (or stokes term) is already stored in the first grid
+  return weights
@@ -95,8 +95,8 @@ const uvw_coord<uvw_base_type> antenna_coords[] = {{-1601710.017000f , -5042006.
 };
 
 int main (int argc, char ** argv) {
-    if (argc != 14)
-        throw runtime_error("Expected args num_threads,dataset_(int)_size_in_MiB,nx,ny,num_chans,num_corr,conv_half_support_size,conv_times_oversample,num_wplanes,observation_length_in_hours,ra_0,dec_0,num_facets");
+    if (argc != 14 && argc != 15)
+        throw runtime_error("Expected args num_threads,dataset_(int)_size_in_MiB,nx,ny,num_chans,num_corr,conv_half_support_size,conv_times_oversample,num_wplanes,observation_length_in_hours,ra_0,dec_0,num_facets[,grid_layout (0 row-major, 1 tiled, 2 planar)]");
     size_t no_threads = atol(argv[1]);
     size_t dataset_size = atol(argv[2]);
     size_t nx = atol(argv[3]);
@@ -132,6 +132,12 @@ int main (int argc, char ** argv) {
     float declination = atof(argv[12]) * M_PI / 180;
     size_t num_facets = atol(argv[13]);
     if (num_facets == 0) printf("WARNING: DISABLING FACETING\n");
+    size_t grid_layout = (argc == 15) ? atol(argv[14]) : 0;
+    if (grid_layout > 2)
+      throw std::invalid_argument("Expected grid layout 0 (row-major), 1 (tiled) or 2 (planar)");
+    if (grid_layout == 1 && (nx % 32 != 0 || ny % 32 != 0))
+      throw std::invalid_argument("The tiled grid layout requires nx and ny to be multiples of 32");
+    printf("GRID LAYOUT: %s\n",grid_layout == 1 ? "TILED" : grid_layout == 2 ? "PLANAR" : "ROW-MAJOR");
     void (*gridding_function)(gridding_parameters &) = num_facets == 0 ? ((pol_count == 1) ? grid_single_pol : (pol_count == 2) ? grid_duel_pol : grid_4_cor) :
 									 ((pol_count == 1) ? facet_single_pol : (pol_count == 2) ? facet_duel_pol : facet_4_cor);
     std::unique_ptr<uvw_base_type[]> facet_centre_list(new uvw_base_type[num_facets*2]);
@@ -240,6 +246,51 @@ int main (int argc, char ** argv) {
     params.spw_index_array = spw_array.get();
     params.uvw_coords = uvw_coords.get();
     params.visibilities = visibilities.get();
+    params.model_visibilities = NULL;
+    params.averaging_smearing_tolerance = 0;
+    params.averaging_field_radius = 0;
+    params.should_average_per_facet = false;
+    params.should_coalesce_visibilities = false;
+    params.should_block_facets = false;
+    params.should_tile_grids = grid_layout == 1;
+    params.should_use_planar_grids = grid_layout == 2;
+    params.should_use_robust_weighting = false;
+    params.weighting_robustness = 0;
+    params.weighting_density_scale = 1;
+    params.should_fuse_sampling_function = false;
+    params.fft_planning_rigour = 0;
+    params.fft_wisdom_directory = NULL;
+    params.should_grid_half_plane = false;
+    params.sampling_function_buffer = NULL; //no PSF is inverted here
+    params.image_buffer = NULL;
+    params.image_nx = params.nx;
+    params.image_ny = params.ny;
+    params.psf_image_buffer = NULL;
+    params.stokes_correlation_weights = NULL;
+    params.grid_correction_x = NULL;
+    params.grid_correction_y = NULL;
+    params.psf_grid_correction_x = NULL;
+    params.psf_grid_correction_y = NULL;
+    params.should_stream_grids = false;
+    params.fits_image_names = NULL; //the images are not written out
+    params.fits_psf_names = NULL;
+    params.should_compress_fits = false;
+    params.fits_polarization = 0;
+    params.fits_image_centres = NULL;
+    params.fits_reference_wavelength = 0;
+    params.fits_delta_wavelength = 0;
+    params.fits_cube_channel_dim_size = params.cube_channel_dim_size;
+    params.fits_first_cube_channel = 0;
+    params.fits_psf_wavelengths = NULL;
+    params.mosaic_buffer = NULL;
+    params.mosaic_nx = 0;
+    params.mosaic_ny = 0;
+    params.mosaic_feather_width = 0;
+    params.facet_geometries = NULL; //all the facets share the geometry above
+    params.psf_nx = params.nx;
+    params.psf_ny = params.ny;
+    params.psf_image_nx = params.psf_nx;
+    params.psf_image_ny = params.psf_ny;
     params.visibility_weights = visibility_weights.get();
     params.wplanes = num_wplanes;
     params.wmax_est = 6500;
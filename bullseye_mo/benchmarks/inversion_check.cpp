@@ -0,0 +1,199 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <complex>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include <cfenv>
+#include <fftw3.h>
+#include "gridding_parameters.h"
+#include "fft_and_repacking_routines.h"
+#include "tiled_grid_policy.h"
+#include "planar_grid_policy.h"
+
+using namespace std;
+using namespace imaging;
+
+/**
+ * Regression check of the grid inversion (ifft_machine) against a plain full-plane FFT and a crop of the window 
+ * centred on the phase centre. The inversion instead modulates even sized grids by a checkerboard of signs, prunes the 
+ * rows outside the image (and the empty columns), folds half-plane grids and untiles / interleaves the tiled and planar 
+ * layouts, all of which should give the same image.
+ * 
+ * Every case inverts a few random grids (with random normalization terms and grid corrections) at odd and even grid and
+ * image sizes. Returns non-zero if any image differs by more than the precision of the grids allows.
+ */
+enum grid_layout {ROW_MAJOR, HALF_PLANE, TILED, PLANAR};
+const char * layout_names[] = {"ROW-MAJOR","HALF-PLANE","TILED","PLANAR"};
+std::mt19937 rng(42);
+std::uniform_real_distribution<double> rnd(-0.5,0.5);
+
+/**
+ * The reference image: the sum over all cells of the (centred) uv grid C with the phase centre at (nx/2, ny/2) is 
+ * computed by ifftshifting C, taking an unnormalized backward FFT and reading out the pixels of the image_nx x image_ny 
+ * window around the image centre (image_nx/2, image_ny/2)
+ */
+vector<double> reference_image(const vector<complex<double> > & C, size_t nx, size_t ny, size_t image_nx, size_t image_ny){
+  vector<complex<double> > shifted(nx*ny), uv_image(nx*ny);
+  for (size_t v = 0; v < ny; ++v)
+    for (size_t u = 0; u < nx; ++u)
+      shifted[((v + ny - ny/2) % ny) * nx + (u + nx - nx/2) % nx] = C[v*nx + u];
+  fftw_plan plan = fftw_plan_dft_2d(ny,nx,(fftw_complex*)shifted.data(),(fftw_complex*)uv_image.data(),FFTW_BACKWARD,FFTW_ESTIMATE);
+  fftw_execute(plan);
+  fftw_destroy_plan(plan);
+  vector<double> image(image_nx*image_ny);
+  for (size_t y = 0; y < image_ny; ++y)
+    for (size_t x = 0; x < image_nx; ++x)
+      image[y*image_nx + x] = uv_image[((y + ny - image_ny/2) % ny) * nx + (x + nx - image_nx/2) % nx].real();
+  return image;
+}
+/**
+ * Writes a centred uv grid into a grid slice of the given layout. Half-plane grids hold the u >= 0 half of the grid plus
+ * the conjugate of the mirrored half (the v axis and the u axis are not shifted), which inverts to twice the real image.
+ */
+void store_grid(const vector<complex<double> > & C, complex<grid_base_type> * slice, size_t nx, size_t ny, grid_layout layout){
+  for (size_t v = 0; v < ny; ++v)
+    for (size_t u = 0; u < nx; ++u){
+      complex<grid_base_type> cell(C[v*nx + u].real(),C[v*nx + u].imag());
+      switch (layout){
+	case ROW_MAJOR: slice[v*nx + u] = cell; break;
+	case TILED: slice[tiled_grid_offset(nx,u,v)] = cell; break;
+	case PLANAR:
+	  ((grid_base_type*)slice)[v*nx + u] = cell.real();
+	  ((grid_base_type*)slice)[nx*ny + v*nx + u] = cell.imag();
+	  break;
+	case HALF_PLANE: break;
+      }
+    }
+  if (layout == HALF_PLANE){
+    size_t half_nx = nx/2 + 1;
+    for (size_t v = 0; v < ny; ++v)
+      for (size_t u = 0; u < half_nx; ++u){
+	complex<double> cell = C[((v + ny/2) % ny) * nx + (u + nx/2) % nx] + 
+			       conj(C[((ny - v) % ny + ny/2) % ny * nx + ((nx - u) % nx + nx/2) % nx]);
+	slice[v*half_nx + u] = complex<grid_base_type>(cell.real(),cell.imag());
+      }
+  }
+}
+bool check_inversion(size_t nx, size_t ny, size_t image_nx, size_t image_ny, grid_layout layout){
+  const size_t no_slices = 2; //cube channels of a single facet and correlation
+  gridding_parameters params = gridding_parameters();
+  params.nx = params.psf_nx = nx;
+  params.ny = params.psf_ny = ny;
+  params.image_nx = params.psf_image_nx = image_nx;
+  params.image_ny = params.psf_image_ny = image_ny;
+  params.num_facet_centres = 1;
+  params.cube_channel_dim_size = params.sampling_function_channel_count = no_slices;
+  params.number_of_polarization_terms_being_gridded = 1;
+  params.should_grid_half_plane = (layout == HALF_PLANE);
+  params.should_tile_grids = (layout == TILED);
+  params.should_use_planar_grids = (layout == PLANAR);
+  size_t slice_size = nx * ny;
+  vector<complex<grid_base_type> > grids(slice_size * no_slices), sampling_functions(slice_size * no_slices);
+  vector<float> images(image_nx * image_ny * no_slices), psf_images(image_nx * image_ny * no_slices);
+  vector<normalization_base_type> normalization_terms(no_slices);
+  vector<grid_base_type> grid_correction_x(image_nx), grid_correction_y(image_ny);
+  for (normalization_base_type & n : normalization_terms) n = 1 + rng() % 7;
+  for (grid_base_type & c : grid_correction_x) c = 1 + rnd(rng);
+  for (grid_base_type & c : grid_correction_y) c = 1 + rnd(rng);
+  params.output_buffer = grids.data();
+  params.sampling_function_buffer = sampling_functions.data();
+  params.image_buffer = images.data();
+  params.psf_image_buffer = psf_images.data();
+  params.normalization_terms = normalization_terms.data();
+  params.grid_correction_x = params.psf_grid_correction_x = grid_correction_x.data();
+  params.grid_correction_y = params.psf_grid_correction_y = grid_correction_y.data();
+  vector<vector<double> > references;
+  for (size_t s = 0; s < no_slices; ++s){
+    vector<complex<double> > C(slice_size);
+    for (complex<double> & c : C) c = complex<double>(rnd(rng),rnd(rng));
+    store_grid(C,grids.data() + s*slice_size,nx,ny,layout);
+    store_grid(C,sampling_functions.data() + s*slice_size,nx,ny,layout);
+    references.push_back(reference_image(C,nx,ny,image_nx,image_ny));
+  }
+  //the layouts are converted back to row-major grids before the inversion (as in finalize)
+  if (layout == TILED){
+    untile_grids(grids.data(),nx,ny,no_slices);
+    untile_grids(sampling_functions.data(),nx,ny,no_slices);
+  } else if (layout == PLANAR){
+    interleave_planar_grids(grids.data(),nx,ny,no_slices);
+    interleave_planar_grids(sampling_functions.data(),nx,ny,no_slices);
+  }
+  {
+    ifft_machine inversion(params);
+    inversion.repack_and_ifft_uv_grids(params);
+    inversion.repack_and_ifft_sampling_function_grids(params);
+  }
+  double max_error = 0, max_value = 0;
+  for (size_t s = 0; s < no_slices; ++s)
+    for (size_t y = 0; y < image_ny; ++y)
+      for (size_t x = 0; x < image_nx; ++x){
+	double expected = references[s][y*image_nx + x] * grid_correction_x[x] * grid_correction_y[y];
+	size_t pixel = (s*image_ny + y)*image_nx + x;
+	max_error = max(max_error,fabs(expected / normalization_terms[s] - images[pixel]));
+	max_error = max(max_error,fabs(expected - psf_images[pixel]));
+	max_value = max(max_value,fabs(expected));
+      }
+  double tolerance = 1e-5 * max_value; //the images are single precision
+  bool passed = max_error <= tolerance;
+  printf("%-10s %4lu x %4lu GRID -> %4lu x %4lu IMAGE: MAX ERROR %e (OF %e) %s\n",layout_names[layout],nx,ny,image_nx,image_ny,
+	 max_error,max_value,passed ? "OK" : "FAILED");
+  return passed;
+}
+int main (int argc, char ** argv) {
+    printf("------------------------------------\nGRID INVERSION CHECK\n------------------------------------\n");
+    //odd and even grid sizes, with odd and even images (and so odd and even amounts of padding)
+    const size_t sizes[][4] = {{24,20,16,12},{24,20,15,11},{21,15,13,9},{21,15,12,8},{30,18,23,14},{40,22,40,22}};
+    bool passed = true;
+    for (const size_t * s : sizes){
+      passed &= check_inversion(s[0],s[1],s[2],s[3],ROW_MAJOR);
+      passed &= check_inversion(s[0],s[1],s[2],s[3],PLANAR);
+      if (s[0] % 2 == 0 && s[1] % 2 == 0) //half-plane grids must be even sized (see hermitian_grid_policy.h)
+	passed &= check_inversion(s[0],s[1],s[2],s[3],HALF_PLANE);
+    }
+    //the tiled layout needs multiples of the tile size
+    const size_t tiled_sizes[][4] = {{64,96,48,64},{64,64,47,33}};
+    for (const size_t * s : tiled_sizes)
+      passed &= check_inversion(s[0],s[1],s[2],s[3],TILED);
+    printf(passed ? "INVERSION CHECK PASSED\n" : "INVERSION CHECK FAILED\n");
+    return passed ? 0 : 1;
+}
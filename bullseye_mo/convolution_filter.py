@@ -105,6 +105,8 @@ class convolution_filter(object):
     AA = np.sinc(x/float(oversampling_factor))
     AA *= convolution_func[function_to_use](x/float(oversampling_factor),convolution_full_support,oversampling_factor)
     AA /= np.sum(AA) #normalize to unity
+    self._AA = AA #the anti-aliasing taps (also incorporated into the w-projection filters), needed for grid correction
+    self._AA_taps = x / float(oversampling_factor) #offsets of the taps measured in grid cells
     
     #compute number of facets required if no w-projection is applied
     phase_error_threshold = 0.5 # this should be much less than 1 for the 2D FFT to be valid
@@ -179,3 +181,13 @@ class convolution_filter(object):
 	  W_bar_kernels[w,:,:] = W_bar_kernel
       self._conv_FIR = W_bar_kernels.astype(base_types.w_fir_type)
     print "CONVOLUTION FILTERS CREATED"
+
+  '''
+  Grid correction (detapering function) along an image axis of npix_padded pixels, of which only the centred npix_out 
+  pixels are kept. Convolving the grid with the anti-aliasing filter multiplies the image by the Fourier transform of 
+  the filter, which is undone by multiplying with the inverse of this taper (normalized to unity at the phase centre)
+  '''
+  def detaper(self,npix_padded,npix_out):
+    l = (np.arange(0,npix_out) + (npix_padded - npix_out) // 2 - npix_padded // 2) / float(npix_padded)
+    taper = np.dot(np.cos(2 * np.pi * np.outer(l,self._AA_taps)),self._AA) / np.sum(self._AA)
+    return (1.0 / taper).astype(base_types.detaper_type)
@@ -0,0 +1,231 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#include "baseline_dependent_averaging.h"
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include "omp.h"
+#include "cu_common.h"
+namespace imaging{
+  namespace {
+    bool in_same_averaging_group(const gridding_parameters & params, std::size_t row_a, std::size_t row_b){
+      return params.antenna_1_ids[row_a] == params.antenna_1_ids[row_b] &&
+	     params.antenna_2_ids[row_a] == params.antenna_2_ids[row_b] &&
+	     params.spw_index_array[row_a] == params.spw_index_array[row_b];
+    }
+  }
+  bool can_merge_channels(const gridding_parameters & params, std::size_t spw, std::size_t c_start, std::size_t c){
+    std::size_t flat_c_start = spw * params.channel_count + c_start;
+    std::size_t flat_c = spw * params.channel_count + c;
+    return params.enabled_channels[flat_c] &&
+	   params.channel_grid_indicies[flat_c] == params.channel_grid_indicies[flat_c_start] &&
+	   (!params.should_grid_sampling_function || 
+	    params.sampling_function_channel_grid_indicies[flat_c] == params.sampling_function_channel_grid_indicies[flat_c_start]);
+  }
+  void group_rows_per_baseline(const gridding_parameters & params, 
+			       std::vector<std::size_t> & rows, 
+			       std::vector<std::size_t> & group_starts){
+    //only keep rows that will actually be gridded (stable sort to preserve the time ordering of the MS)
+    rows.clear();
+    rows.reserve(params.row_count);
+    for (std::size_t r = 0; r < params.row_count; ++r)
+      if (!params.flagged_rows[r] && params.field_array[r] == params.imaging_field)
+	rows.push_back(r);
+    std::stable_sort(rows.begin(),rows.end(),[&params](std::size_t a, std::size_t b){
+      if (params.antenna_1_ids[a] != params.antenna_1_ids[b]) return params.antenna_1_ids[a] < params.antenna_1_ids[b];
+      if (params.antenna_2_ids[a] != params.antenna_2_ids[b]) return params.antenna_2_ids[a] < params.antenna_2_ids[b];
+      return params.spw_index_array[a] < params.spw_index_array[b];
+    });
+    group_starts.clear();
+    for (std::size_t i = 0; i < rows.size(); ++i)
+      if (i == 0 || !in_same_averaging_group(params,rows[i-1],rows[i]))
+	group_starts.push_back(i);
+    group_starts.push_back(rows.size());
+  }
+  void baseline_dependent_averager::average(gridding_parameters & params){
+    if (params.should_invert_jones_terms)
+      throw std::runtime_error("Baseline dependent averaging cannot be combined with jones corrections (the corrective terms are per timestamp), average per facet instead");
+    const std::size_t row_size = params.channel_count * params.number_of_polarization_terms;
+    const uvw_base_type l_max = params.averaging_field_radius * ARCSEC_TO_RAD;
+    const uvw_base_type n_complement_max = 1 - sqrt(std::max<uvw_base_type>(0,1 - l_max*l_max));
+    const uvw_base_type half_tolerance = params.averaging_smearing_tolerance * 0.5;
+    
+    std::vector<std::size_t> rows;
+    std::vector<std::size_t> group_starts;
+    group_rows_per_baseline(params,rows,group_starts);
+    std::size_t no_groups = group_starts.size() - 1;
+    
+    //first pass: mark the first row of every time bin
+    std::vector<char> starts_bin(rows.size(),0);
+    std::vector<std::size_t> bin_offsets(no_groups + 1,0);
+    #pragma omp parallel for schedule(dynamic)
+    for (std::size_t g = 0; g < no_groups; ++g){
+      std::size_t spw = params.spw_index_array[rows[group_starts[g]]];
+      uvw_base_type inv_lambda_max = 0; //the shortest wavelength sweeps out the largest distance in the uv plane
+      for (std::size_t c = 0; c < params.channel_count; ++c)
+	if (params.enabled_channels[spw * params.channel_count + c])
+	  inv_lambda_max = std::max<uvw_base_type>(inv_lambda_max,1 / params.reference_wavelengths[spw * params.channel_count + c]);
+      std::size_t bin_start = group_starts[g];
+      std::size_t no_bins = 1;
+      starts_bin[bin_start] = 1;
+      for (std::size_t i = bin_start + 1; i < group_starts[g+1]; ++i){
+	if (averaging_phase_drift(params.uvw_coords[rows[bin_start]],params.uvw_coords[rows[i]],
+				  inv_lambda_max,l_max,n_complement_max) > half_tolerance){
+	  bin_start = i;
+	  starts_bin[i] = 1;
+	  ++no_bins;
+	}
+      }
+      bin_offsets[g + 1] = no_bins;
+    }
+    std::partial_sum(bin_offsets.begin(),bin_offsets.end(),bin_offsets.begin());
+    std::size_t no_averaged_rows = bin_offsets[no_groups];
+    
+    _uvw_coords.resize(no_averaged_rows);
+    _visibilities.resize(no_averaged_rows * row_size);
+    _visibility_weights.resize(no_averaged_rows * row_size);
+    _flags.resize(no_averaged_rows * row_size);
+    _flagged_rows.resize(no_averaged_rows);
+    _field_array.resize(no_averaged_rows);
+    _spw_index_array.resize(no_averaged_rows);
+    _antenna_1_ids.resize(no_averaged_rows);
+    _antenna_2_ids.resize(no_averaged_rows);
+    _timestamp_ids.resize(no_averaged_rows);
+    
+    //second pass: accumulate the weighted visibilities of each time bin and then merge channels within the bin
+    std::size_t no_samples_in = 0;
+    std::size_t no_samples_out = 0;
+    #pragma omp parallel for schedule(dynamic) reduction(+:no_samples_in,no_samples_out)
+    for (std::size_t g = 0; g < no_groups; ++g){
+      std::size_t out_row = bin_offsets[g];
+      for (std::size_t bin_start = group_starts[g]; bin_start < group_starts[g+1]; ++out_row){
+	std::size_t bin_end = bin_start + 1;
+	while (bin_end < group_starts[g+1] && !starts_bin[bin_end]) ++bin_end;
+	std::size_t first_row = rows[bin_start];
+	std::size_t spw = params.spw_index_array[first_row];
+	_field_array[out_row] = params.field_array[first_row];
+	_spw_index_array[out_row] = spw;
+	_antenna_1_ids[out_row] = params.antenna_1_ids[first_row];
+	_antenna_2_ids[out_row] = params.antenna_2_ids[first_row];
+	_timestamp_ids[out_row] = (params.timestamp_ids != NULL) ? params.timestamp_ids[first_row] : 0;
+	_flagged_rows[out_row] = false;
+	std::complex<visibility_base_type> * __restrict__ vis = &_visibilities[out_row * row_size];
+	visibility_weights_base_type * __restrict__ weight = &_visibility_weights[out_row * row_size];
+	char * __restrict__ flag = &_flags[out_row * row_size];
+	std::fill(vis,vis + row_size,std::complex<visibility_base_type>(0,0));
+	std::fill(weight,weight + row_size,0);
+	
+	//time averaging: the uvw coordinate is the centre of the bin, the visibilities are kept as weighted sums until the end
+	imaging::uvw_coord<uvw_base_type> uvw(0,0,0);
+	for (std::size_t i = bin_start; i < bin_end; ++i){
+	  std::size_t r = rows[i];
+	  uvw._u += params.uvw_coords[r]._u;
+	  uvw._v += params.uvw_coords[r]._v;
+	  uvw._w += params.uvw_coords[r]._w;
+	  for (std::size_t s = 0; s < row_size; ++s){
+	    std::size_t in_index = r * row_size + s;
+	    if (params.flags[in_index]) continue;
+	    std::complex<visibility_base_type> sample = params.visibilities[in_index];
+	    if (params.model_visibilities != NULL)
+	      sample -= params.model_visibilities[in_index];
+	    vis[s] += sample * params.visibility_weights[in_index];
+	    weight[s] += params.visibility_weights[in_index];
+	  }
+	}
+	uvw *= (uvw_base_type)(1.0 / (bin_end - bin_start));
+	_uvw_coords[out_row] = uvw;
+	
+	//frequency averaging: merge neighbouring channels that end up in the same cube slice into the middle channel of the bin
+	uvw_base_type baseline_length = sqrt(uvw._u*uvw._u + uvw._v*uvw._v + uvw._w*uvw._w);
+	for (std::size_t c_start = 0; c_start < params.channel_count;){
+	  std::size_t c_end = c_start + 1;
+	  if (params.enabled_channels[spw * params.channel_count + c_start]){
+	    uvw_base_type inv_lambda_start = 1 / params.reference_wavelengths[spw * params.channel_count + c_start];
+	    while (c_end < params.channel_count && can_merge_channels(params,spw,c_start,c_end) &&
+		   2 * M_PI * baseline_length * l_max * 
+		   fabs(1 / params.reference_wavelengths[spw * params.channel_count + c_end] - inv_lambda_start) <= half_tolerance)
+	      ++c_end;
+	  }
+	  std::size_t c_mid = (c_start + c_end - 1) / 2;
+	  for (std::size_t c = c_start; c < c_end; ++c){
+	    if (c == c_mid) continue;
+	    for (std::size_t p = 0; p < params.number_of_polarization_terms; ++p){
+	      std::size_t from = c * params.number_of_polarization_terms + p;
+	      std::size_t to = c_mid * params.number_of_polarization_terms + p;
+	      vis[to] += vis[from];
+	      weight[to] += weight[from];
+	      vis[from] = 0;
+	      weight[from] = 0;
+	    }
+	  }
+	  c_start = c_end;
+	}
+	
+	//normalize the weighted sums, anything without weight is flagged (and skipped by the gridder)
+	for (std::size_t s = 0; s < row_size; ++s){
+	  flag[s] = (weight[s] == 0);
+	  if (!flag[s]){
+	    vis[s] /= weight[s];
+	    ++no_samples_out;
+	  }
+	}
+	no_samples_in += (bin_end - bin_start) * row_size;
+	bin_start = bin_end;
+      }
+    }
+    printf("Baseline dependent averaging: %lu rows reduced to %lu rows (%lu visibilities reduced to %lu)\n",
+	   params.row_count,no_averaged_rows,no_samples_in,no_samples_out);
+    
+    //redirect the chunk to the averaged data
+    params.uvw_coords = _uvw_coords.data();
+    params.visibilities = _visibilities.data();
+    params.model_visibilities = NULL; //already subtracted
+    params.visibility_weights = _visibility_weights.data();
+    params.flags = (bool *)_flags.data();
+    params.flagged_rows = (bool *)_flagged_rows.data();
+    params.field_array = _field_array.data();
+    params.spw_index_array = _spw_index_array.data();
+    params.antenna_1_ids = _antenna_1_ids.data();
+    params.antenna_2_ids = _antenna_2_ids.data();
+    params.timestamp_ids = _timestamp_ids.data();
+    params.row_count = no_averaged_rows;
+  }
+}
@@ -0,0 +1,110 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <vector>
+#include <complex>
+#include <cmath>
+#include "gridding_parameters.h"
+#include "uvw_coord.h"
+namespace imaging{
+    /**
+     * Lists the rows of the chunk that will be gridded (unflagged rows in the field being imaged), ordered per 
+     * baseline and spw. Within each group the original (time) ordering of the rows is kept. group_starts holds the 
+     * starting position of every group in rows, followed by rows.size().
+     */
+    void group_rows_per_baseline(const gridding_parameters & params, 
+				 std::vector<std::size_t> & rows, 
+				 std::vector<std::size_t> & group_starts);
+    /**
+     * Moving a sample from uvw coordinate a to b (in metres) changes the phase of a source at (l,m) by 2pi(du l + dv m + dw (n-1)),
+     * which is bounded by 2pi(|duv| l_max + |dw| (1 - n_min)) over a field of radius l_max
+     */
+    inline uvw_base_type averaging_phase_drift(const imaging::uvw_coord<uvw_base_type> & a,
+					       const imaging::uvw_coord<uvw_base_type> & b,
+					       uvw_base_type inv_lambda,
+					       uvw_base_type l_max,
+					       uvw_base_type n_complement_max){
+      uvw_base_type du = (b._u - a._u) * inv_lambda;
+      uvw_base_type dv = (b._v - a._v) * inv_lambda;
+      uvw_base_type dw = (b._w - a._w) * inv_lambda;
+      return 2 * M_PI * (sqrt(du*du + dv*dv) * l_max + fabs(dw) * n_complement_max);
+    }
+    /**
+     * Checks that channel c can be averaged into the bin starting at channel c_start (both channels must be enabled and 
+     * be gridded to the same cube and sampling function slices)
+     */
+    bool can_merge_channels(const gridding_parameters & params, std::size_t spw, std::size_t c_start, std::size_t c);
+    /**
+     * Baseline dependent averaging (compression of the data ahead of the gridder)
+     * 
+     * Short baselines move slowly through the uv plane and can be averaged over many integrations
+     * (and channels) before the smearing becomes noticeable. Rows are grouped per baseline and
+     * spectral window and successive samples are merged as long as the phase drift they introduce at
+     * the edge of the imaged field (averaging_field_radius) stays within averaging_smearing_tolerance. Half of the
+     * tolerance is allotted to time averaging and the other half to frequency averaging.
+     * 
+     * The reduced data is kept in the same layout as the original chunk: time-averaged rows replace the original rows
+     * and channel bins are accumulated into the middle channel of each bin, with the remaining channels of the bin flagged
+     * (the gridder skips flagged visibilities). The weight of every averaged visibility is the sum of the weights merged 
+     * into it, so the gridded visibilities and sampling function still count every original sample.
+     * 
+     * Rows not in the field being imaged and flagged rows are dropped. Any model visibilities are subtracted before averaging.
+     * The buffers are owned by this class and reused between chunks, so the previous chunk must have finished gridding
+     * before the next call to average.
+     */
+    class baseline_dependent_averager {
+    private:
+      std::vector<imaging::uvw_coord<uvw_base_type> > _uvw_coords;
+      std::vector<std::complex<visibility_base_type> > _visibilities;
+      std::vector<visibility_weights_base_type> _visibility_weights;
+      std::vector<char> _flags; //std::vector<bool> is bit packed, the gridder needs a plain bool array
+      std::vector<char> _flagged_rows;
+      std::vector<unsigned int> _field_array;
+      std::vector<unsigned int> _spw_index_array;
+      std::vector<unsigned int> _antenna_1_ids;
+      std::vector<unsigned int> _antenna_2_ids;
+      std::vector<std::size_t> _timestamp_ids;
+    public:
+      /**
+       * Averages the chunk described by params and redirects the data pointers (and row count) in params
+       * to the reduced chunk.
+       */
+      void average(gridding_parameters & params);
+    };
+}
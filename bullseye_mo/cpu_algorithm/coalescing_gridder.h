@@ -0,0 +1,215 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <vector>
+#include <cstdio>
+#include "templated_gridder.h"
+#include "baseline_dependent_averaging.h"
+
+namespace imaging {
+	/**
+	 * Position of the convolution kernel on the grid. This mirrors the placement logic of the precomputed AA (wplanes <= 1)
+	 * and w-projection (wplanes > 1) convolution policies: visibilities with the same placement are convolved with exactly
+	 * the same kernel taps, so they can be summed before convolution without changing the result.
+	 */
+	struct kernel_placement {
+	  std::size_t disc_grid_u;
+	  std::size_t disc_grid_v;
+	  std::size_t frac_u_offset;
+	  std::size_t frac_v_offset;
+	  std::size_t w_plane;
+	  bool conjugate;
+	  bool operator==(const kernel_placement & rhs) const {
+	    return disc_grid_u == rhs.disc_grid_u && disc_grid_v == rhs.disc_grid_v &&
+		   frac_u_offset == rhs.frac_u_offset && frac_v_offset == rhs.frac_v_offset &&
+		   w_plane == rhs.w_plane && conjugate == rhs.conjugate;
+	  }
+	};
+	/**
+	 * Gridding with coalescing of visibilities: with dense uv coverage consecutive samples on a baseline often land on the 
+	 * same cell, with the same oversampled kernel offset and w-plane. Each channel keeps one pending (weighted, phase rotated) 
+	 * visibility which further samples with the same kernel placement are added to. The pending sum is only convolved once 
+	 * a sample with a different placement arrives or the baseline ends, so identical convolutions are done only once.
+	 * 
+	 * The kernel placements of all the channels in a row are computed together in a vectorizable loop.
+	 */
+	template <typename active_correlation_gridding_policy,
+		  typename active_baseline_transformation_policy,
+		  typename active_phase_transformation,
+		  typename active_convolution_policy>
+	void templated_coalescing_gridder(gridding_parameters & params){
+		typedef typename active_correlation_gridding_policy::active_trait active_trait;
+		active_convolution_policy::set_required_rounding_operation();
+		size_t conv_full_support = (params.conv_support << 1) + 1;
+		size_t padded_conv_full_support = conv_full_support + 2; //remember we need to reserve some of the support for +/- frac on both sides
+		
+		//Scale the IFFT by the simularity theorem to the correct FOV
+		uvw_base_type u_scale=params.nx*params.cell_size_x * ARCSEC_TO_RAD;
+		uvw_base_type v_scale=-(params.ny*params.cell_size_y * ARCSEC_TO_RAD);
+		uvw_base_type grid_centre_offset_x = params.nx/2 - params.conv_support;
+		uvw_base_type grid_centre_offset_y = params.ny/2 - params.conv_support;
+		size_t grid_size_in_floats = params.nx * params.ny << 1;
+		bool w_projection = params.wplanes > 1;
+		
+		std::vector<reference_wavelengths_base_type> inv_wavelengths(params.spw_count * params.channel_count);
+		for (size_t i = 0; i < params.spw_count * params.channel_count; ++i)
+		  inv_wavelengths[i] = 1 / params.reference_wavelengths[i];
+		//coalescing only pays off along a baseline, so walk the rows in baseline order
+		std::vector<std::size_t> rows;
+		std::vector<std::size_t> group_starts;
+		group_rows_per_baseline(params,rows,group_starts);
+		std::size_t no_groups = group_starts.size() - 1;
+		std::size_t no_visibilities = 0;
+		std::size_t no_convolutions = 0;
+		
+		#pragma omp parallel for schedule(dynamic) reduction(+:no_visibilities,no_convolutions)
+		for (size_t my_facet_id = 0; my_facet_id < params.num_facet_centres; ++my_facet_id){
+		  grid_base_type* facet_output_buffer;
+		  active_correlation_gridding_policy::compute_facet_grid_ptr(params,my_facet_id,grid_size_in_floats,&facet_output_buffer);
+		  //Compute the transformation necessary to distort the baseline and phase according to the new facet delay centre (Cornwell & Perley, 1991)
+		  typename active_baseline_transformation_policy::baseline_transform_type baseline_transformation;
+		  lmn_coord phase_offset;
+		  uvw_base_type new_delay_ra;
+		  uvw_base_type new_delay_dec;
+		  active_phase_transformation::read_facet_ra_dec(params,my_facet_id,new_delay_ra,new_delay_dec);
+		  active_baseline_transformation_policy::compute_transformation_matrix(params.phase_centre_ra,params.phase_centre_dec,
+										      new_delay_ra,new_delay_dec,baseline_transformation);
+		  active_phase_transformation::compute_delta_lmn(params.phase_centre_ra,params.phase_centre_dec,
+								 new_delay_ra,new_delay_dec,phase_offset);
+		  //scaled grid coordinates and kernel placements of the current row (per channel)
+		  std::vector<uvw_coord<uvw_base_type> > grid_uvw(params.channel_count);
+		  std::vector<kernel_placement> placements(params.channel_count);
+		  //pending coalesced visibilities (per channel)
+		  std::vector<char> pending(params.channel_count,false);
+		  std::vector<kernel_placement> pending_placement(params.channel_count);
+		  std::vector<uvw_coord<uvw_base_type> > pending_uvw(params.channel_count);
+		  std::vector<typename active_trait::vis_type> pending_vis(params.channel_count);
+		  std::vector<typename active_trait::vis_weight_type> pending_weight(params.channel_count);
+		  std::vector<size_t> pending_channel_grid_index(params.channel_count);
+		  auto flush = [&](size_t c){
+			if (!pending[c]) return;
+			pending[c] = false;
+			++no_convolutions;
+			uvw_coord<uvw_base_type> uvw_lambda = pending_uvw[c];
+			typename active_trait::vis_type vis = pending_vis[c];
+			typename active_trait::normalization_accumulator_type normalization_term = 0;
+			active_convolution_policy::convolve(params,grid_centre_offset_x,grid_centre_offset_y,
+							    facet_output_buffer + 
+							      active_correlation_gridding_policy::compute_grid_offset(params,pending_channel_grid_index[c],grid_size_in_floats),
+							    pending_channel_grid_index[c],grid_size_in_floats,
+							    conv_full_support,padded_conv_full_support,uvw_lambda,vis,normalization_term);
+			normalization_term = vector_promotion<visibility_weights_base_type,normalization_base_type>(pending_weight[c] * normalization_term._x);
+			active_correlation_gridding_policy::store_normalization_term(params,pending_channel_grid_index[c],my_facet_id,
+										     normalization_term);
+		  };
+		  for (std::size_t g = 0; g < no_groups; ++g){
+		    for (std::size_t i = group_starts[g]; i < group_starts[g+1]; ++i){
+			size_t row = rows[i];
+			imaging::uvw_coord<uvw_base_type> uvw = params.uvw_coords[row];
+			size_t spw = params.spw_index_array[row];
+			const reference_wavelengths_base_type * __restrict__ spw_inv_wavelengths = &inv_wavelengths[spw * params.channel_count];
+			//compute the grid coordinates and kernel placements of all the channels in the row at once
+			#pragma omp simd
+			for (size_t c = 0; c < params.channel_count; ++c){
+			    uvw_coord< uvw_base_type > uvw_lambda = uvw;
+			    uvw_lambda._u *= spw_inv_wavelengths[c];
+			    uvw_lambda._v *= spw_inv_wavelengths[c];
+			    uvw_lambda._w *= spw_inv_wavelengths[c];
+			    active_baseline_transformation_policy::apply_transformation(uvw_lambda,baseline_transformation);
+			    uvw_lambda._u *= u_scale; 
+			    uvw_lambda._v *= v_scale;
+			    grid_uvw[c] = uvw_lambda;
+			    //the w-projection policies grid the conjugate baseline when w is negative
+			    bool conjugate = w_projection && uvw_lambda._w < 0;
+			    uvw_base_type sign = conjugate ? -1 : 1;
+			    uvw_base_type u = uvw_lambda._u * sign;
+			    uvw_base_type v = uvw_lambda._v * sign;
+			    uvw_base_type w = uvw_lambda._w * sign;
+			    uvw_base_type translated_grid_u = u + grid_centre_offset_x;
+			    uvw_base_type translated_grid_v = v + grid_centre_offset_y;
+			    placements[c].disc_grid_u = std::lrint(translated_grid_u);
+			    placements[c].disc_grid_v = std::lrint(translated_grid_v);
+			    placements[c].frac_u_offset = (1 -u + std::lrint(u)) * params.conv_oversample;
+			    placements[c].frac_v_offset = (1 -v + std::lrint(v)) * params.conv_oversample;
+			    placements[c].w_plane = w_projection ? std::lrint(abs(w)/(float)params.wmax_est*(params.wplanes-1)) : 0;
+			    placements[c].conjugate = conjugate;
+			}
+			for (size_t c = 0; c < params.channel_count; ++c){	
+			    size_t flat_indexed_spw_channel = spw * params.channel_count + c;
+			    if (!params.enabled_channels[flat_indexed_spw_channel]) continue;
+			    typename active_trait::vis_type vis;
+			    typename active_trait::vis_weight_type vis_weight;
+			    typename active_trait::vis_flag_type visibility_flagged;
+			    active_correlation_gridding_policy::read_corralation_data(params,row,spw,c,vis,visibility_flagged,vis_weight);
+			    typename active_trait::vis_flag_type vis_flagged = !visibility_flagged;
+			    if (!vector_any(vis_flagged)) continue;
+			    ++no_visibilities;
+			    /*read and apply the two corrected jones terms if in faceting mode ( Jp^-1 . X . Jq^H^-1 ) --- either DIE or DDE 
+			      assuming small fields of view.*/
+			    active_correlation_gridding_policy::read_and_apply_antenna_jones_terms(params,row,my_facet_id,spw,c,vis);
+			    typename active_trait::vis_weight_type combined_vis_weight = vis_weight * 
+											vector_promotion<int,visibility_base_type>(vector_promotion<bool,int>(vis_flagged));
+			    vis = vis * combined_vis_weight;
+			    //Do phase rotation in accordance with Cornwell & Perley (1992)
+			    uvw_coord< uvw_base_type > uvw_lambda = uvw;
+			    uvw_lambda._u *= spw_inv_wavelengths[c];
+			    uvw_lambda._v *= spw_inv_wavelengths[c];
+			    uvw_lambda._w *= spw_inv_wavelengths[c];
+			    active_phase_transformation::apply_phase_transform(phase_offset,uvw_lambda,vis);
+			    if (pending[c] && pending_placement[c] == placements[c]){
+			      pending_vis[c] += vis;
+			      pending_weight[c] += combined_vis_weight;
+			    } else {
+			      flush(c);
+			      pending[c] = true;
+			      pending_placement[c] = placements[c];
+			      pending_uvw[c] = grid_uvw[c];
+			      pending_vis[c] = vis;
+			      pending_weight[c] = combined_vis_weight;
+			      active_correlation_gridding_policy::read_channel_grid_index(params,flat_indexed_spw_channel,pending_channel_grid_index[c]);
+			    }
+			}//channel
+		    }//row
+		    for (size_t c = 0; c < params.channel_count; ++c)
+		      flush(c);
+		  }//baseline
+		}//facet
+		printf("Coalesced %lu visibilities into %lu convolutions\n",no_visibilities,no_convolutions);
+	}
+}
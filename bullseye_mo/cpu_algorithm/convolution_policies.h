@@ -359,8 +359,8 @@ protected:
     //second correlation
     {
       convolution_base_type min_vis_i = -vis_in._y._imag;
-      __m256 vis_ri_4 = _mm256_set_ps(vis_in._y._imag,vis_in._x._real,vis_in._y._imag,vis_in._y._real,
-				      vis_in._y._imag,vis_in._x._real,vis_in._y._imag,vis_in._y._real);
+      __m256 vis_ri_4 = _mm256_set_ps(vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._y._real,
+				      vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._y._real);
       __m256 vis_mir_4 = _mm256_set_ps(vis_in._y._real,min_vis_i,vis_in._y._real,min_vis_i,
 				      vis_in._y._real,min_vis_i,vis_in._y._real,min_vis_i);
       visses_out[1] = _mm256_add_ps(_mm256_mul_ps(vis_ri_4,
@@ -399,7 +399,7 @@ protected:
     //second correlation
     {
 	convolution_base_type min_vis_i = -vis_in._y._imag;
-	__m256d vis_ri_2 = _mm256_set_pd(vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._x._real);
+	__m256d vis_ri_2 = _mm256_set_pd(vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._y._real);
 	__m256d vis_mir_2 = _mm256_set_pd(vis_in._y._real,min_vis_i,vis_in._y._real,min_vis_i);
 	visses_out[2] = _mm256_add_pd(_mm256_mul_pd(vis_ri_2,
 						    _mm256_set_pd(conv_weight[1]._real,conv_weight[1]._real,
@@ -439,8 +439,8 @@ protected:
     //second correlation
     {
       convolution_base_type min_vis_i = -vis_in._y._imag;
-      __m256 vis_ri_4 = _mm256_set_ps(vis_in._y._imag,vis_in._x._real,vis_in._y._imag,vis_in._y._real,
-				      vis_in._y._imag,vis_in._x._real,vis_in._y._imag,vis_in._y._real);
+      __m256 vis_ri_4 = _mm256_set_ps(vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._y._real,
+				      vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._y._real);
       __m256 vis_mir_4 = _mm256_set_ps(vis_in._y._real,min_vis_i,vis_in._y._real,min_vis_i,
 				      vis_in._y._real,min_vis_i,vis_in._y._real,min_vis_i);
       visses_out[1] = _mm256_add_ps(_mm256_mul_ps(vis_ri_4,
@@ -474,9 +474,9 @@ protected:
     }
     //fourth correlation
     {
-      convolution_base_type min_vis_i = -vis_in._y._imag;
-      __m256 vis_ri_4 = _mm256_set_ps(vis_in._w._imag,vis_in._x._real,vis_in._w._imag,vis_in._w._real,
-				      vis_in._w._imag,vis_in._x._real,vis_in._w._imag,vis_in._w._real);
+      convolution_base_type min_vis_i = -vis_in._w._imag;
+      __m256 vis_ri_4 = _mm256_set_ps(vis_in._w._imag,vis_in._w._real,vis_in._w._imag,vis_in._w._real,
+				      vis_in._w._imag,vis_in._w._real,vis_in._w._imag,vis_in._w._real);
       __m256 vis_mir_4 = _mm256_set_ps(vis_in._w._real,min_vis_i,vis_in._w._real,min_vis_i,
 				      vis_in._w._real,min_vis_i,vis_in._w._real,min_vis_i);
       visses_out[3] = _mm256_add_ps(_mm256_mul_ps(vis_ri_4,
@@ -515,7 +515,7 @@ protected:
     //second correlation
     {
 	convolution_base_type min_vis_i = -vis_in._y._imag;
-	__m256d vis_ri_2 = _mm256_set_pd(vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._x._real);
+	__m256d vis_ri_2 = _mm256_set_pd(vis_in._y._imag,vis_in._y._real,vis_in._y._imag,vis_in._y._real);
 	__m256d vis_mir_2 = _mm256_set_pd(vis_in._y._real,min_vis_i,vis_in._y._real,min_vis_i);
 	visses_out[2] = _mm256_add_pd(_mm256_mul_pd(vis_ri_2,
 						    _mm256_set_pd(conv_weight[1]._real,conv_weight[1]._real,
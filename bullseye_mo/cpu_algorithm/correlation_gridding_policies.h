@@ -39,6 +39,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #pragma once
 #include "correlation_gridding_traits.h"
 #include "gridding_parameters.h"
+#include "facet_geometry.h"
+#include "imaging_weights.h"
 #include "cu_basic_complex.h"
 #include "cu_vec.h"
 namespace imaging {
@@ -67,6 +69,15 @@ namespace imaging {
     static size_t compute_grid_offset(const gridding_parameters & params,
 					   size_t grid_channel_id,
 					   size_t grid_size_in_floats);
+    /**
+     * Points the sample at the sampling function slice it is gridded to when the sampling function is gridded along with
+     * the visibilities (see fused_psf_gridder.h). Nothing to do otherwise.
+     */
+    static void compute_sampling_function_grid_ptr(const gridding_parameters & params,
+						   size_t facet_id,
+						   size_t spw_channel_flat_index,
+						   size_t grid_size_in_floats,
+						   typename active_trait::vis_type & vis);
     static void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -106,6 +117,9 @@ namespace imaging {
       flag = params.flags[vis_index];
       weight = params.visibility_weights[vis_index];
       vis = ((active_trait::vis_type *)params.visibilities)[vis_index];
+      //residual imaging: subtract the model while the visibility is still in registers
+      if (params.model_visibilities != NULL)
+	vis = vis - ((active_trait::vis_type *)params.model_visibilities)[vis_index];
     }
     static void read_channel_grid_index(const gridding_parameters & params,
 						   size_t spw_channel_flat_index,
@@ -122,14 +136,20 @@ namespace imaging {
 						  size_t facet_id,
 						  size_t grid_size_in_floats,
 						  grid_base_type ** facet_grid_starting_ptr){
-      *facet_grid_starting_ptr = (grid_base_type*)params.output_buffer + grid_size_in_floats * 
-				params.number_of_polarization_terms_being_gridded * params.cube_channel_dim_size * facet_id;
+      *facet_grid_starting_ptr = (grid_base_type*)params.output_buffer + 
+				 facet_grid_offset(params,facet_id,grid_size_in_floats * 
+						   params.number_of_polarization_terms_being_gridded * params.cube_channel_dim_size);
     }
     static size_t compute_grid_offset(const gridding_parameters & params,
 				    size_t grid_channel_id,
 				    size_t grid_size_in_floats){
       return (grid_channel_id * params.number_of_polarization_terms_being_gridded) * grid_size_in_floats;
     }
+    static void compute_sampling_function_grid_ptr(const gridding_parameters & params,
+						   size_t facet_id,
+						   size_t spw_channel_flat_index,
+						   size_t grid_size_in_floats,
+						   typename active_trait::vis_type & vis){}
     static inline void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -199,8 +219,13 @@ namespace imaging {
 						  typename active_trait::vis_flag_type & flag,
 						  typename active_trait::vis_weight_type & weight
 						 ){
-      flag = false;
-      weight = 1;
+      size_t vis_index = (row_index * params.channel_count + c) * params.number_of_polarization_terms;
+      flag = params.flags[vis_index + params.polarization_index]; //flagged (or averaged away) samples are not part of the sampling function
+      /*
+       * the sampling function is weighted in the same way as the visibilities, so that the PSF matches the dirty image 
+       * under any imaging weights. An averaged visibility carries the summed weights of all the samples merged into it.
+       */
+      weight = mean_gridded_correlation_weight(params,vis_index);
       vis = vec1<basic_complex<visibility_base_type> >(basic_complex<visibility_base_type>(1,0));
     }
     static void read_channel_grid_index(const gridding_parameters & params,
@@ -218,14 +243,19 @@ namespace imaging {
 						  size_t facet_id,
 						  size_t grid_size_in_floats,
 						  grid_base_type ** facet_grid_starting_ptr){
-      *facet_grid_starting_ptr = (grid_base_type*)params.sampling_function_buffer + grid_size_in_floats * 
-				params.sampling_function_channel_count * facet_id;
+      *facet_grid_starting_ptr = (grid_base_type*)params.sampling_function_buffer + 
+				 facet_sampling_function_grid_offset(params,facet_id,grid_size_in_floats * params.sampling_function_channel_count);
     }
     static size_t compute_grid_offset(const gridding_parameters & params,
 				      size_t grid_channel_id,
 				      size_t grid_size_in_floats){
       return grid_channel_id * grid_size_in_floats;
     }
+    static void compute_sampling_function_grid_ptr(const gridding_parameters & params,
+						   size_t facet_id,
+						   size_t spw_channel_flat_index,
+						   size_t grid_size_in_floats,
+						   typename active_trait::vis_type & vis){}
     static void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -265,6 +295,11 @@ namespace imaging {
       weight._y = (params.visibility_weights)[vis_index + params.second_polarization_index];
       vis._x = ((basic_complex<visibility_base_type>*)params.visibilities)[vis_index + params.polarization_index];
       vis._y = ((basic_complex<visibility_base_type>*)params.visibilities)[vis_index + params.second_polarization_index];
+      //residual imaging: subtract the model while the visibility is still in registers
+      if (params.model_visibilities != NULL){
+	vis._x = vis._x - ((basic_complex<visibility_base_type>*)params.model_visibilities)[vis_index + params.polarization_index];
+	vis._y = vis._y - ((basic_complex<visibility_base_type>*)params.model_visibilities)[vis_index + params.second_polarization_index];
+      }
     }
     static void read_channel_grid_index(const gridding_parameters & params,
 						   size_t spw_channel_flat_index,
@@ -281,14 +316,20 @@ namespace imaging {
 						  size_t facet_id,
 						  size_t grid_size_in_floats,
 						  grid_base_type ** facet_grid_starting_ptr){
-      *facet_grid_starting_ptr = (grid_base_type*)params.output_buffer + grid_size_in_floats * 
-				params.number_of_polarization_terms_being_gridded * params.cube_channel_dim_size * facet_id;
+      *facet_grid_starting_ptr = (grid_base_type*)params.output_buffer + 
+				 facet_grid_offset(params,facet_id,grid_size_in_floats * 
+						   params.number_of_polarization_terms_being_gridded * params.cube_channel_dim_size);
     }
     static size_t compute_grid_offset(const gridding_parameters & params,
 				    size_t grid_channel_id,
 				    size_t grid_size_in_floats){
       return (grid_channel_id * params.number_of_polarization_terms_being_gridded) * grid_size_in_floats;
     }
+    static void compute_sampling_function_grid_ptr(const gridding_parameters & params,
+						   size_t facet_id,
+						   size_t spw_channel_flat_index,
+						   size_t grid_size_in_floats,
+						   typename active_trait::vis_type & vis){}
     static void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -376,6 +417,9 @@ namespace imaging {
       flag = ((active_trait::vis_flag_type *)params.flags)[vis_index];
       weight = ((active_trait::vis_weight_type *)params.visibility_weights)[vis_index];
       vis = ((active_trait::vis_type *)params.visibilities)[vis_index];
+      //residual imaging: subtract the model while the visibility is still in registers
+      if (params.model_visibilities != NULL)
+	vis = vis - ((active_trait::vis_type *)params.model_visibilities)[vis_index];
     }
     static void read_channel_grid_index(const gridding_parameters & params,
 						   size_t spw_channel_flat_index,
@@ -392,14 +436,20 @@ namespace imaging {
 						  size_t facet_id,
 						  size_t grid_size_in_floats,
 						  grid_base_type ** facet_grid_starting_ptr){
-      *facet_grid_starting_ptr = (grid_base_type*)params.output_buffer + grid_size_in_floats * 
-				params.number_of_polarization_terms_being_gridded * params.cube_channel_dim_size * facet_id;
+      *facet_grid_starting_ptr = (grid_base_type*)params.output_buffer + 
+				 facet_grid_offset(params,facet_id,grid_size_in_floats * 
+						   params.number_of_polarization_terms_being_gridded * params.cube_channel_dim_size);
     }
     static size_t compute_grid_offset(const gridding_parameters & params,
 				    size_t grid_channel_id,
 				    size_t grid_size_in_floats){
       return (grid_channel_id * params.number_of_polarization_terms_being_gridded) * grid_size_in_floats;
     }
+    static void compute_sampling_function_grid_ptr(const gridding_parameters & params,
+						   size_t facet_id,
+						   size_t spw_channel_flat_index,
+						   size_t grid_size_in_floats,
+						   typename active_trait::vis_type & vis){}
     static void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -424,7 +474,7 @@ namespace imaging {
     }
 #ifdef __AVX__
 #ifdef BULLSEYE_SINGLE
-    typedef __m256 avx_vis_type[2]  __attribute__((aligned(16)));
+    typedef __m256 avx_vis_type[4]  __attribute__((aligned(16)));
     static inline void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -451,7 +501,7 @@ namespace imaging {
 					accumulator[3]));
     }
 #elif BULLSEYE_DOUBLE
-    typedef __m256d avx_vis_type[4]  __attribute__((aligned(16)));
+    typedef __m256d avx_vis_type[8]  __attribute__((aligned(16)));
     static inline void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -551,6 +601,11 @@ namespace imaging {
 				    size_t grid_size_in_floats){
       return imaging::correlation_gridding_policy<grid_4_correlation>::compute_grid_offset(params,grid_channel_id,grid_size_in_floats);
     }
+    static void compute_sampling_function_grid_ptr(const gridding_parameters & params,
+						   size_t facet_id,
+						   size_t spw_channel_flat_index,
+						   size_t grid_size_in_floats,
+						   typename active_trait::vis_type & vis){}
     static void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -563,7 +618,7 @@ namespace imaging {
     }
 #ifdef __AVX__
 #ifdef BULLSEYE_SINGLE
-    typedef __m256 avx_vis_type[2]  __attribute__((aligned(16)));
+    typedef __m256 avx_vis_type[4]  __attribute__((aligned(16)));
     static inline void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
@@ -575,7 +630,7 @@ namespace imaging {
 										pos_u,pos_v,accumulator); 
     }
 #elif BULLSEYE_DOUBLE
-    typedef __m256d avx_vis_type[4]  __attribute__((aligned(16)));
+    typedef __m256d avx_vis_type[8]  __attribute__((aligned(16)));
     static inline void grid_visibility (grid_base_type* grid,
 					    size_t slice_size,
 					    size_t nx,
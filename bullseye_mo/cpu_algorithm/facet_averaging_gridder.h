@@ -0,0 +1,198 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "templated_gridder.h"
+#include "baseline_dependent_averaging.h"
+
+namespace imaging {
+	/**
+	 * Faceting with per facet averaging: each facet first phase rotates the visibilities to its own delay centre and
+	 * then averages them per baseline over time and frequency, before gridding the reduced set. Because the data is 
+	 * rotated first, the smearing tolerance only needs to hold over the facet itself (instead of over the entire field 
+	 * as in the baseline dependent averaging stage), which permits much longer bins when imaging many small facets.
+	 * 
+	 * Averaged samples are gridded at the mean uvw coordinate (and mean inverse wavelength) of their bin. Jones terms are
+	 * applied to every sample before it is averaged.
+	 */
+	template <typename active_correlation_gridding_policy,
+		  typename active_baseline_transformation_policy,
+		  typename active_phase_transformation,
+		  typename active_convolution_policy>
+	void templated_facet_averaging_gridder(gridding_parameters & params){
+		typedef typename active_correlation_gridding_policy::active_trait active_trait;
+		active_convolution_policy::set_required_rounding_operation();
+		size_t conv_full_support = (params.conv_support << 1) + 1;
+		size_t padded_conv_full_support = conv_full_support + 2; //remember we need to reserve some of the support for +/- frac on both sides
+		
+		//Scale the IFFT by the simularity theorem to the correct FOV
+		uvw_base_type u_scale=params.nx*params.cell_size_x * ARCSEC_TO_RAD;
+		uvw_base_type v_scale=-(params.ny*params.cell_size_y * ARCSEC_TO_RAD);
+		uvw_base_type grid_centre_offset_x = params.nx/2 - params.conv_support;
+		uvw_base_type grid_centre_offset_y = params.ny/2 - params.conv_support;
+		size_t grid_size_in_floats = params.nx * params.ny << 1;
+		
+		//the smearing tolerance must hold up to the corners of the facet
+		uvw_base_type half_facet_size_l = params.nx * params.cell_size_x * 0.5 * ARCSEC_TO_RAD;
+		uvw_base_type half_facet_size_m = params.ny * params.cell_size_y * 0.5 * ARCSEC_TO_RAD;
+		uvw_base_type l_max = sqrt(half_facet_size_l*half_facet_size_l + half_facet_size_m*half_facet_size_m);
+		uvw_base_type n_complement_max = 1 - sqrt(std::max<uvw_base_type>(0,1 - l_max*l_max));
+		uvw_base_type half_tolerance = params.averaging_smearing_tolerance * 0.5; //half for time and half for frequency averaging
+		
+		std::vector<std::size_t> rows;
+		std::vector<std::size_t> group_starts;
+		group_rows_per_baseline(params,rows,group_starts);
+		std::size_t no_groups = group_starts.size() - 1;
+		
+		#pragma omp parallel for schedule(dynamic)
+		for (size_t my_facet_id = 0; my_facet_id < params.num_facet_centres; ++my_facet_id){
+		  grid_base_type* facet_output_buffer;
+		  active_correlation_gridding_policy::compute_facet_grid_ptr(params,my_facet_id,grid_size_in_floats,&facet_output_buffer);
+		  //Compute the transformation necessary to distort the baseline and phase according to the new facet delay centre (Cornwell & Perley, 1991)
+		  typename active_baseline_transformation_policy::baseline_transform_type baseline_transformation;
+		  lmn_coord phase_offset;
+		  uvw_base_type new_delay_ra;
+		  uvw_base_type new_delay_dec;
+		  active_phase_transformation::read_facet_ra_dec(params,my_facet_id,new_delay_ra,new_delay_dec);
+		  active_baseline_transformation_policy::compute_transformation_matrix(params.phase_centre_ra,params.phase_centre_dec,
+										      new_delay_ra,new_delay_dec,baseline_transformation);
+		  active_phase_transformation::compute_delta_lmn(params.phase_centre_ra,params.phase_centre_dec,
+								 new_delay_ra,new_delay_dec,phase_offset);
+		  //weighted, phase rotated sums of the current time bin (per channel)
+		  std::vector<typename active_trait::vis_type> vis_sum(params.channel_count);
+		  std::vector<typename active_trait::vis_weight_type> weight_sum(params.channel_count);
+		  for (std::size_t g = 0; g < no_groups; ++g){
+			size_t spw = params.spw_index_array[rows[group_starts[g]]];
+			uvw_base_type inv_lambda_max = 0; //the shortest wavelength sweeps out the largest distance in the uv plane
+			for (size_t c = 0; c < params.channel_count; ++c)
+			  if (params.enabled_channels[spw * params.channel_count + c])
+			    inv_lambda_max = std::max<uvw_base_type>(inv_lambda_max,1 / params.reference_wavelengths[spw * params.channel_count + c]);
+			std::size_t bin_start = group_starts[g];
+			imaging::uvw_coord<uvw_base_type> uvw_sum(0,0,0);
+			std::fill(vis_sum.begin(),vis_sum.end(),typename active_trait::vis_type());
+			std::fill(weight_sum.begin(),weight_sum.end(),typename active_trait::vis_weight_type());
+			for (std::size_t i = group_starts[g]; i <= group_starts[g+1]; ++i){
+			    bool end_of_baseline = (i == group_starts[g+1]);
+			    if (end_of_baseline || 
+				averaging_phase_drift(params.uvw_coords[rows[bin_start]],params.uvw_coords[rows[i]],
+						      inv_lambda_max,l_max,n_complement_max) > half_tolerance){
+				//grid the current bin, merging channels that stay within the tolerance
+				imaging::uvw_coord<uvw_base_type> uvw_mean = uvw_sum;
+				uvw_mean *= (uvw_base_type)(1.0 / (i - bin_start));
+				uvw_base_type baseline_length = sqrt(uvw_mean._u*uvw_mean._u + uvw_mean._v*uvw_mean._v + uvw_mean._w*uvw_mean._w);
+				for (size_t c_start = 0; c_start < params.channel_count;){
+				    size_t flat_indexed_spw_channel = spw * params.channel_count + c_start;
+				    size_t c_end = c_start + 1;
+				    if (!params.enabled_channels[flat_indexed_spw_channel]) { c_start = c_end; continue; }
+				    reference_wavelengths_base_type inv_lambda_start = 1 / params.reference_wavelengths[flat_indexed_spw_channel];
+				    while (c_end < params.channel_count && can_merge_channels(params,spw,c_start,c_end) &&
+					   2 * M_PI * baseline_length * l_max * 
+					   fabs(1 / params.reference_wavelengths[spw * params.channel_count + c_end] - inv_lambda_start) <= half_tolerance)
+				      ++c_end;
+				    typename active_trait::vis_type vis = vis_sum[c_start];
+				    typename active_trait::vis_weight_type combined_vis_weight = weight_sum[c_start];
+				    uvw_base_type inv_lambda_sum = inv_lambda_start;
+				    for (size_t c = c_start + 1; c < c_end; ++c){
+				      vis += vis_sum[c];
+				      combined_vis_weight += weight_sum[c];
+				      inv_lambda_sum += 1 / params.reference_wavelengths[spw * params.channel_count + c];
+				    }
+				    uvw_base_type inv_lambda_mean = inv_lambda_sum / (c_end - c_start);
+				    c_start = c_end;
+				    if (!vector_any(combined_vis_weight)) continue;
+				    size_t channel_grid_index;
+				    active_correlation_gridding_policy::read_channel_grid_index(params,flat_indexed_spw_channel,channel_grid_index);
+				    uvw_coord< uvw_base_type > uvw_lambda = uvw_mean;
+				    uvw_lambda *= inv_lambda_mean;
+				    //DO baseline rotation in accordance with Cornwell & Perley (1992) / Greisen 2009 --- latter results in coplanar facets
+				    active_baseline_transformation_policy::apply_transformation(uvw_lambda,baseline_transformation);
+				    //scale the uv coordinates (measured in wavelengths) to the correct FOV by the fourier simularity theorem (pg 146-148 Synthesis Imaging in Radio Astronomy II)
+				    uvw_lambda._u *= u_scale; 
+				    uvw_lambda._v *= v_scale;
+				    typename active_trait::normalization_accumulator_type normalization_term = 0;
+				    active_convolution_policy::convolve(params,grid_centre_offset_x,grid_centre_offset_y,
+									facet_output_buffer + 
+									  active_correlation_gridding_policy::compute_grid_offset(params,channel_grid_index,grid_size_in_floats),
+									channel_grid_index,grid_size_in_floats,
+									conv_full_support,padded_conv_full_support,uvw_lambda,vis,normalization_term);
+				    normalization_term = vector_promotion<visibility_weights_base_type,normalization_base_type>(combined_vis_weight * normalization_term._x);
+				    active_correlation_gridding_policy::store_normalization_term(params,channel_grid_index,my_facet_id,
+												 normalization_term);
+				}
+				if (end_of_baseline) break;
+				//start a new bin
+				bin_start = i;
+				uvw_sum = imaging::uvw_coord<uvw_base_type>(0,0,0);
+				std::fill(vis_sum.begin(),vis_sum.end(),typename active_trait::vis_type());
+				std::fill(weight_sum.begin(),weight_sum.end(),typename active_trait::vis_weight_type());
+			    }
+			    //accumulate the current row into the bin
+			    size_t row = rows[i];
+			    imaging::uvw_coord<uvw_base_type> uvw = params.uvw_coords[row];
+			    uvw_sum._u += uvw._u;
+			    uvw_sum._v += uvw._v;
+			    uvw_sum._w += uvw._w;
+			    for (size_t c = 0; c < params.channel_count; ++c){
+				size_t flat_indexed_spw_channel = spw * params.channel_count + c;
+				if (!params.enabled_channels[flat_indexed_spw_channel]) continue;
+				reference_wavelengths_base_type ref_wavelength = 1 / params.reference_wavelengths[flat_indexed_spw_channel];
+				typename active_trait::vis_type vis;
+				typename active_trait::vis_weight_type vis_weight;
+				typename active_trait::vis_flag_type visibility_flagged;
+				active_correlation_gridding_policy::read_corralation_data(params,row,spw,c,vis,visibility_flagged,vis_weight);
+				typename active_trait::vis_flag_type vis_flagged = !visibility_flagged;
+				if (!vector_any(vis_flagged)) continue;
+				//jones terms differ per timestamp, so they have to be applied before averaging
+				active_correlation_gridding_policy::read_and_apply_antenna_jones_terms(params,row,my_facet_id,spw,c,vis);
+				typename active_trait::vis_weight_type combined_vis_weight = vis_weight * 
+											    vector_promotion<int,visibility_base_type>(vector_promotion<bool,int>(vis_flagged));
+				vis = vis * combined_vis_weight;
+				uvw_coord< uvw_base_type > uvw_lambda = uvw;
+				uvw_lambda *= (uvw_base_type)ref_wavelength;
+				//Do phase rotation in accordance with Cornwell & Perley (1992) before averaging
+				active_phase_transformation::apply_phase_transform(phase_offset,uvw_lambda,vis);
+				vis_sum[c] += vis;
+				weight_sum[c] += combined_vis_weight;
+			    }
+			}//row
+		  }//baseline
+		}//facet
+	}
+}
@@ -0,0 +1,184 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "omp.h"
+#include "templated_gridder.h"
+
+namespace imaging {
+	/**
+	 * Approximate number of bytes of phase rotated, transformed visibilities staged per thread before they are gridded.
+	 * This should comfortably fit in the L2 cache.
+	 */
+	const std::size_t FACET_BLOCK_STAGING_BYTES = 1 << 20;
+	/**
+	 * Data-major faceting: the templated gridder streams the entire chunk (uvw, visibilities, weights and flags) from memory
+	 * once per facet. Here the chunk is walked only once, in blocks of rows shared by all the threads. The rows of a block are
+	 * split between the threads, which read every visibility once and rotate and transform it to all the facets. The staged
+	 * block is then gridded facet by facet, with the facets split between the threads, so that the writes to each facet 
+	 * grid stay localized.
+	 * 
+	 * Each facet is only written by one thread per block and the threads meet at the end of every stage, so there are no 
+	 * races on the grids, normalization terms or the staging buffers. Gridding only runs on as many threads as there are 
+	 * facets.
+	 */
+	template <typename active_correlation_gridding_policy,
+		  typename active_baseline_transformation_policy,
+		  typename active_phase_transformation,
+		  typename active_convolution_policy>
+	void templated_facet_blocked_gridder(gridding_parameters & params){
+		typedef typename active_correlation_gridding_policy::active_trait active_trait;
+		typedef typename active_baseline_transformation_policy::baseline_transform_type baseline_transform_type;
+		size_t conv_full_support = (params.conv_support << 1) + 1;
+		size_t padded_conv_full_support = conv_full_support + 2; //remember we need to reserve some of the support for +/- frac on both sides
+		
+		//Scale the IFFT by the simularity theorem to the correct FOV
+		uvw_base_type u_scale=params.nx*params.cell_size_x * ARCSEC_TO_RAD;
+		uvw_base_type v_scale=-(params.ny*params.cell_size_y * ARCSEC_TO_RAD);
+		uvw_base_type grid_centre_offset_x = params.nx/2 - params.conv_support;
+		uvw_base_type grid_centre_offset_y = params.ny/2 - params.conv_support;
+		size_t grid_size_in_floats = params.nx * params.ny << 1;
+		
+		//Compute the transformations necessary to distort the baseline and phase according to the new facet delay centres (Cornwell & Perley, 1991)
+		std::vector<baseline_transform_type> baseline_transformations(params.num_facet_centres);
+		std::vector<lmn_coord> phase_offsets(params.num_facet_centres);
+		for (size_t f = 0; f < params.num_facet_centres; ++f){
+		  uvw_base_type new_delay_ra;
+		  uvw_base_type new_delay_dec;
+		  active_phase_transformation::read_facet_ra_dec(params,f,new_delay_ra,new_delay_dec);
+		  active_baseline_transformation_policy::compute_transformation_matrix(params.phase_centre_ra,params.phase_centre_dec,
+										      new_delay_ra,new_delay_dec,baseline_transformations[f]);
+		  active_phase_transformation::compute_delta_lmn(params.phase_centre_ra,params.phase_centre_dec,
+								 new_delay_ra,new_delay_dec,phase_offsets[f]);
+		}
+		//the staging buffers are shared, so a block holds the share of every thread
+		size_t samples_per_row = params.num_facet_centres * params.channel_count;
+		size_t no_threads = omp_get_max_threads();
+		size_t block_rows = std::max<size_t>(no_threads,FACET_BLOCK_STAGING_BYTES * no_threads / (samples_per_row * 
+								(sizeof(uvw_coord<uvw_base_type>) + sizeof(typename active_trait::vis_type))));
+		//staged values are stored per facet, then per row and channel in the block
+		std::vector<uvw_coord<uvw_base_type> > staged_uvw(block_rows * samples_per_row);
+		std::vector<typename active_trait::vis_type> staged_vis(block_rows * samples_per_row);
+		std::vector<typename active_trait::vis_weight_type> staged_weight(block_rows * params.channel_count);
+		std::vector<size_t> staged_channel_grid_index(block_rows * params.channel_count);
+		std::vector<char> staged_sample_valid(block_rows * params.channel_count); //not vector<bool>: its bits can't be written concurrently
+		
+		#pragma omp parallel
+		{
+		  active_convolution_policy::set_required_rounding_operation(); //the rounding mode is per thread
+		  for (size_t block_start = 0; block_start < params.row_count; block_start += block_rows){
+		    size_t rows_in_block = std::min(block_rows,params.row_count - block_start);
+		    size_t facet_stride = rows_in_block * params.channel_count;
+		    //read the block once and rotate it to every facet
+		    #pragma omp for schedule(static)
+		    for (size_t r = 0; r < rows_in_block; ++r){
+			size_t row = block_start + r;
+			imaging::uvw_coord<uvw_base_type> uvw = params.uvw_coords[row];
+			bool row_flagged = params.flagged_rows[row];
+			bool row_is_in_field_being_imaged = (params.field_array[row] == params.imaging_field);
+			size_t spw = params.spw_index_array[row];
+			for (size_t c = 0; c < params.channel_count; ++c){
+			    size_t sample = r * params.channel_count + c;
+			    size_t flat_indexed_spw_channel = spw * params.channel_count + c;
+			    staged_sample_valid[sample] = false;
+			    if (row_flagged || !row_is_in_field_being_imaged) continue; //these rows carry no weight
+			    if (!params.enabled_channels[flat_indexed_spw_channel]) continue;
+			    typename active_trait::vis_type vis;
+			    typename active_trait::vis_weight_type vis_weight;
+			    typename active_trait::vis_flag_type visibility_flagged;
+			    active_correlation_gridding_policy::read_corralation_data(params,row,spw,c,vis,visibility_flagged,vis_weight);
+			    typename active_trait::vis_flag_type vis_flagged = !visibility_flagged;
+			    if (!vector_any(vis_flagged)) continue; //fully flagged (or averaged away) visibilities contribute nothing
+			    staged_sample_valid[sample] = true;
+			    active_correlation_gridding_policy::read_channel_grid_index(params,flat_indexed_spw_channel,staged_channel_grid_index[sample]);
+			    typename active_trait::vis_weight_type combined_vis_weight = vis_weight * 
+											vector_promotion<int,visibility_base_type>(vector_promotion<bool,int>(vis_flagged));
+			    staged_weight[sample] = combined_vis_weight;
+			    reference_wavelengths_base_type ref_wavelength = 1 / params.reference_wavelengths[flat_indexed_spw_channel];
+			    uvw_coord< uvw_base_type > uvw_lambda = uvw;
+			    {
+			      uvw_lambda._u *= ref_wavelength;
+			      uvw_lambda._v *= ref_wavelength;
+			      uvw_lambda._w *= ref_wavelength;
+			    }
+			    for (size_t f = 0; f < params.num_facet_centres; ++f){
+				typename active_trait::vis_type facet_vis = vis;
+				/*read and apply the two corrected jones terms if in faceting mode ( Jp^-1 . X . Jq^H^-1 ) --- either DIE or DDE 
+				  assuming small fields of view. Weighting is a scalar and can be apply in any order*/
+				active_correlation_gridding_policy::read_and_apply_antenna_jones_terms(params,row,f,spw,c,facet_vis);
+				facet_vis = facet_vis * combined_vis_weight;
+				//Do phase rotation in accordance with Cornwell & Perley (1992)
+				active_phase_transformation::apply_phase_transform(phase_offsets[f],uvw_lambda,facet_vis);
+				//DO baseline rotation in accordance with Cornwell & Perley (1992) / Greisen 2009 --- latter results in coplanar facets
+				uvw_coord< uvw_base_type > facet_uvw = uvw_lambda;
+				active_baseline_transformation_policy::apply_transformation(facet_uvw,baseline_transformations[f]);
+				//scale the uv coordinates (measured in wavelengths) to the correct FOV by the fourier simularity theorem
+				facet_uvw._u *= u_scale; 
+				facet_uvw._v *= v_scale;
+				staged_uvw[f * facet_stride + sample] = facet_uvw;
+				staged_vis[f * facet_stride + sample] = facet_vis;
+			    }
+			}//channel
+		    }//row
+		    //grid the staged block facet by facet (the implied barrier keeps the next block from overwriting it too early)
+		    #pragma omp for schedule(dynamic)
+		    for (size_t my_facet_id = 0; my_facet_id < params.num_facet_centres; ++my_facet_id){
+			grid_base_type* facet_output_buffer;
+			active_correlation_gridding_policy::compute_facet_grid_ptr(params,my_facet_id,grid_size_in_floats,&facet_output_buffer);
+			for (size_t sample = 0; sample < facet_stride; ++sample){
+			    if (!staged_sample_valid[sample]) continue;
+			    size_t channel_grid_index = staged_channel_grid_index[sample];
+			    typename active_trait::normalization_accumulator_type normalization_term = 0;
+			    active_convolution_policy::convolve(params,grid_centre_offset_x,grid_centre_offset_y,
+								facet_output_buffer + 
+								  active_correlation_gridding_policy::compute_grid_offset(params,channel_grid_index,grid_size_in_floats),
+								channel_grid_index,grid_size_in_floats,
+								conv_full_support,padded_conv_full_support,
+								staged_uvw[my_facet_id * facet_stride + sample],staged_vis[my_facet_id * facet_stride + sample],
+								normalization_term);
+			    normalization_term = vector_promotion<visibility_weights_base_type,normalization_base_type>(staged_weight[sample] * normalization_term._x);
+			    active_correlation_gridding_policy::store_normalization_term(params,channel_grid_index,my_facet_id,
+											 normalization_term);
+			}//sample
+		    }//facet
+		  }//block
+		}//parallel
+	}
+}
@@ -0,0 +1,189 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <stdexcept>
+#include "templated_gridder.h"
+#include "tiled_grid_policy.h"
+
+namespace imaging {
+	/**
+	 * A visibility travelling through templated_gridder and the convolution policies together with its sampling function 
+	 * sample (weighted as when it is gridded on its own) and the sampling function slice it is gridded to. The convolution 
+	 * policies scale both by the same convolution weights, so the kernel lookups are shared between the two grids. 
+	 * Everything else (jones corrections, phase rotation and the visibility weights) only sees the visibility.
+	 */
+	template <typename vis_type>
+	struct fused_psf_visibility {
+	  vis_type _vis;
+	  vec1<basic_complex<visibility_base_type> > _psf;
+	  grid_base_type * _psf_grid;
+	  operator vis_type & (){
+	    return _vis;
+	  }
+	};
+	template <typename vis_type, typename conv_weight_type>
+	inline fused_psf_visibility<vis_type> operator*(const fused_psf_visibility<vis_type> & fused, const conv_weight_type & conv_weight){
+	  fused_psf_visibility<vis_type> result;
+	  result._vis = fused._vis * conv_weight;
+	  result._psf = fused._psf * conv_weight;
+	  result._psf_grid = fused._psf_grid;
+	  return result;
+	}
+	template <typename vis_type, typename T>
+	inline fused_psf_visibility<vis_type> operator*(const fused_psf_visibility<vis_type> & fused, const vec1<T> & vis_weight){
+	  fused_psf_visibility<vis_type> result = fused;
+	  result._vis = fused._vis * vis_weight;
+	  return result;
+	}
+	template <typename vis_type, typename T>
+	inline fused_psf_visibility<vis_type> operator*(const fused_psf_visibility<vis_type> & fused, const vec2<T> & vis_weight){
+	  fused_psf_visibility<vis_type> result = fused;
+	  result._vis = fused._vis * vis_weight;
+	  return result;
+	}
+	template <typename vis_type, typename T>
+	inline fused_psf_visibility<vis_type> operator*(const fused_psf_visibility<vis_type> & fused, const vec4<T> & vis_weight){
+	  fused_psf_visibility<vis_type> result = fused;
+	  result._vis = fused._vis * vis_weight;
+	  return result;
+	}
+	template <typename T, typename vis_type>
+	inline void conj(fused_psf_visibility<vis_type> & fused){
+	  conj<T>(fused._vis);
+	  conj<T>(fused._psf);
+	}
+	/**
+	 * Wraps any of the (row-major) correlation gridding policies to accumulate the sampling function along with the 
+	 * visibilities. The sampling function grids have the same dimensions and layout as the visibility grids, so the
+	 * sample lands at the same cell offset in its own slice. The sample, its weight and its slice are read in the same 
+	 * way as when the sampling function is gridded on its own.
+	 */
+	template <typename visibility_policy>
+	class fused_psf_gridding_policy : public visibility_policy {
+	  typedef correlation_gridding_policy<grid_sampling_function> sampling_function_policy;
+	public:
+	  typedef typename visibility_policy::active_trait visibility_trait;
+	  class active_trait : public visibility_trait {
+	  public:
+	    typedef fused_psf_visibility<typename visibility_trait::vis_type> vis_type;
+	    typedef fused_psf_visibility<typename visibility_trait::accumulator_type> accumulator_type;
+	  };
+	  static void read_corralation_data (gridding_parameters & params,
+					     size_t row_index,
+					     size_t spw,
+					     size_t c,
+					     typename active_trait::vis_type & vis,
+					     typename active_trait::vis_flag_type & flag,
+					     typename active_trait::vis_weight_type & weight
+					    ){
+	    visibility_policy::read_corralation_data(params,row_index,spw,c,vis._vis,flag,weight);
+	    typename sampling_function_policy::active_trait::vis_flag_type psf_flag;
+	    typename sampling_function_policy::active_trait::vis_weight_type psf_weight;
+	    sampling_function_policy::read_corralation_data(params,row_index,spw,c,vis._psf,psf_flag,psf_weight);
+	    vis._psf = vis._psf * (psf_flag._x ? 0 : psf_weight._x);
+	  }
+	  static void compute_sampling_function_grid_ptr(const gridding_parameters & params,
+							 size_t facet_id,
+							 size_t spw_channel_flat_index,
+							 size_t grid_size_in_floats,
+							 typename active_trait::vis_type & vis){
+	    grid_base_type* facet_psf_buffer;
+	    sampling_function_policy::compute_facet_grid_ptr(params,facet_id,grid_size_in_floats,&facet_psf_buffer);
+	    size_t psf_channel_grid_index;
+	    sampling_function_policy::read_channel_grid_index(params,spw_channel_flat_index,psf_channel_grid_index);
+	    vis._psf_grid = facet_psf_buffer + sampling_function_policy::compute_grid_offset(params,psf_channel_grid_index,grid_size_in_floats);
+	  }
+	  static inline void grid_visibility (grid_base_type* grid,
+					      size_t slice_size,
+					      size_t nx,
+					      size_t pos_u,
+					      size_t pos_v,
+					      typename active_trait::accumulator_type & accumulator
+					     ){
+	    visibility_policy::grid_visibility(grid,slice_size,nx,pos_u,pos_v,accumulator._vis);
+	    grid_base_type* psf_flat_index = accumulator._psf_grid + ((pos_v * nx + pos_u) << 1);
+	    psf_flat_index[0] += accumulator._psf._x._real;
+	    psf_flat_index[1] += accumulator._psf._x._imag;
+	  }
+	};
+	/**
+	 * The AVX convolution policies only know how to multiply the plain correlation vectors, so the fused policies 
+	 * fall back on the scalar version of the same kernel
+	 */
+	template <typename convolution_mode>
+	struct fused_psf_convolution_mode {
+	  typedef convolution_mode type;
+	};
+#ifdef __AVX__
+	template <>
+	struct fused_psf_convolution_mode<convolution_w_projection_precomputed_vectorized> {
+	  typedef convolution_w_projection_precomputed type;
+	};
+#endif
+	template <typename convolution_policy_type, typename new_correlation_gridding_policy>
+	struct rebind_fused_psf_convolution_policy {};
+	template <typename old_correlation_gridding_policy, typename convolution_mode, typename new_correlation_gridding_policy>
+	struct rebind_fused_psf_convolution_policy<convolution_policy<old_correlation_gridding_policy,convolution_mode>,new_correlation_gridding_policy> {
+	  typedef convolution_policy<new_correlation_gridding_policy,typename fused_psf_convolution_mode<convolution_mode>::type> type;
+	};
+	/**
+	 * Wraps the correlation gridding and convolution policies to grid the sampling function along with the visibilities,
+	 * in the row-major or tiled grid layouts. The other gridding strategies and the planar layout grid the sampling
+	 * function in a seperate pass.
+	 */
+	template <typename correlation_gridding_policy,
+		  typename baseline_transform_policy,
+		  typename phase_transform_policy,
+		  typename convolution_policy>
+	void dispatch_fused_psf_gridder(gridding_parameters & params){
+	  if (params.should_use_planar_grids || params.should_grid_half_plane || params.should_average_per_facet || params.should_coalesce_visibilities ||
+	      (params.should_block_facets && params.num_facet_centres > 1))
+	    throw std::runtime_error("Fused sampling function gridding is only supported by the default gridder in the row-major or tiled grid layouts");
+	  if (params.psf_nx != params.nx || params.psf_ny != params.ny)
+	    throw std::runtime_error("Fused sampling function gridding requires full size PSFs (the PSF cutout is gridded at a different uv cell size)");
+	  typedef fused_psf_gridding_policy<correlation_gridding_policy> fused_correlation_gridding_policy;
+	  typedef typename rebind_fused_psf_convolution_policy<convolution_policy,fused_correlation_gridding_policy>::type fused_convolution_policy;
+	  if (params.should_tile_grids){
+	    typedef tiled_grid_policy<fused_correlation_gridding_policy> tiled_correlation_gridding_policy;
+	    typedef typename rebind_convolution_policy<fused_convolution_policy,tiled_correlation_gridding_policy>::type tiled_convolution_policy;
+	    templated_gridder<tiled_correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,tiled_convolution_policy>(params);
+	  } else
+	    templated_gridder<fused_correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,fused_convolution_policy>(params);
+	}
+}
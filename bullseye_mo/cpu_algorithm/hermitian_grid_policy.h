@@ -0,0 +1,115 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <cstring>
+#include "correlation_gridding_policies.h"
+#include "correlation_gridding_traits.h"
+#include "tiled_grid_policy.h"
+
+namespace imaging {
+	/**
+	 * Hermitian half-plane grids: the images are real, so only the Hermitian part of a uv grid, (G(u,v) + G*(-u,-v)) / 2, 
+	 * contributes to them. Each slice then only stores twice this Hermitian part over the half plane of non-negative u 
+	 * (nx / 2 + 1 columns, in unshifted FFT order), which is inverted with a complex-to-real FFT. Cells at negative u are
+	 * folded onto the cell of the conjugate baseline, while cells on the u = 0 and Nyquist columns (each their own mirror
+	 * column) are added both as is and conjugated. Because the grids are unshifted, no FFT shifts are needed either.
+	 * 
+	 * The grid dimensions must be even. The half plane is stored at the start of each nx x ny slice, so the rest of the
+	 * slice is never touched.
+	 */
+	inline std::size_t half_plane_grid_width(std::size_t nx){
+	  return (nx >> 1) + 1;
+	}
+	/**
+	 * Wraps any of the row-major correlation gridding policies to fold the footprint of the convolution kernel onto the
+	 * half plane
+	 */
+	template <typename row_major_policy>
+	class hermitian_grid_policy : public row_major_policy {
+	public:
+	  typedef typename row_major_policy::active_trait active_trait;
+	  static inline void grid_visibility (grid_base_type* grid,
+					      size_t slice_size,
+					      size_t nx,
+					      size_t pos_u,
+					      size_t pos_v,
+					      typename active_trait::accumulator_type & accumulator
+					     ){
+	    std::size_t ny = (slice_size >> 1) / nx;
+	    std::size_t half_nx = nx >> 1;
+	    std::size_t half_ny = ny >> 1;
+	    std::size_t fft_u = (pos_u >= half_nx) ? pos_u - half_nx : pos_u + half_nx;
+	    std::size_t fft_v = (pos_v >= half_ny) ? pos_v - half_ny : pos_v + half_ny;
+	    if (fft_u <= half_nx)
+	      row_major_policy::grid_visibility(grid,slice_size,half_plane_grid_width(nx),fft_u,fft_v,accumulator);
+	    if (fft_u >= half_nx || fft_u == 0){
+	      typename active_trait::accumulator_type conjugate_accumulator = accumulator;
+	      conj(conjugate_accumulator);
+	      row_major_policy::grid_visibility(grid,slice_size,half_plane_grid_width(nx),
+						(fft_u == 0) ? 0 : nx - fft_u,(fft_v == 0) ? 0 : ny - fft_v,
+						conjugate_accumulator);
+	    }
+	  }
+#ifdef __AVX__
+	  /**
+	   * The vectorized convolution policies accumulate 4 consecutive cells along u at a time. These may have to be folded
+	   * to different places, so the lanes are gridded one cell at a time.
+	   */
+	  template <typename avx_register_type>
+	  static inline void grid_visibility (grid_base_type* grid,
+					      size_t slice_size,
+					      size_t nx,
+					      size_t pos_u,
+					      size_t pos_v,
+					      avx_register_type * accumulator
+					     ){
+	    const std::size_t no_correlations = sizeof(typename active_trait::accumulator_type) / sizeof(basic_complex<visibility_base_type>);
+	    grid_base_type lanes[no_correlations * 4 * 2];
+	    std::memcpy(lanes,accumulator,sizeof(lanes));
+	    for (std::size_t i = 0; i < 4; ++i){
+	      typename active_trait::accumulator_type lane_accumulator;
+	      basic_complex<visibility_base_type> * lane_correlations = (basic_complex<visibility_base_type> *)&lane_accumulator;
+	      for (std::size_t corr = 0; corr < no_correlations; ++corr)
+		lane_correlations[corr] = basic_complex<visibility_base_type>(lanes[(corr * 4 + i) * 2],lanes[(corr * 4 + i) * 2 + 1]);
+	      grid_visibility(grid,slice_size,nx,pos_u + i,pos_v,lane_accumulator);
+	    }
+	  }
+#endif
+	};
+}
@@ -0,0 +1,147 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#include "imaging_weights.h"
+#include <cmath>
+#include <algorithm>
+#include "omp.h"
+#include "cu_common.h"
+namespace imaging{
+  namespace {
+    /**
+     * Nearest density cell of a uv coordinate (in pixels from the centre of the uv grid), false if it falls off the grid
+     */
+    inline bool density_cell(uvw_base_type u_pix, uvw_base_type v_pix, std::size_t scale, 
+			     std::size_t density_nx, std::size_t density_ny, std::size_t & cell){
+      long x = (long)std::floor(u_pix / scale + 0.5) + (long)(density_nx / 2);
+      long y = (long)std::floor(v_pix / scale + 0.5) + (long)(density_ny / 2);
+      if (x < 0 || y < 0 || x >= (long)density_nx || y >= (long)density_ny) return false;
+      cell = y * density_nx + x;
+      return true;
+    }
+  }
+  imaging_weighter::imaging_weighter(): _density_nx(0), _density_ny(0), _densities_final(false) {}
+  void imaging_weighter::accumulate(const gridding_parameters & params){
+    std::size_t scale = std::max<std::size_t>(1,params.weighting_density_scale);
+    if (_densities.empty()){
+      _density_nx = (params.nx + scale - 1) / scale;
+      _density_ny = (params.ny + scale - 1) / scale;
+      _densities.resize(params.cube_channel_dim_size * _density_nx * _density_ny,0);
+    }
+    _densities_final = false;
+    std::size_t density_size = _density_nx * _density_ny;
+    uvw_base_type u_scale = params.nx*params.cell_size_x * ARCSEC_TO_RAD;
+    uvw_base_type v_scale = -(params.ny*params.cell_size_y * ARCSEC_TO_RAD);
+    normalization_base_type * __restrict__ densities = &_densities[0];
+    #pragma omp parallel for schedule(dynamic,64)
+    for (std::size_t row = 0; row < params.row_count; ++row){
+      if (params.flagged_rows[row] || params.field_array[row] != params.imaging_field) continue;
+      std::size_t spw = params.spw_index_array[row];
+      imaging::uvw_coord<uvw_base_type> uvw = params.uvw_coords[row];
+      for (std::size_t c = 0; c < params.channel_count; ++c){
+	std::size_t flat_indexed_spw_channel = spw * params.channel_count + c;
+	if (!params.enabled_channels[flat_indexed_spw_channel]) continue;
+	//the imaging weights are computed from the mean natural weight of the correlations being gridded
+	normalization_base_type weight = mean_gridded_correlation_weight(params,(row * params.channel_count + c) * params.number_of_polarization_terms);
+	if (weight == 0) continue; //fully flagged
+	uvw_base_type inv_lambda = 1 / params.reference_wavelengths[flat_indexed_spw_channel];
+	uvw_base_type u_pix = uvw._u * inv_lambda * u_scale;
+	uvw_base_type v_pix = uvw._v * inv_lambda * v_scale;
+	normalization_base_type * __restrict__ density = densities + params.channel_grid_indicies[flat_indexed_spw_channel] * density_size;
+	std::size_t cell;
+	if (density_cell(u_pix,v_pix,scale,_density_nx,_density_ny,cell)){
+	  #pragma omp atomic
+	  density[cell] += weight;
+	}
+	if (density_cell(-u_pix,-v_pix,scale,_density_nx,_density_ny,cell)){
+	  #pragma omp atomic
+	  density[cell] += weight;
+	}
+      }
+    }
+  }
+  void imaging_weighter::finalize_densities(const gridding_parameters & params){
+    std::size_t density_size = _density_nx * _density_ny;
+    normalization_base_type robust_numerator = 5 * pow(10.0,-params.weighting_robustness);
+    robust_numerator *= robust_numerator;
+    _robust_scales.resize(params.cube_channel_dim_size);
+    for (std::size_t g = 0; g < params.cube_channel_dim_size; ++g){
+      normalization_base_type sum_weights = 0;
+      normalization_base_type sum_squared_densities = 0;
+      #pragma omp parallel for reduction(+:sum_weights,sum_squared_densities)
+      for (std::size_t i = 0; i < density_size; ++i){
+	normalization_base_type d = _densities[g * density_size + i];
+	sum_weights += d;
+	sum_squared_densities += d * d;
+      }
+      _robust_scales[g] = (sum_squared_densities > 0) ? robust_numerator * sum_weights / sum_squared_densities : 0;
+    }
+    _densities_final = true;
+  }
+  void imaging_weighter::apply(gridding_parameters & params){
+    if (_densities.empty()) return; //nothing accumulated, so nothing will be gridded either
+    if (!_densities_final)
+      finalize_densities(params);
+    std::size_t scale = std::max<std::size_t>(1,params.weighting_density_scale);
+    std::size_t density_size = _density_nx * _density_ny;
+    uvw_base_type u_scale = params.nx*params.cell_size_x * ARCSEC_TO_RAD;
+    uvw_base_type v_scale = -(params.ny*params.cell_size_y * ARCSEC_TO_RAD);
+    #pragma omp parallel for schedule(dynamic,64)
+    for (std::size_t row = 0; row < params.row_count; ++row){
+      if (params.flagged_rows[row] || params.field_array[row] != params.imaging_field) continue;
+      std::size_t spw = params.spw_index_array[row];
+      imaging::uvw_coord<uvw_base_type> uvw = params.uvw_coords[row];
+      for (std::size_t c = 0; c < params.channel_count; ++c){
+	std::size_t flat_indexed_spw_channel = spw * params.channel_count + c;
+	if (!params.enabled_channels[flat_indexed_spw_channel]) continue;
+	uvw_base_type inv_lambda = 1 / params.reference_wavelengths[flat_indexed_spw_channel];
+	std::size_t cell;
+	if (!density_cell(uvw._u * inv_lambda * u_scale,uvw._v * inv_lambda * v_scale,scale,_density_nx,_density_ny,cell)) continue;
+	std::size_t g = params.channel_grid_indicies[flat_indexed_spw_channel];
+	normalization_base_type density = _densities[g * density_size + cell];
+	if (density <= 0) continue; //fully flagged, these visibilities carry no weight
+	visibility_weights_base_type weight_scale = params.should_use_robust_weighting ? 1 / (1 + density * _robust_scales[g]) : 
+											 1 / density;
+	visibility_weights_base_type * __restrict__ weights = params.visibility_weights + 
+							      (row * params.channel_count + c) * params.number_of_polarization_terms;
+	for (std::size_t corr = 0; corr < params.number_of_polarization_terms; ++corr)
+	  weights[corr] *= weight_scale;
+      }
+    }
+  }
+}
@@ -0,0 +1,109 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <vector>
+#include "gridding_parameters.h"
+namespace imaging{
+    /**
+     * The correlations being gridded (at most 4), these make up the imaging weight of a visibility
+     */
+    inline std::size_t gridded_correlations(const gridding_parameters & params, std::size_t * corrs){
+      if (params.number_of_polarization_terms_being_gridded == 1){
+	corrs[0] = params.polarization_index;
+	return 1;
+      } else if (params.number_of_polarization_terms_being_gridded == 2){
+	corrs[0] = params.polarization_index;
+	corrs[1] = params.second_polarization_index;
+	return 2;
+      }
+      for (std::size_t corr = 0; corr < params.number_of_polarization_terms; ++corr)
+	corrs[corr] = corr;
+      return params.number_of_polarization_terms;
+    }
+    /**
+     * The mean weight of the unflagged correlations being gridded of the visibility starting at vis_index (0 if they are 
+     * all flagged)
+     */
+    inline visibility_weights_base_type mean_gridded_correlation_weight(const gridding_parameters & params, std::size_t vis_index){
+      std::size_t corrs[4];
+      std::size_t no_corrs = gridded_correlations(params,corrs);
+      visibility_weights_base_type weight = 0;
+      std::size_t no_unflagged = 0;
+      for (std::size_t i = 0; i < no_corrs; ++i)
+	if (!params.flags[vis_index + corrs[i]]){
+	  weight += params.visibility_weights[vis_index + corrs[i]];
+	  ++no_unflagged;
+	}
+      return (no_unflagged == 0) ? 0 : weight / no_unflagged;
+    }
+    /**
+     * Per visibility imaging weights (uniform, robust / Briggs and super-uniform weighting), computed ahead of the gridder
+     * 
+     * The natural weights of all the data being imaged are first binned (nearest neighbour) onto a real-valued density grid 
+     * per cube channel, along with their hermitian counterparts. Each density cell spans weighting_density_scale x 
+     * weighting_density_scale uv cells (super-uniform weighting when > 1). Once all the data has been accumulated the natural 
+     * weight w of each visibility is replaced by
+     *   uniform: w / D
+     *   robust:  w / (1 + D f^2), with f^2 = (5 * 10^-R)^2 / (sum D^2 / sum w) (Briggs, 1995)
+     * where D is the density of the cell the visibility falls into. The gridder then picks up the new weights as if they 
+     * were natural weights.
+     * 
+     * The densities are computed from the unrotated uv coordinates, so all the facets share the same imaging weights.
+     */
+    class imaging_weighter {
+    private:
+      std::vector<normalization_base_type> _densities; //cube_channel_dim_size x density_ny x density_nx
+      std::vector<normalization_base_type> _robust_scales; //f^2 per cube channel
+      std::size_t _density_nx;
+      std::size_t _density_ny;
+      bool _densities_final;
+      void finalize_densities(const gridding_parameters & params);
+    public:
+      imaging_weighter();
+      /**
+       * Adds the natural weights of the chunk described by params to the density grids. This must be called for all 
+       * the data being imaged before the first call to apply.
+       */
+      void accumulate(const gridding_parameters & params);
+      /**
+       * Replaces the natural weights of the chunk described by params with imaging weights (in place)
+       */
+      void apply(gridding_parameters & params);
+    };
+}
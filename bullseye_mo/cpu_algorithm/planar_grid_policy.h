@@ -0,0 +1,349 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <vector>
+#include <complex>
+#include <algorithm>
+#include "correlation_gridding_policies.h"
+#include "convolution_policies.h"
+
+namespace imaging {
+	/**
+	 * Planar grid layout: every (nx x ny) correlation slice stores all the real components followed by all the imaginary
+	 * components, instead of interleaved complex numbers. Consecutive cells along u then map to contiguous vector lanes, 
+	 * so the vectorized convolution policies can accumulate with plain (fused) multiply-adds, without shuffling the 
+	 * visibilities into interleaved real / imaginary vectors first. The slices are re-interleaved before the FFT.
+	 */
+#ifdef __AVX__
+#ifdef BULLSEYE_SINGLE
+	typedef __m256 planar_lanes_type;
+	const std::size_t PLANAR_LANES = 8;
+	inline planar_lanes_type planar_load(const grid_base_type * p) { return _mm256_loadu_ps(p); }
+	inline void planar_store(grid_base_type * p, planar_lanes_type v) { _mm256_storeu_ps(p,v); }
+	inline planar_lanes_type planar_set1(grid_base_type x) { return _mm256_set1_ps(x); }
+#ifdef __FMA__
+	inline planar_lanes_type planar_fmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_fmadd_ps(a,b,c); }
+	inline planar_lanes_type planar_fnmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_fnmadd_ps(a,b,c); }
+#else
+	inline planar_lanes_type planar_fmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_add_ps(_mm256_mul_ps(a,b),c); }
+	inline planar_lanes_type planar_fnmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_sub_ps(c,_mm256_mul_ps(a,b)); }
+#endif
+#elif BULLSEYE_DOUBLE
+	typedef __m256d planar_lanes_type;
+	const std::size_t PLANAR_LANES = 4;
+	inline planar_lanes_type planar_load(const grid_base_type * p) { return _mm256_loadu_pd(p); }
+	inline void planar_store(grid_base_type * p, planar_lanes_type v) { _mm256_storeu_pd(p,v); }
+	inline planar_lanes_type planar_set1(grid_base_type x) { return _mm256_set1_pd(x); }
+#ifdef __FMA__
+	inline planar_lanes_type planar_fmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_fmadd_pd(a,b,c); }
+	inline planar_lanes_type planar_fnmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_fnmadd_pd(a,b,c); }
+#else
+	inline planar_lanes_type planar_fmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_add_pd(_mm256_mul_pd(a,b),c); }
+	inline planar_lanes_type planar_fnmadd(planar_lanes_type a, planar_lanes_type b, planar_lanes_type c) { return _mm256_sub_pd(c,_mm256_mul_pd(a,b)); }
+#endif
+#endif
+#endif
+	/**
+	 * Wraps any of the correlation gridding policies to accumulate into planar grids
+	 */
+	template <typename interleaved_policy>
+	class planar_grid_policy : public interleaved_policy {
+	public:
+	  typedef typename interleaved_policy::active_trait active_trait;
+	  static const std::size_t no_correlations = sizeof(typename active_trait::accumulator_type) / sizeof(basic_complex<visibility_base_type>);
+	  static inline void grid_visibility (grid_base_type* grid,
+					      size_t slice_size,
+					      size_t nx,
+					      size_t pos_u,
+					      size_t pos_v,
+					      typename active_trait::accumulator_type & accumulator
+					     ){
+	    const basic_complex<visibility_base_type> * correlations = (const basic_complex<visibility_base_type> *)&accumulator;
+	    grid_base_type* grid_real_plane = grid + pos_v * nx + pos_u;
+	    grid_base_type* grid_imag_plane = grid_real_plane + (slice_size >> 1);
+	    for (std::size_t corr = 0; corr < no_correlations; ++corr){
+	      grid_real_plane[corr * slice_size] += correlations[corr]._real;
+	      grid_imag_plane[corr * slice_size] += correlations[corr]._imag;
+	    }
+	  }
+#ifdef __AVX__
+	  /**
+	   * Accumulates vis * conv_weight into PLANAR_LANES consecutive cells along u, where the complex convolution weights
+	   * are given as seperate real and imaginary lanes
+	   */
+	  static inline void grid_visibility_lanes (grid_base_type* grid,
+						    size_t slice_size,
+						    size_t nx,
+						    size_t pos_u,
+						    size_t pos_v,
+						    const typename active_trait::vis_type & vis,
+						    planar_lanes_type conv_weight_real,
+						    planar_lanes_type conv_weight_imag
+						   ){
+	    const basic_complex<visibility_base_type> * correlations = (const basic_complex<visibility_base_type> *)&vis;
+	    grid_base_type* grid_real_plane = grid + pos_v * nx + pos_u;
+	    grid_base_type* grid_imag_plane = grid_real_plane + (slice_size >> 1);
+	    for (std::size_t corr = 0; corr < no_correlations; ++corr){
+	      planar_lanes_type vis_real = planar_set1(correlations[corr]._real);
+	      planar_lanes_type vis_imag = planar_set1(correlations[corr]._imag);
+	      grid_base_type* real_ptr = grid_real_plane + corr * slice_size;
+	      grid_base_type* imag_ptr = grid_imag_plane + corr * slice_size;
+	      planar_store(real_ptr,planar_fnmadd(vis_imag,conv_weight_imag,planar_fmadd(vis_real,conv_weight_real,planar_load(real_ptr))));
+	      planar_store(imag_ptr,planar_fmadd(vis_imag,conv_weight_real,planar_fmadd(vis_real,conv_weight_imag,planar_load(imag_ptr))));
+	    }
+	  }
+	  /**
+	   * As above, but for real-valued convolution weights
+	   */
+	  static inline void grid_visibility_lanes (grid_base_type* grid,
+						    size_t slice_size,
+						    size_t nx,
+						    size_t pos_u,
+						    size_t pos_v,
+						    const typename active_trait::vis_type & vis,
+						    planar_lanes_type conv_weight
+						   ){
+	    const basic_complex<visibility_base_type> * correlations = (const basic_complex<visibility_base_type> *)&vis;
+	    grid_base_type* grid_real_plane = grid + pos_v * nx + pos_u;
+	    grid_base_type* grid_imag_plane = grid_real_plane + (slice_size >> 1);
+	    for (std::size_t corr = 0; corr < no_correlations; ++corr){
+	      grid_base_type* real_ptr = grid_real_plane + corr * slice_size;
+	      grid_base_type* imag_ptr = grid_imag_plane + corr * slice_size;
+	      planar_store(real_ptr,planar_fmadd(planar_set1(correlations[corr]._real),conv_weight,planar_load(real_ptr)));
+	      planar_store(imag_ptr,planar_fmadd(planar_set1(correlations[corr]._imag),conv_weight,planar_load(imag_ptr)));
+	    }
+	  }
+#endif
+	};
+#ifdef __AVX__
+	class convolution_AA_1D_precomputed_planar_vectorized {};
+	class convolution_w_projection_precomputed_planar_vectorized {};
+	/**
+	 * Vectorized 1D precomputed AA kernel for planar grids (same placement and rounding as convolution_AA_1D_precomputed)
+	 */
+	template <typename active_correlation_gridding_policy>
+	class convolution_policy <active_correlation_gridding_policy,convolution_AA_1D_precomputed_planar_vectorized> {
+	public:
+	    inline static void set_required_rounding_operation(){
+	      std::fesetround(FE_DOWNWARD); // this is the same strategy followed in the casacore gridder and produces very similar looking images
+	    }
+	    inline static void convolve(gridding_parameters & params, uvw_base_type grid_centre_offset_x,
+					uvw_base_type grid_centre_offset_y,
+					grid_base_type * __restrict__ facet_output_buffer,
+					std::size_t channel_grid_index,
+					std::size_t grid_size_in_floats,
+					size_t conv_full_support,
+					size_t padded_conv_full_support,
+					uvw_coord< uvw_base_type > & uvw,
+					typename active_correlation_gridding_policy::active_trait::vis_type & vis,
+					typename active_correlation_gridding_policy::active_trait::normalization_accumulator_type & normalization_term) {
+		//account for interpolation error (we select the closest sample from the oversampled convolution filter)
+		uvw_base_type translated_grid_u = uvw._u + grid_centre_offset_x;
+		uvw_base_type translated_grid_v = uvw._v + grid_centre_offset_y;
+		std::size_t disc_grid_u = std::lrint(translated_grid_u);
+		std::size_t disc_grid_v = std::lrint(translated_grid_v);
+		//to reduce the interpolation error we need to take the offset from the grid centre into account when choosing a convolution weight
+		std::size_t frac_u_offset = (1 -uvw._u + std::lrint(uvw._u)) * params.conv_oversample;
+		std::size_t frac_v_offset = (1 -uvw._v + std::lrint(uvw._v)) * params.conv_oversample;
+		//Don't you dare go over the boundary
+		if (disc_grid_v + padded_conv_full_support  >= params.ny || disc_grid_u + padded_conv_full_support >= params.nx ||
+			disc_grid_v >= params.ny || disc_grid_u >= params.nx) return;
+		std::size_t unrolled_ul = conv_full_support / PLANAR_LANES;
+		std::size_t rem_loop_ll = unrolled_ul * PLANAR_LANES;
+		std::size_t conv_v = frac_v_offset;
+		for (std::size_t sup_v = 0; sup_v < conv_full_support; ++sup_v) {
+		    convolution_base_type conv_v_weight = params.conv[conv_v];
+		    for (std::size_t sup_u = 0; sup_u < unrolled_ul; ++sup_u) {
+			convolution_base_type conv_weight[PLANAR_LANES] __attribute__((aligned(32)));
+			std::size_t conv_u = frac_u_offset + sup_u * PLANAR_LANES * params.conv_oversample;
+			for (std::size_t lane = 0; lane < PLANAR_LANES; ++lane){
+			  conv_weight[lane] = params.conv[conv_u] * conv_v_weight;
+			  normalization_term += conv_weight[lane];
+			  conv_u += params.conv_oversample;
+			}
+			active_correlation_gridding_policy::grid_visibility_lanes(facet_output_buffer,
+										  grid_size_in_floats,
+										  params.nx,
+										  disc_grid_u + sup_u * PLANAR_LANES,
+										  disc_grid_v + sup_v,
+										  vis,
+										  planar_load(conv_weight));
+		    }
+		    std::size_t conv_u = frac_u_offset + rem_loop_ll * params.conv_oversample;
+		    for (std::size_t sup_u = rem_loop_ll; sup_u < conv_full_support; ++sup_u) {
+			convolution_base_type conv_weight = params.conv[conv_u] * conv_v_weight;
+			typename active_correlation_gridding_policy::active_trait::vis_type convolved_vis = vis * conv_weight;
+			active_correlation_gridding_policy::grid_visibility(facet_output_buffer,
+									    grid_size_in_floats,
+									    params.nx,
+									    disc_grid_u + sup_u,
+									    disc_grid_v + sup_v,
+									    convolved_vis);
+			normalization_term += conv_weight;
+			conv_u += params.conv_oversample;
+		    }
+		    conv_v += params.conv_oversample;
+		} //conv_v
+	    }
+	};
+	/**
+	 * Vectorized 2D precomputed w-projection kernel for planar grids (same placement as convolution_w_projection_precomputed)
+	 */
+	template <typename active_correlation_gridding_policy>
+	class convolution_policy <active_correlation_gridding_policy,convolution_w_projection_precomputed_planar_vectorized> {
+	public:
+	    inline static void set_required_rounding_operation(){
+	      std::fesetround(FE_TONEAREST); 
+	    }
+	    inline static void convolve(gridding_parameters & params, uvw_base_type grid_centre_offset_x,
+					uvw_base_type grid_centre_offset_y,
+					grid_base_type * __restrict__ facet_output_buffer,
+					std::size_t channel_grid_index,
+					std::size_t grid_size_in_floats,
+					size_t conv_full_support,
+					size_t padded_conv_full_support,
+					uvw_coord< uvw_base_type > & uvw,
+					typename active_correlation_gridding_policy::active_trait::vis_type & vis,
+					typename active_correlation_gridding_policy::active_trait::normalization_accumulator_type & normalization_term) {
+		//W should be positive (either we grid the visibility or its conjugate baseline):	
+		if (uvw._w < 0){
+		  conj<visibility_base_type>(vis);
+		  uvw._u *= -1;
+		  uvw._v *= -1;
+		  uvw._w *= -1;
+		}
+		//account for interpolation error (we select the closest sample from the oversampled convolution filter)
+		uvw_base_type translated_grid_u = uvw._u + grid_centre_offset_x;
+		uvw_base_type translated_grid_v = uvw._v + grid_centre_offset_y;
+		std::size_t  disc_grid_u = std::lrint(translated_grid_u);
+		std::size_t  disc_grid_v = std::lrint(translated_grid_v);
+		//to reduce the interpolation error we need to take the offset from the grid centre into account when choosing a convolution weight
+		std::size_t frac_u_offset = (1 -uvw._u + std::lrint(uvw._u)) * params.conv_oversample;
+		std::size_t frac_v_offset = (1 -uvw._v + std::lrint(uvw._v)) * params.conv_oversample;
+		
+		std::size_t conv_dim_size = padded_conv_full_support + (padded_conv_full_support - 1) * (params.conv_oversample - 1);
+		std::size_t best_fit_w_plane = std::lrint(abs(uvw._w)/(float)params.wmax_est*(params.wplanes-1));
+		std::size_t filter_offset = best_fit_w_plane * conv_dim_size * conv_dim_size;
+		
+		//Don't you dare go over the boundary
+		if (disc_grid_v + padded_conv_full_support >= params.ny || disc_grid_u + padded_conv_full_support >= params.nx ||
+			disc_grid_v >= params.ny || disc_grid_u >= params.nx || best_fit_w_plane >= params.wplanes) return;
+		const basic_complex<convolution_base_type> * conv = (const basic_complex<convolution_base_type>*)params.conv;
+		std::size_t unrolled_ul = conv_full_support / PLANAR_LANES;
+		std::size_t rem_loop_ll = unrolled_ul * PLANAR_LANES;
+		std::size_t conv_v = filter_offset + frac_v_offset * conv_dim_size;
+		for (std::size_t sup_v = 0; sup_v < conv_full_support; ++sup_v){
+		  for (std::size_t sup_u = 0; sup_u < unrolled_ul; ++sup_u){
+		      convolution_base_type conv_weight_real[PLANAR_LANES] __attribute__((aligned(32)));
+		      convolution_base_type conv_weight_imag[PLANAR_LANES] __attribute__((aligned(32)));
+		      std::size_t conv_flat_index = conv_v + frac_u_offset + sup_u * PLANAR_LANES * params.conv_oversample;
+		      for (std::size_t lane = 0; lane < PLANAR_LANES; ++lane){
+			conv_weight_real[lane] = conv[conv_flat_index]._real;
+			conv_weight_imag[lane] = conv[conv_flat_index]._imag;
+			normalization_term += conv_weight_real[lane]; // real and imaginary components roughly similar
+			conv_flat_index += params.conv_oversample;
+		      }
+		      active_correlation_gridding_policy::grid_visibility_lanes(facet_output_buffer,
+										grid_size_in_floats,
+										params.nx,
+										disc_grid_u + sup_u * PLANAR_LANES,
+										disc_grid_v + sup_v,
+										vis,
+										planar_load(conv_weight_real),
+										planar_load(conv_weight_imag));
+		  }
+		  for (std::size_t sup_u = rem_loop_ll; sup_u < conv_full_support; ++sup_u){
+		      std::size_t conv_flat_index = conv_v + frac_u_offset + sup_u * params.conv_oversample;
+		      basic_complex<convolution_base_type> conv_weight = conv[conv_flat_index];
+		      typename active_correlation_gridding_policy::active_trait::vis_type convolved_vis = vis * conv_weight;
+		      active_correlation_gridding_policy::grid_visibility(facet_output_buffer,
+									  grid_size_in_floats,
+									  params.nx,
+									  disc_grid_u + sup_u,
+									  disc_grid_v + sup_v,
+									  convolved_vis);
+		      normalization_term += conv_weight._real; // real and imaginary components roughly similar
+		  }
+		  conv_v += params.conv_oversample * conv_dim_size;
+		}
+	    }
+	};
+#endif
+	/**
+	 * Picks the planar counterpart of a convolution mode (modes without one grid through the scalar planar accumulation)
+	 */
+	template <typename convolution_mode>
+	struct planar_convolution_mode { typedef convolution_mode type; };
+#ifdef __AVX__
+	template <>
+	struct planar_convolution_mode<convolution_AA_1D_precomputed> { typedef convolution_AA_1D_precomputed_planar_vectorized type; };
+	template <>
+	struct planar_convolution_mode<convolution_w_projection_precomputed> { typedef convolution_w_projection_precomputed_planar_vectorized type; };
+	template <>
+	struct planar_convolution_mode<convolution_w_projection_precomputed_vectorized> { typedef convolution_w_projection_precomputed_planar_vectorized type; };
+#endif
+	/**
+	 * Rebinds a convolution policy to its planar counterpart, gridding through the given planar correlation gridding policy
+	 */
+	template <typename convolution_policy_type, typename planar_correlation_gridding_policy>
+	struct rebind_planar_convolution_policy {};
+	template <typename old_correlation_gridding_policy, typename convolution_mode, typename planar_correlation_gridding_policy>
+	struct rebind_planar_convolution_policy<convolution_policy<old_correlation_gridding_policy,convolution_mode>,planar_correlation_gridding_policy> {
+	  typedef convolution_policy<planar_correlation_gridding_policy,typename planar_convolution_mode<convolution_mode>::type> type;
+	};
+	/**
+	 * Re-interleaves no_slices planar nx x ny grids into complex grids. This needs a temporary copy of one slice.
+	 */
+	inline void interleave_planar_grids(std::complex<grid_base_type> * __restrict__ grids, std::size_t nx, std::size_t ny, std::size_t no_slices){
+	  std::size_t slice_cells = nx * ny;
+	  std::vector<grid_base_type> planes(slice_cells << 1);
+	  for (std::size_t s = 0; s < no_slices; ++s){
+	    grid_base_type * __restrict__ slice_ptr = (grid_base_type *)(grids + s * slice_cells);
+	    grid_base_type * __restrict__ planes_ptr = planes.data();
+	    #pragma omp parallel for schedule(static)
+	    for (std::size_t i = 0; i < (slice_cells << 1); ++i)
+	      planes_ptr[i] = slice_ptr[i];
+	    #pragma omp parallel for schedule(static)
+	    for (std::size_t i = 0; i < slice_cells; ++i){
+	      slice_ptr[i << 1] = planes_ptr[i];
+	      slice_ptr[(i << 1) + 1] = planes_ptr[slice_cells + i];
+	    }
+	  }
+	}
+}
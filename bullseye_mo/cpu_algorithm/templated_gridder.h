@@ -2,6 +2,7 @@
 
 #include <cfenv>
 #include "gridding_parameters.h"
+#include "facet_geometry.h"
 #include "baseline_transform_policies.h"
 #include "phase_transform_policies.h"
 #include "baseline_transform_traits.h"
@@ -19,15 +20,16 @@ namespace imaging {
 		size_t conv_full_support = (params.conv_support << 1) + 1;
 		size_t padded_conv_full_support = conv_full_support + 2; //remember we need to reserve some of the support for +/- frac on both sides
 		
-		//Scale the IFFT by the simularity theorem to the correct FOV
-		uvw_base_type u_scale=params.nx*params.cell_size_x * ARCSEC_TO_RAD;
-		uvw_base_type v_scale=-(params.ny*params.cell_size_y * ARCSEC_TO_RAD);
-		uvw_base_type grid_centre_offset_x = params.nx/2 - params.conv_support;
-		uvw_base_type grid_centre_offset_y = params.ny/2 - params.conv_support;
-		size_t grid_size_in_floats = params.nx * params.ny << 1;
-		
 		#pragma omp parallel for schedule(static)
 		for (size_t my_facet_id = 0; my_facet_id < params.num_facet_centres; ++my_facet_id){
+		  //every facet may have its own grid and cell size (see facet_geometry.h)
+		  gridding_parameters facet_params = facet_gridding_parameters(params,my_facet_id);
+		  //Scale the IFFT by the simularity theorem to the correct FOV
+		  uvw_base_type u_scale=facet_params.nx*facet_params.cell_size_x * ARCSEC_TO_RAD;
+		  uvw_base_type v_scale=-(facet_params.ny*facet_params.cell_size_y * ARCSEC_TO_RAD);
+		  uvw_base_type grid_centre_offset_x = facet_params.nx/2 - params.conv_support;
+		  uvw_base_type grid_centre_offset_y = facet_params.ny/2 - params.conv_support;
+		  size_t grid_size_in_floats = facet_params.nx * facet_params.ny << 1;
 		  grid_base_type* facet_output_buffer;
 		  active_correlation_gridding_policy::compute_facet_grid_ptr(params,my_facet_id,grid_size_in_floats,&facet_output_buffer);
 		  //Compute the transformation necessary to distort the baseline and phase according to the new facet delay centre (Cornwell & Perley, 1991)
@@ -46,6 +48,7 @@ namespace imaging {
 			imaging::uvw_coord<uvw_base_type> uvw = params.uvw_coords[row];
 			bool row_flagged = params.flagged_rows[row];
 			bool row_is_in_field_being_imaged = (params.field_array[row] == params.imaging_field);
+			if (row_flagged || !row_is_in_field_being_imaged) continue; //these rows carry no weight
 			size_t spw = params.spw_index_array[row];
 			for (size_t c = 0; c < params.channel_count; ++c){	
 			    //read all the stuff that is only dependent on the current spw and channel    
@@ -60,6 +63,7 @@ namespace imaging {
 			    typename active_correlation_gridding_policy::active_trait::vis_weight_type vis_weight;
 			    typename active_correlation_gridding_policy::active_trait::vis_flag_type visibility_flagged;
 			    active_correlation_gridding_policy::read_corralation_data(params,row,spw,c,vis,visibility_flagged,vis_weight);
+			    active_correlation_gridding_policy::compute_sampling_function_grid_ptr(params,my_facet_id,flat_indexed_spw_channel,grid_size_in_floats,vis);
 			    /**
 			     * We don't need to compute wplanes for negative w
 			     * Here we simply grid the conjugate of the visibility
@@ -70,13 +74,14 @@ namespace imaging {
 			      uvw_lambda._v *= ref_wavelength;
 			      uvw_lambda._w *= ref_wavelength;
 			    }
+			    //compute the weighted visibility and promote the flags to integers so that we don't have unnecessary branch diversion here
+			    typename active_correlation_gridding_policy::active_trait::vis_flag_type vis_flagged = !(visibility_flagged || row_flagged) && 
+														     row_is_in_field_being_imaged;
+			    if (!vector_any(vis_flagged)) continue; //fully flagged (or averaged away) visibilities contribute nothing
 			    /*read and apply the two corrected jones terms if in faceting mode ( Jp^-1 . X . Jq^H^-1 ) --- either DIE or DDE 
 			      assuming small fields of view. Weighting is a scalar and can be apply in any order, so lets just first 
 			      apply the corrections*/
 			    active_correlation_gridding_policy::read_and_apply_antenna_jones_terms(params,row,my_facet_id,spw,c,vis);
-			    //compute the weighted visibility and promote the flags to integers so that we don't have unnecessary branch diversion here
-			    typename active_correlation_gridding_policy::active_trait::vis_flag_type vis_flagged = !(visibility_flagged || row_flagged) && 
-														     row_is_in_field_being_imaged;
 			    typename active_correlation_gridding_policy::active_trait::vis_weight_type combined_vis_weight = vis_weight * 
 												       vector_promotion<int,visibility_base_type>(vector_promotion<bool,int>(vis_flagged));
 			    vis = vis * combined_vis_weight;
@@ -89,7 +94,7 @@ namespace imaging {
 			    uvw_lambda._u *= u_scale; 
 			    uvw_lambda._v *= v_scale;
 			    typename active_correlation_gridding_policy::active_trait::normalization_accumulator_type normalization_term = 0;
-			    active_convolution_policy::convolve(params,grid_centre_offset_x,grid_centre_offset_y,
+			    active_convolution_policy::convolve(facet_params,grid_centre_offset_x,grid_centre_offset_y,
 								facet_output_buffer + 
 								  active_correlation_gridding_policy::compute_grid_offset(params,channel_grid_index,grid_size_in_floats),
 								channel_grid_index,grid_size_in_floats,
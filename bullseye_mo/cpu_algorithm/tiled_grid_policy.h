@@ -0,0 +1,151 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "correlation_gridding_policies.h"
+#include "convolution_policies.h"
+
+namespace imaging {
+	/**
+	 * Tiled grid layout: the grid is stored as GRID_TILE_SIZE x GRID_TILE_SIZE tiles of consecutive memory (tiles and the 
+	 * cells within tiles are stored row-major). A convolution footprint then only touches a handful of tiles (and pages), 
+	 * instead of one page per footprint row, which keeps huge (16k+) grids from being TLB and cache-miss bound.
+	 * 
+	 * The grid dimensions must be multiples of the tile size. A band of GRID_TILE_SIZE grid rows covers the same memory
+	 * in both layouts, so the grids can be converted back to row-major band by band.
+	 */
+	const std::size_t GRID_TILE_SIZE_LOG2 = 5;
+	const std::size_t GRID_TILE_SIZE = 1 << GRID_TILE_SIZE_LOG2;
+	inline std::size_t tiled_grid_offset(std::size_t nx, std::size_t pos_u, std::size_t pos_v){
+	  std::size_t tile_index = (pos_v >> GRID_TILE_SIZE_LOG2) * (nx >> GRID_TILE_SIZE_LOG2) + (pos_u >> GRID_TILE_SIZE_LOG2);
+	  return (((tile_index << GRID_TILE_SIZE_LOG2) + (pos_v & (GRID_TILE_SIZE - 1))) << GRID_TILE_SIZE_LOG2) + 
+		 (pos_u & (GRID_TILE_SIZE - 1));
+	}
+	/**
+	 * Wraps any of the correlation gridding policies to address the grid in the tiled layout. The row-major policy is
+	 * handed the tiled cell offset as its u coordinate (on grid row 0), so that the per correlation slice handling is reused.
+	 */
+	template <typename row_major_policy>
+	class tiled_grid_policy : public row_major_policy {
+	public:
+	  typedef typename row_major_policy::active_trait active_trait;
+	  static inline void grid_visibility (grid_base_type* grid,
+					      size_t slice_size,
+					      size_t nx,
+					      size_t pos_u,
+					      size_t pos_v,
+					      typename active_trait::accumulator_type & accumulator
+					     ){
+	    row_major_policy::grid_visibility(grid,slice_size,nx,tiled_grid_offset(nx,pos_u,pos_v),0,accumulator);
+	  }
+#ifdef __AVX__
+	  /**
+	   * The vectorized convolution policies accumulate 4 consecutive cells along u at a time. These are only consecutive
+	   * in memory if they don't straddle a tile boundary, otherwise the lanes are added one cell at a time.
+	   */
+	  template <typename avx_register_type>
+	  static inline void grid_visibility (grid_base_type* grid,
+					      size_t slice_size,
+					      size_t nx,
+					      size_t pos_u,
+					      size_t pos_v,
+					      avx_register_type * accumulator
+					     ){
+	    if ((pos_u & (GRID_TILE_SIZE - 1)) <= GRID_TILE_SIZE - 4){
+	      row_major_policy::grid_visibility(grid,slice_size,nx,tiled_grid_offset(nx,pos_u,pos_v),0,accumulator);
+	    } else {
+	      const std::size_t no_correlations = sizeof(typename active_trait::accumulator_type) / sizeof(basic_complex<visibility_base_type>);
+	      grid_base_type lanes[no_correlations * 4 * 2];
+	      std::memcpy(lanes,accumulator,sizeof(lanes));
+	      for (std::size_t corr = 0; corr < no_correlations; ++corr)
+		for (std::size_t i = 0; i < 4; ++i){
+		  grid_base_type* grid_flat_index = grid + corr * slice_size + (tiled_grid_offset(nx,pos_u + i,pos_v) << 1);
+		  grid_flat_index[0] += lanes[(corr * 4 + i) * 2];
+		  grid_flat_index[1] += lanes[(corr * 4 + i) * 2 + 1];
+		}
+	    }
+	  }
+#endif
+	};
+	/**
+	 * Rebinds a convolution policy to grid through another correlation gridding policy
+	 */
+	template <typename convolution_policy_type, typename new_correlation_gridding_policy>
+	struct rebind_convolution_policy {};
+	template <typename old_correlation_gridding_policy, typename convolution_mode, typename new_correlation_gridding_policy>
+	struct rebind_convolution_policy<convolution_policy<old_correlation_gridding_policy,convolution_mode>,new_correlation_gridding_policy> {
+	  typedef convolution_policy<new_correlation_gridding_policy,convolution_mode> type;
+	};
+	template <typename grid_type>
+	inline bool cell_holds_data(const grid_type & cell){
+	  return cell != grid_type(0);
+	}
+	/**
+	 * Converts no_slices tiled nx x ny grids back to the row-major layout expected by the FFT and output routines.
+	 * 
+	 * Bands without any data are left alone: they read as zeros in both layouts. Tiles fill whole pages of a page
+	 * aligned grid, and lazily zeroed memory (calloc, sparse scratch files) only takes up RAM once a page is written.
+	 * So the grid takes up RAM roughly in proportion to the number of tiles the gridder touched, and only the bands
+	 * holding data are made dense here, just before the inversion.
+	 */
+	template <typename grid_type>
+	void untile_grids(grid_type * __restrict__ grids, std::size_t nx, std::size_t ny, std::size_t no_slices){
+	  std::size_t band_size = nx << GRID_TILE_SIZE_LOG2;
+	  std::size_t no_tiles_per_band = nx >> GRID_TILE_SIZE_LOG2;
+	  std::size_t no_bands = (ny >> GRID_TILE_SIZE_LOG2) * no_slices;
+	  #pragma omp parallel
+	  {
+	    std::vector<grid_type> band(band_size);
+	    #pragma omp for schedule(dynamic)
+	    for (std::size_t b = 0; b < no_bands; ++b){
+	      grid_type * __restrict__ band_ptr = grids + b * band_size;
+	      if (std::find_if(band_ptr,band_ptr + band_size,cell_holds_data<grid_type>) == band_ptr + band_size) continue;
+	      std::copy(band_ptr,band_ptr + band_size,band.begin());
+	      for (std::size_t t = 0; t < no_tiles_per_band; ++t)
+		for (std::size_t y = 0; y < GRID_TILE_SIZE; ++y){
+		  typename std::vector<grid_type>::const_iterator tile_row = band.begin() + 
+									     (((t << GRID_TILE_SIZE_LOG2) + y) << GRID_TILE_SIZE_LOG2);
+		  std::copy(tile_row,tile_row + GRID_TILE_SIZE,band_ptr + y * nx + (t << GRID_TILE_SIZE_LOG2));
+		}
+	    }
+	  }
+	}
+}
@@ -51,23 +51,111 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "timer.h"
 #include "uvw_coord.h"
 #include "templated_gridder.h"
+#include "facet_averaging_gridder.h"
+#include "coalescing_gridder.h"
+#include "facet_blocked_gridder.h"
+#include "tiled_grid_policy.h"
+#include "planar_grid_policy.h"
+#include "hermitian_grid_policy.h"
+#include "fused_psf_gridder.h"
 #include "fft_and_repacking_routines.h"
+#include "grid_paging.h"
+#include "fits_writer.h"
+#include "facet_mosaic.h"
+#include "baseline_dependent_averaging.h"
+#include "imaging_weights.h"
+
+/**
+ * Picks the gridding strategy: either every visibility is gridded into each facet, the data is first averaged per facet
+ * after rotating it to the facet centre, visibilities with the same kernel placement are coalesced before convolution, or
+ * blocks of rows are read once and gridded into a batch of facets at a time
+ */
+template <typename correlation_gridding_policy,
+	  typename baseline_transform_policy,
+	  typename phase_transform_policy,
+	  typename convolution_policy>
+void dispatch_gridding_strategy(gridding_parameters & params){
+  if (params.should_average_per_facet)
+    imaging::templated_facet_averaging_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+  else if (params.should_coalesce_visibilities)
+    imaging::templated_coalescing_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+  else if (params.should_block_facets && params.num_facet_centres > 1)
+    imaging::templated_facet_blocked_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+  else
+    imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+}
+
+/**
+ * Picks the grid memory layout (row-major, tiled, planar or Hermitian half-plane) before picking the gridding strategy. When the sampling
+ * function is fused into the visibility pass the fused gridder handles the layout itself.
+ */
+template <typename correlation_gridding_policy,
+	  typename baseline_transform_policy,
+	  typename phase_transform_policy,
+	  typename convolution_policy>
+void dispatch_gridder(gridding_parameters & params){
+  //only the row-major templated gridder works out the geometry of every facet as it goes (see facet_geometry.h)
+  if (params.facet_geometries != NULL && 
+      (params.should_use_planar_grids || params.should_grid_half_plane || params.should_tile_grids || params.should_average_per_facet || 
+       params.should_coalesce_visibilities || (params.should_block_facets && params.num_facet_centres > 1)))
+    throw std::runtime_error("Per-facet geometry is only supported by the default (row-major, unblocked) gridder");
+  if (params.should_fuse_sampling_function && params.should_grid_sampling_function)
+    imaging::dispatch_fused_psf_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+  else if (params.should_use_planar_grids){
+    typedef imaging::planar_grid_policy<correlation_gridding_policy> planar_correlation_gridding_policy;
+    typedef typename imaging::rebind_planar_convolution_policy<convolution_policy,planar_correlation_gridding_policy>::type planar_convolution_policy;
+    dispatch_gridding_strategy<planar_correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,planar_convolution_policy>(params);
+  } else if (params.should_grid_half_plane){
+    typedef imaging::hermitian_grid_policy<correlation_gridding_policy> hermitian_correlation_gridding_policy;
+    typedef typename imaging::rebind_convolution_policy<convolution_policy,hermitian_correlation_gridding_policy>::type hermitian_convolution_policy;
+    dispatch_gridding_strategy<hermitian_correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,hermitian_convolution_policy>(params);
+  } else if (params.should_tile_grids){
+    typedef imaging::tiled_grid_policy<correlation_gridding_policy> tiled_correlation_gridding_policy;
+    typedef typename imaging::rebind_convolution_policy<convolution_policy,tiled_correlation_gridding_policy>::type tiled_convolution_policy;
+    dispatch_gridding_strategy<tiled_correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,tiled_convolution_policy>(params);
+  } else
+    dispatch_gridding_strategy<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+}
+
+/**
+ * The sampling function grids are smaller than the visibility grids when only a PSF cutout is required. The PSF is then
+ * gridded at a proportionally coarser uv cell size (spanning the same uv extent), using only the w = 0 plane of any
+ * w-projection kernels: the w-term is negligible over a small patch around the centre of the PSF.
+ */
+gridding_parameters sampling_function_gridding_parameters(const gridding_parameters & params){
+  gridding_parameters psf_params = params;
+  if (params.psf_nx != params.nx || params.psf_ny != params.ny){
+    psf_params.nx = params.psf_nx;
+    psf_params.ny = params.psf_ny;
+    if (psf_params.wplanes > 1)
+      psf_params.wplanes = 1;
+  }
+  return psf_params;
+}
 
 extern "C" {
     imaging::ifft_machine * fftw_ifft_machine;
+    imaging::baseline_dependent_averager * averager;
+    imaging::imaging_weighter * weighter;
     utils::timer gridding_timer;
     utils::timer sampling_function_gridding_timer;
+    utils::timer averaging_timer;
+    utils::timer weighting_timer;
     utils::timer inversion_timer;
+    utils::timer fft_planning_timer;
     std::future<void> gridding_future;
     normalization_base_type * sample_count_per_grid;
     bool initialized = false;
     
     double get_gridding_walltime() {
-      return gridding_timer.duration() + sampling_function_gridding_timer.duration();
+      return gridding_timer.duration() + sampling_function_gridding_timer.duration() + averaging_timer.duration() + weighting_timer.duration();
     }
     double get_inversion_walltime() {
       return inversion_timer.duration();
     }
+    double get_fft_planning_walltime() {
+      return fft_planning_timer.duration();
+    }
     void gridding_barrier() {
         if (gridding_future.valid())
             gridding_future.get(); //Block until result becomes available
@@ -91,8 +179,20 @@ extern "C" {
       #endif
       printf(" >Number of cores available: %d\n",omp_get_num_procs());
       printf(" >Number of threads being used: %d\n",omp_get_max_threads());
+      printf(" >Out-of-core (memory-mapped) grids: %s\n",params.should_stream_grids ? "enabled" : "disabled");
       printf("-----------------------------------------------\n");
+      if (params.should_stream_grids){
+	utils::advise_random_access(params.output_buffer,sizeof(std::complex<grid_base_type>) * params.nx * params.ny *
+					 params.number_of_polarization_terms_being_gridded * params.cube_channel_dim_size * params.num_facet_centres);
+	if (params.sampling_function_buffer != NULL)
+	  utils::advise_random_access(params.sampling_function_buffer,sizeof(std::complex<grid_base_type>) * params.psf_nx * params.psf_ny *
+					   params.sampling_function_channel_count * params.num_facet_centres);
+      }
+      fft_planning_timer.start();
       fftw_ifft_machine = new imaging::ifft_machine(params);
+      fft_planning_timer.stop();
+      averager = new imaging::baseline_dependent_averager();
+      weighter = new imaging::imaging_weighter();
       sample_count_per_grid = new normalization_base_type[params.num_facet_centres * 
 							  params.cube_channel_dim_size * 
 							  params.number_of_polarization_terms_being_gridded]();
@@ -103,63 +203,75 @@ extern "C" {
       initialized = false;
       gridding_barrier();
       delete fftw_ifft_machine;
+      delete averager;
+      delete weighter;
       delete [] sample_count_per_grid;
     }
     void weight_uniformly(gridding_parameters & params){
-      #define EPSILON 0.0000001f
-      gridding_barrier();
-      for (std::size_t f = 0; f < params.num_facet_centres; ++f)
-	for (std::size_t g = 0; g < params.cube_channel_dim_size; ++g)
-	  for (std::size_t y = 0; y < params.ny; ++y)
-	    for (std::size_t x = 0; x < params.nx; ++x){
-		grid_base_type count = EPSILON;
-		//accumulate all the sampling functions that contribute to the current grid
-		for (std::size_t c = 0; c < params.sampling_function_channel_count; ++c)
-		    count += (int)(params.channel_grid_indicies[c] == g) *
-			     real(params.sampling_function_buffer[((f*params.sampling_function_channel_count + c)*params.ny+y)*params.nx + x]);
-		count = 1/count;
-		//and apply to the continuous block of nx*ny*cube_channel grids (any temporary correlation term buffers should have been collapsed by this point)
-		for (size_t corr = 0; corr < params.number_of_polarization_terms_being_gridded; ++corr)
-		  params.output_buffer[(((f*params.cube_channel_dim_size + g)*params.number_of_polarization_terms_being_gridded+corr)*params.ny+y)*params.nx+x] *= count;
-	    }
+      throw std::runtime_error("Unimplemented: the CPU imager applies uniform weights to every visibility before gridding (see imaging_weights.h)");
     }
     void normalize(gridding_parameters & params){
 	gridding_barrier();
 	/*
-	 * Now normalize per facet, per channel accumulator grid and correlation
+	 * The normalization terms are already accumulated per facet, per channel accumulator grid and correlation. They are
+	 * applied by the inversion (see ifft_machine), in the same pass that combines the correlations into the Stokes 
+	 * term being imaged, instead of making another pass over all the grids here.
 	 */
-	for (size_t f = 0; f < params.num_facet_centres; ++f){
-	  for (size_t ch = 0; ch < params.cube_channel_dim_size; ++ch){
-	    for (size_t corr = 0; corr < params.number_of_polarization_terms_being_gridded; ++corr){
-	      normalization_base_type norm_val = params.normalization_terms[(f * params.cube_channel_dim_size + ch) * 
-									    params.number_of_polarization_terms_being_gridded +
-									    corr];
-	      printf("Normalizing cube slice @ facet %lu, channel slice %lu, correlation term %lu with val %f\n",
-		     f,ch,corr,norm_val);
-	      std::complex<grid_base_type> * __restrict__ grid_ptr = params.output_buffer + 
-								     ((f * params.cube_channel_dim_size + ch) * 
-								     params.number_of_polarization_terms_being_gridded + corr) * params.ny * params.nx;
-	      for (size_t i = 0; i < params.ny * params.nx; ++i)
-		grid_ptr[i] /= norm_val;
-	    }
-	  }
-	}
     }
     void finalize(gridding_parameters & params){
 	gridding_barrier();
 	inversion_timer.start();
-	fftw_ifft_machine->repack_and_ifft_uv_grids(params);
+	if (params.should_use_planar_grids)
+	  imaging::interleave_planar_grids(params.output_buffer,params.nx,params.ny,
+					   params.num_facet_centres * params.cube_channel_dim_size * params.number_of_polarization_terms_being_gridded);
+	if (params.should_tile_grids)
+	  imaging::untile_grids(params.output_buffer,params.nx,params.ny,
+				params.num_facet_centres * params.cube_channel_dim_size * params.number_of_polarization_terms_being_gridded);
+	imaging::fits_image_writer image_writer(params,imaging::fits_image_writer::DIRTY_IMAGES);
+	fftw_ifft_machine->repack_and_ifft_uv_grids(params,params.fits_image_names != NULL ? &image_writer : NULL);
+	image_writer.wait();
 	inversion_timer.stop();
     }
     void finalize_psf(gridding_parameters & params){
 	gridding_barrier();
 	inversion_timer.start();
-	fftw_ifft_machine->repack_and_ifft_sampling_function_grids(params);
+	if (params.should_use_planar_grids)
+	  imaging::interleave_planar_grids(params.sampling_function_buffer,params.psf_nx,params.psf_ny,
+					   params.num_facet_centres * params.sampling_function_channel_count);
+	if (params.should_tile_grids)
+	  imaging::untile_grids(params.sampling_function_buffer,params.psf_nx,params.psf_ny,
+				params.num_facet_centres * params.sampling_function_channel_count);
+	imaging::fits_image_writer psf_writer(params,imaging::fits_image_writer::PSF_IMAGES);
+	fftw_ifft_machine->repack_and_ifft_sampling_function_grids(params,params.fits_psf_names != NULL ? &psf_writer : NULL);
+	psf_writer.wait();
 	inversion_timer.stop();
     }
+    void compute_mosaic_size(gridding_parameters & params){
+	imaging::compute_mosaic_size(params);
+    }
+    void mosaic_facets(gridding_parameters & params){
+	imaging::mosaic_facets(params);
+    }
     void repack_input_data(gridding_parameters & params){
       throw std::runtime_error("Unimplemented: CPU data repacking not necessary");
     }
+    void average_baselines(gridding_parameters & params){
+      gridding_barrier(); //the previous chunk may still be gridding from the averaged buffers
+      averaging_timer.start();
+      averager->average(params);
+      averaging_timer.stop();
+    }
+    void accumulate_imaging_weight_densities(gridding_parameters & params){
+      weighting_timer.start();
+      weighter->accumulate(params);
+      weighting_timer.stop();
+    }
+    void apply_imaging_weights(gridding_parameters & params){
+      gridding_barrier(); //the previous chunk may still be gridding with its weights
+      weighting_timer.start();
+      weighter->apply(params);
+      weighting_timer.stop();
+    }
     void grid_single_pol(gridding_parameters & params) {
         gridding_future = std::async(std::launch::async, [&params] () {
 	    gridding_timer.start();
@@ -172,14 +284,14 @@ extern "C" {
 		typedef imaging::phase_transform_policy<imaging::disable_faceting_phase_shift > phase_transform_policy;
 		if (params.wplanes <= 1){
 		  typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-		  imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+		  dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 		} else {
 		  #ifdef __AVX__
 		  typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-		  imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+		  dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 		  #else
 		  typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-		  imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+		  dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 		  #endif
 		}
 	      }
@@ -199,14 +311,14 @@ extern "C" {
 		typedef imaging::phase_transform_policy<imaging::enable_faceting_phase_shift> phase_transform_policy;
 		if (params.wplanes <= 1){
 		  typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-		  imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+		  dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 		} else {
 		  #ifdef __AVX__
 		  typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed_vectorized> convolution_policy;
-		  imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+		  dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 		  #else
 		  typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-		  imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+		  dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 		  #endif
 		}
 	      }
@@ -223,14 +335,14 @@ extern "C" {
 	    typedef imaging::phase_transform_policy<imaging::disable_faceting_phase_shift > phase_transform_policy;
 	    if (params.wplanes <= 1){
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	    } else {
 	      #ifdef __AVX__
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed_vectorized> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #else
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #endif
 	    }
 	    gridding_timer.stop();
@@ -247,14 +359,14 @@ extern "C" {
 	  typedef imaging::phase_transform_policy<imaging::enable_faceting_phase_shift> phase_transform_policy;
 	  if (params.wplanes <= 1){
 	    typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-	    imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	    dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	  } else {
 	    #ifdef __AVX__
 	    typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed_vectorized> convolution_policy;
-	    imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	    dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	    #else
 	    typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-	    imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	    dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	    #endif
 	  }
 	}
@@ -270,14 +382,14 @@ extern "C" {
 	    typedef imaging::phase_transform_policy<imaging::disable_faceting_phase_shift > phase_transform_policy;
 	    if (params.wplanes <= 1){
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	    } else {
 	      #ifdef __AVX__
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed_vectorized> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #else
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #endif
 	    }
 	    gridding_timer.stop();
@@ -292,14 +404,14 @@ extern "C" {
 	    typedef imaging::phase_transform_policy<imaging::enable_faceting_phase_shift> phase_transform_policy;
 	    if (params.wplanes <= 1){
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	    } else {
 	      #ifdef __AVX__
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed_vectorized> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #else
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #endif
 	    }
             gridding_timer.stop();
@@ -319,14 +431,14 @@ extern "C" {
 	    typedef imaging::phase_transform_policy<imaging::enable_faceting_phase_shift> phase_transform_policy;
 	    if (params.wplanes <= 1){
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	    } else {
 	      #ifdef __AVX__
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed_vectorized> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #else
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
 	      #endif
 	    }
             gridding_timer.stop();
@@ -334,36 +446,40 @@ extern "C" {
     }
     
     void grid_sampling_function(gridding_parameters & params) {
+        if (params.should_fuse_sampling_function) return; //already gridded along with the visibilities
         gridding_future = std::async(std::launch::async, [&params] () {
 	    sampling_function_gridding_timer.start();
             printf("Gridding sampling function on the CPU...\n");  
             typedef imaging::correlation_gridding_policy<imaging::grid_sampling_function> correlation_gridding_policy;
 	    typedef imaging::baseline_transform_policy<imaging::transform_disable_facet_rotation > baseline_transform_policy;
 	    typedef imaging::phase_transform_policy<imaging::disable_faceting_phase_shift > phase_transform_policy;
+	    gridding_parameters psf_params = sampling_function_gridding_parameters(params);
 	    if (params.wplanes <= 1){
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(psf_params);
 	    } else {
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(psf_params);
 	    }
 	    sampling_function_gridding_timer.stop();
         });
     }
     
     void facet_sampling_function(gridding_parameters & params) {
+        if (params.should_fuse_sampling_function) return; //already gridded along with the visibilities
         gridding_future = std::async(std::launch::async, [&params] () {
 	    sampling_function_gridding_timer.start();
             printf("Faceting sampling function on the CPU...\n");
 	    typedef imaging::correlation_gridding_policy<imaging::grid_sampling_function> correlation_gridding_policy;
 	    typedef imaging::baseline_transform_policy<imaging::transform_planar_approx_with_w > baseline_transform_policy;
 	    typedef imaging::phase_transform_policy<imaging::disable_faceting_phase_shift > phase_transform_policy;
+	    gridding_parameters psf_params = sampling_function_gridding_parameters(params);
 	    if (params.wplanes <= 1){
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_AA_1D_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(psf_params);
 	    } else {
 	      typedef imaging::convolution_policy<correlation_gridding_policy,imaging::convolution_w_projection_precomputed> convolution_policy;
-	      imaging::templated_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(params);
+	      dispatch_gridder<correlation_gridding_policy,baseline_transform_policy,phase_transform_policy,convolution_policy>(psf_params);
 	    }
             sampling_function_gridding_timer.stop();
         });
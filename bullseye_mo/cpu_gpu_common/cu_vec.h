@@ -54,6 +54,9 @@ struct vec1 {
   __device__ __host__ vec1<T> operator*(const vec1<T> scalar) const{
     return vec1<T>(_x * scalar._x);
   }
+  __device__ __host__ vec1<T> operator-(const vec1<T> & rhs) const{
+    return vec1<T>(_x - rhs._x);
+  }
   __device__ __host__ vec1<T>& operator+=(const vec1<T> & rhs){
     _x += rhs._x;
     return *this;
@@ -72,6 +75,10 @@ template <typename from_type,typename to_type>
 __device__ __host__ static vec1<to_type> vector_promotion(const vec1<from_type> & arg){
     return vec1<to_type>((to_type)(arg._x));
 }
+template <typename T>
+__device__ __host__ static bool vector_any(const vec1<T> & arg){
+    return arg._x;
+}
 
 template <typename T>
 struct vec2 {
@@ -94,6 +101,9 @@ struct vec2 {
   __device__ __host__ vec2<T> operator*(const vec2<T> element_wise_by_vector) const{
     return vec2<T>(_x * element_wise_by_vector._x, _y * element_wise_by_vector._y);
   }
+  __device__ __host__ vec2<T> operator-(const vec2<T> & rhs) const{
+    return vec2<T>(_x - rhs._x, _y - rhs._y);
+  }
   __device__ __host__ vec2<T>& operator+=(const vec2<T> & rhs){
     _x += rhs._x;
     _y += rhs._y;
@@ -113,6 +123,10 @@ template <typename from_type,typename to_type>
   __device__ __host__ static vec2<to_type> vector_promotion(const vec2<from_type> & arg){
     return vec2<to_type>((to_type)(arg._x),(to_type)(arg._y));
 }
+template <typename T>
+__device__ __host__ static bool vector_any(const vec2<T> & arg){
+    return arg._x || arg._y;
+}
 
 template <typename T>
 struct vec4 {
@@ -138,6 +152,9 @@ struct vec4 {
     return vec4<T>(_x * element_wise_by_vector._x, _y * element_wise_by_vector._y,
 		   _z * element_wise_by_vector._z, _w * element_wise_by_vector._w);
   }
+  __device__ __host__ vec4<T> operator-(const vec4<T> & rhs) const{
+    return vec4<T>(_x - rhs._x, _y - rhs._y, _z - rhs._z, _w - rhs._w);
+  }
   __device__ __host__ vec4<T>& operator+=(const vec4<T> & rhs){
     _x += rhs._x;
     _y += rhs._y;
@@ -158,4 +175,8 @@ struct vec4 {
 template <typename from_type,typename to_type>
   __device__ __host__ static vec4<to_type> vector_promotion(const vec4<from_type> & arg){
     return vec4<to_type>((to_type)(arg._x),(to_type)(arg._y),(to_type)(arg._z),(to_type)(arg._w));
+}
+template <typename T>
+__device__ __host__ static bool vector_any(const vec4<T> & arg){
+    return arg._x || arg._y || arg._z || arg._w;
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <cstddef>
+#include "gridding_parameters.h"
+
+namespace imaging {
+  /**
+   * Helpers for heterogeneous facet geometry (params.facet_geometries). Every facet may have its own grid size, cell
+   * size and image size: the geometry of a facet is read from its descriptor and its grids and images are found through
+   * the offset table of the descriptor. Without descriptors all the facets share the geometry of params and are laid
+   * out at a fixed stride, so the same code serves both cases.
+   */
+  /*
+   * A copy of params describing the grids of a single facet (grid size, cell size, image size and grid corrections)
+   */
+  inline gridding_parameters facet_gridding_parameters(const gridding_parameters & params,std::size_t facet){
+    gridding_parameters facet_params = params;
+    if (params.facet_geometries != NULL){
+      const facet_geometry & geometry = params.facet_geometries[facet];
+      facet_params.nx = geometry.nx;
+      facet_params.ny = geometry.ny;
+      facet_params.cell_size_x = geometry.cell_size_x;
+      facet_params.cell_size_y = geometry.cell_size_y;
+      facet_params.image_nx = geometry.image_nx;
+      facet_params.image_ny = geometry.image_ny;
+      facet_params.grid_correction_x = geometry.grid_correction_x;
+      facet_params.grid_correction_y = geometry.grid_correction_y;
+      //the PSF of a facet is made on the grid of the facet
+      facet_params.psf_nx = geometry.nx;
+      facet_params.psf_ny = geometry.ny;
+      facet_params.psf_image_nx = geometry.image_nx;
+      facet_params.psf_image_ny = geometry.image_ny;
+      facet_params.psf_grid_correction_x = geometry.grid_correction_x;
+      facet_params.psf_grid_correction_y = geometry.grid_correction_y;
+    }
+    return facet_params;
+  }
+  /*
+   * Offsets (in floats) of the first grid of a facet in output_buffer and sampling_function_buffer, given the size
+   * of all the grids of a facet when they are laid out at a fixed stride
+   */
+  inline std::size_t facet_grid_offset(const gridding_parameters & params,std::size_t facet,std::size_t facet_size_in_floats){
+    return (params.facet_geometries != NULL) ? params.facet_geometries[facet].grid_offset << 1 : facet_size_in_floats * facet;
+  }
+  inline std::size_t facet_sampling_function_grid_offset(const gridding_parameters & params,std::size_t facet,
+							 std::size_t facet_size_in_floats){
+    return (params.facet_geometries != NULL) ? params.facet_geometries[facet].sampling_function_grid_offset << 1 : 
+					       facet_size_in_floats * facet;
+  }
+  /*
+   * Offsets (in pixels) of the first image of a facet in image_buffer and psf_image_buffer
+   */
+  inline std::size_t facet_image_offset(const gridding_parameters & params,std::size_t facet,std::size_t facet_size_in_pixels){
+    return (params.facet_geometries != NULL) ? params.facet_geometries[facet].image_offset : facet_size_in_pixels * facet;
+  }
+  inline std::size_t facet_psf_image_offset(const gridding_parameters & params,std::size_t facet,std::size_t facet_size_in_pixels){
+    return (params.facet_geometries != NULL) ? params.facet_geometries[facet].psf_image_offset : facet_size_in_pixels * facet;
+  }
+}
@@ -0,0 +1,175 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#include "facet_mosaic.h"
+#include "phase_transform_policies.h"
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace imaging {
+  namespace {
+    /*
+     * Where a facet lands in the mosaic: facet pixel (x,y) is mosaic pixel (x0 + x - frac_x, y0 + y - frac_y). Mosaic
+     * pixel (x0 + x, y0 + y) is interpolated from facet pixels x, x + 1 and y, y + 1, which covers all but the last 
+     * column and row of the facet.
+     */
+    struct facet_placement {
+      std::ptrdiff_t x0;
+      std::ptrdiff_t y0;
+      float frac_x;
+      float frac_y;
+      std::vector<float> column_weights; //feathered blending weights, image_nx - 1 long
+      std::vector<float> row_weights; //image_ny - 1 long
+    };
+    /*
+     * Position of the facet centre on the tangent plane of the phase centre, in pixels from the phase centre. This is
+     * the inverse of the phase shift applied while gridding (see phase_transform_policy::compute_delta_lmn). RA 
+     * increases towards -x (east is left) and DEC towards +y, as in the FITS export.
+     */
+    void facet_centre_offset(const gridding_parameters & params,std::size_t facet,double & offset_x,double & offset_y){
+      lmn_coord delta_lmn;
+      phase_transform_policy<enable_faceting_phase_shift>::compute_delta_lmn(params.phase_centre_ra,params.phase_centre_dec,
+									      params.facet_centres[facet*2],params.facet_centres[facet*2 + 1],
+									      delta_lmn);
+      offset_x = delta_lmn._l / (params.cell_size_x * ARCSEC_TO_RAD);
+      offset_y = -delta_lmn._m / (params.cell_size_y * ARCSEC_TO_RAD);
+    }
+    /*
+     * Facets are blended with weights that ramp up linearly away from their edges, so that the seams between 
+     * overlapping facets are feathered out instead of showing the (less accurate) facet edges
+     */
+    std::vector<float> feathered_weights(std::size_t no_pixels,std::size_t feather_width){
+      std::vector<float> weights(no_pixels);
+      for (std::size_t i = 0; i < no_pixels; ++i)
+	weights[i] = std::min<float>(1,(std::min(i,no_pixels - 1 - i) + 1) / (float)(feather_width + 1));
+      return weights;
+    }
+    void place_facets(const gridding_parameters & params,std::vector<facet_placement> & placements){
+      std::vector<float> column_weights = feathered_weights(params.image_nx - 1,params.mosaic_feather_width);
+      std::vector<float> row_weights = feathered_weights(params.image_ny - 1,params.mosaic_feather_width);
+      placements.resize(params.num_facet_centres);
+      for (std::size_t f = 0; f < params.num_facet_centres; ++f){
+	double offset_x,offset_y;
+	facet_centre_offset(params,f,offset_x,offset_y);
+	//mosaic position of the first facet pixel
+	double origin_x = offset_x - (double)(params.image_nx / 2) + (double)(params.mosaic_nx / 2);
+	double origin_y = offset_y - (double)(params.image_ny / 2) + (double)(params.mosaic_ny / 2);
+	placements[f].x0 = (std::ptrdiff_t)std::ceil(origin_x);
+	placements[f].y0 = (std::ptrdiff_t)std::ceil(origin_y);
+	placements[f].frac_x = placements[f].x0 - origin_x;
+	placements[f].frac_y = placements[f].y0 - origin_y;
+	placements[f].column_weights = column_weights;
+	placements[f].row_weights = row_weights;
+      }
+    }
+    /*
+     * Adds the weighted, bilinearly interpolated facet rows top and bottom to a row of the mosaic. The interpolation
+     * weights are the same for every pixel, so that this vectorizes into a few SIMD multiply-adds per pixel
+     */
+    void blend_row(float * __restrict__ mosaic_row,const float * __restrict__ top,const float * __restrict__ bottom,
+		   const float * __restrict__ column_weights,float row_weight,float frac_x,float frac_y,std::size_t no_pixels){
+      float w00 = (1 - frac_x) * (1 - frac_y) * row_weight;
+      float w01 = frac_x * (1 - frac_y) * row_weight;
+      float w10 = (1 - frac_x) * frac_y * row_weight;
+      float w11 = frac_x * frac_y * row_weight;
+      for (std::size_t x = 0; x < no_pixels; ++x)
+	mosaic_row[x] += column_weights[x] * (w00 * top[x] + w01 * top[x + 1] + w10 * bottom[x] + w11 * bottom[x + 1]);
+    }
+  }
+  void compute_mosaic_size(gridding_parameters & params){
+    //the facets are resampled as windows of the same pixel grid, which facets of different resolutions are not
+    if (params.facet_geometries != NULL)
+      throw std::runtime_error("Facets with their own geometry cannot be mosaicked");
+    double max_extent_x = 0;
+    double max_extent_y = 0;
+    for (std::size_t f = 0; f < params.num_facet_centres; ++f){
+      double offset_x,offset_y;
+      facet_centre_offset(params,f,offset_x,offset_y);
+      double first_x = offset_x - (double)(params.image_nx / 2);
+      double first_y = offset_y - (double)(params.image_ny / 2);
+      max_extent_x = std::max(max_extent_x,std::max(std::fabs(first_x),std::fabs(first_x + params.image_nx - 1)));
+      max_extent_y = std::max(max_extent_y,std::max(std::fabs(first_y),std::fabs(first_y + params.image_ny - 1)));
+    }
+    params.mosaic_nx = 2 * ((std::size_t)std::ceil(max_extent_x) + 1);
+    params.mosaic_ny = 2 * ((std::size_t)std::ceil(max_extent_y) + 1);
+  }
+  void mosaic_facets(const gridding_parameters & params){
+    if (params.facet_geometries != NULL)
+      throw std::runtime_error("Facets with their own geometry cannot be mosaicked");
+    std::vector<facet_placement> placements;
+    place_facets(params,placements);
+    std::size_t image_size = params.image_nx * params.image_ny;
+    std::size_t mosaic_size = params.mosaic_nx * params.mosaic_ny;
+    std::size_t covered_columns = params.image_nx - 1;
+    std::size_t covered_rows = params.image_ny - 1;
+    #pragma omp parallel
+    {
+      std::vector<float> weight_sums(params.mosaic_nx);
+      #pragma omp for schedule(dynamic)
+      for (std::size_t y = 0; y < params.mosaic_ny; ++y){
+	std::fill(weight_sums.begin(),weight_sums.end(),0.0f);
+	for (std::size_t c = 0; c < params.cube_channel_dim_size; ++c)
+	  std::fill(params.mosaic_buffer + c * mosaic_size + y * params.mosaic_nx,
+		    params.mosaic_buffer + c * mosaic_size + (y + 1) * params.mosaic_nx,0.0f);
+	for (std::size_t f = 0; f < params.num_facet_centres; ++f){
+	  const facet_placement & placement = placements[f];
+	  std::ptrdiff_t facet_y = (std::ptrdiff_t)y - placement.y0;
+	  if (facet_y < 0 || facet_y >= (std::ptrdiff_t)covered_rows) continue;
+	  float row_weight = placement.row_weights[facet_y];
+	  for (std::size_t x = 0; x < covered_columns; ++x)
+	    weight_sums[placement.x0 + x] += row_weight * placement.column_weights[x];
+	  for (std::size_t c = 0; c < params.cube_channel_dim_size; ++c){
+	    const float * facet_image = params.image_buffer + (f * params.cube_channel_dim_size + c) * image_size;
+	    blend_row(params.mosaic_buffer + c * mosaic_size + y * params.mosaic_nx + placement.x0,
+		      facet_image + facet_y * params.image_nx,facet_image + (facet_y + 1) * params.image_nx,
+		      &placement.column_weights[0],row_weight,placement.frac_x,placement.frac_y,covered_columns);
+	  }
+	}
+	for (std::size_t c = 0; c < params.cube_channel_dim_size; ++c){
+	  float * __restrict__ mosaic_row = params.mosaic_buffer + c * mosaic_size + y * params.mosaic_nx;
+	  for (std::size_t x = 0; x < params.mosaic_nx; ++x)
+	    mosaic_row[x] = weight_sums[x] > 0 ? mosaic_row[x] / weight_sums[x] : 0;
+	}
+      }
+    }
+  }
+}
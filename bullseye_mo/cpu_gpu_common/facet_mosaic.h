@@ -0,0 +1,60 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include "gridding_parameters.h"
+
+namespace imaging {
+  /**
+   * Stitches the facets together in memory. The facets are coplanar (their baselines are transformed to the tangent
+   * plane of the phase centre, see transform_planar_approx_with_w), so every facet image is a window onto that plane,
+   * centred on the offset of its facet centre. Resampling a facet onto the mosaic is therefore a (sub-pixel) shift
+   * that is the same for all its pixels: the bilinear interpolation weights and the feathered blending weights are
+   * worked out once per facet, and the rows of the mosaic are then made independently (in parallel) from the rows of
+   * the facets that cover them.
+   */
+  /*
+   * Sets params.mosaic_nx and params.mosaic_ny to the smallest (even) mosaic centred on the phase centre that holds all the facets
+   */
+  void compute_mosaic_size(gridding_parameters & params);
+  /*
+   * Blends the dirty images of all the facets (params.image_buffer) into params.mosaic_buffer, one mosaic per cube channel.
+   * Mosaic pixels that are not covered by any facet are set to 0
+   */
+  void mosaic_facets(const gridding_parameters & params);
+}
@@ -37,126 +37,398 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 ********************************************************************************************/
 #include "fft_and_repacking_routines.h"
+#include "grid_paging.h"
+#include "facet_geometry.h"
 #include <fftw3.h>
+#include <omp.h>
+#include <cstddef>
+#include <cstdio>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <sstream>
 #ifdef SHOULD_DO_32_BIT_FFT
 typedef fftwf_plan fftw_plan_type;
+typedef fftwf_complex fftw_complex_type;
+typedef float fftw_real_type;
+#define FFTW_ROUTINE(name) fftwf_##name
 #else
 typedef fftw_plan fftw_plan_type;
+typedef fftw_complex fftw_complex_type;
+typedef double fftw_real_type;
+#define FFTW_ROUTINE(name) fftw_##name
 #endif
 namespace imaging{
+  namespace {
+    const std::size_t INVERSION_BLOCK_SIZE = 8; //neighbouring lines transformed per plan execution
+    /*
+     * Describes the inversion of one set of grids into the centred image_nx x image_ny windows of their images
+     */
+    struct inversion_geometry {
+      std::size_t nx;
+      std::size_t ny;
+      std::size_t grid_width; //cells per grid row (nx / 2 + 1 for Hermitian half-plane grids)
+      bool half_plane;
+      /*
+       * Even sized grids are modulated by a checkerboard of signs instead of being shifted, which keeps the output centred
+       * (see utils::checkerboard_modulate), so that only the rows inside the output window have to be transformed along u.
+       * Odd sized grids are shifted and transformed in full.
+       */
+      bool is_pruned;
+      std::size_t image_nx;
+      std::size_t image_ny;
+      //the image centre (image_nx/2, image_ny/2) lands on the grid centre (nx/2, ny/2), even if the padding isn't symmetric
+      std::size_t image_x0;
+      std::size_t image_y0;
+      /*
+       * Separable factors applied to the real image when it is written out: the grid correction, the sign left over from
+       * the checkerboard modulation of full-plane grids ((-1)^(x + y + nx/2 + ny/2)) and the halving of half-plane
+       * images (those grids hold twice the Hermitian part of the uv grid)
+       */
+      std::vector<grid_base_type> column_factors;
+      std::vector<grid_base_type> row_factors;
+      inversion_geometry(std::size_t nx,std::size_t ny,std::size_t image_nx,std::size_t image_ny,bool half_plane,
+			 const grid_base_type * grid_correction_x = NULL,const grid_base_type * grid_correction_y = NULL):
+	nx(nx),ny(ny),grid_width(half_plane ? (nx >> 1) + 1 : nx),half_plane(half_plane),is_pruned(nx % 2 == 0 && ny % 2 == 0),
+	image_nx(image_nx),image_ny(image_ny),image_x0(nx/2 - image_nx/2),image_y0(ny/2 - image_ny/2),
+	column_factors(image_nx),row_factors(image_ny) {
+	  bool is_modulated = is_pruned && !half_plane;
+	  for (std::size_t x = 0; x < image_nx; ++x)
+	    column_factors[x] = (grid_correction_x != NULL ? grid_correction_x[x] : 1) * (half_plane ? 0.5 : 1) *
+				((is_modulated && (image_x0 + x) % 2 != 0) ? -1 : 1);
+	  for (std::size_t y = 0; y < image_ny; ++y)
+	    row_factors[y] = (grid_correction_y != NULL ? grid_correction_y[y] : 1) *
+			     ((is_modulated && (image_y0 + y + nx/2 + ny/2) % 2 != 0) ? -1 : 1);
+	}
+    };
+    unsigned int fftw_planning_flags(const gridding_parameters & params){
+      switch (params.fft_planning_rigour){
+	case 0: return FFTW_ESTIMATE;
+	case 1: return FFTW_MEASURE;
+	default: return FFTW_PATIENT;
+      }
+    }
+    /*
+     * FFTW keys its wisdom on the transform geometry, so the file name carries the grid sizes. This keeps one small 
+     * wisdom file per imaging setup instead of a single file that grows with every run.
+     */
+    std::string fftw_wisdom_filename(const gridding_parameters & params){
+      std::ostringstream filename;
+      filename << params.fft_wisdom_directory << "/bullseye_" 
+	       #ifdef SHOULD_DO_32_BIT_FFT
+	       << "f32_" 
+	       #else
+	       << "f64_"
+	       #endif
+	       << (params.should_grid_half_plane ? "c2r_" : "")
+	       << params.nx << "x" << params.ny << "_psf_" << params.psf_nx << "x" << params.psf_ny << ".wisdom";
+      return filename.str();
+    }
+    /*
+     * Plans are made on a scratch slice (so that measuring them doesn't scribble over the grids) and executed on the
+     * grids with the new-array interface. That is only safe without FFTW_UNALIGNED if every line a plan is executed on
+     * starts at the same SIMD alignment as the (fully aligned) scratch slice. Column blocks start a whole block of cells
+     * apart and rows a whole row apart, so it is enough to check the start of every slice and the length of the rows.
+     */
+    bool slice_starts_aligned(std::complex<grid_base_type> * grid,std::size_t no_slices,std::size_t slice_stride){
+      bool aligned = true;
+      for (std::size_t s = 0; s < no_slices; ++s)
+	aligned &= (FFTW_ROUTINE(alignment_of)((fftw_real_type *)(grid + s*slice_stride)) == 0);
+      return aligned;
+    }
+    /*
+     * The plans are made with the guru64 interface: all the line lengths, strides and batch counts are 64 bit, so that
+     * nothing overflows on huge grids (the int based interfaces can't address the cells of grids beyond about 46k x 46k)
+     */
+    fftw_plan_type plan_lines(std::ptrdiff_t n,std::ptrdiff_t stride,std::ptrdiff_t no_lines,std::ptrdiff_t line_dist,
+			      std::complex<grid_base_type> * buffer,bool half_plane,unsigned int flags){
+      FFTW_ROUTINE(iodim64) line = {n,stride,stride};
+      if (half_plane) {
+	//each row of nx / 2 + 1 complex cells is inverted in place into nx (padded to 2 x (nx / 2 + 1)) reals
+	FFTW_ROUTINE(iodim64) lines = {no_lines,line_dist,line_dist * 2};
+	return FFTW_ROUTINE(plan_guru64_dft_c2r)(1,&line,1,&lines,(fftw_complex_type *)buffer,(fftw_real_type *)buffer,flags);
+      }
+      FFTW_ROUTINE(iodim64) lines = {no_lines,line_dist,line_dist};
+      return FFTW_ROUTINE(plan_guru64_dft)(1,&line,1,&lines,(fftw_complex_type *)buffer,(fftw_complex_type *)buffer,
+					   FFTW_BACKWARD,flags);
+    }
+    void make_inversion_plans(const inversion_geometry & geometry,unsigned int planning_flags,bool slices_aligned,
+			      inversion_plans & plans){
+      std::complex<grid_base_type> * scratch = (std::complex<grid_base_type> *)
+					       FFTW_ROUTINE(malloc)(sizeof(std::complex<grid_base_type>) * geometry.grid_width * geometry.ny);
+      std::ptrdiff_t width = geometry.grid_width;
+      unsigned int column_block_flags = planning_flags | (slices_aligned ? 0 : FFTW_UNALIGNED);
+      unsigned int row_block_flags = planning_flags | 
+				     ((slices_aligned && (geometry.grid_width * sizeof(std::complex<grid_base_type>)) % 64 == 0) ? 0 : FFTW_UNALIGNED);
+      //the single line plans take care of the remainders, which can start anywhere
+      unsigned int line_flags = planning_flags | FFTW_UNALIGNED;
+      plans.column_block_plan = new fftw_plan_type(plan_lines(geometry.ny,width,INVERSION_BLOCK_SIZE,1,scratch,false,column_block_flags));
+      plans.column_plan = new fftw_plan_type(plan_lines(geometry.ny,width,1,1,scratch,false,line_flags));
+      plans.row_block_plan = new fftw_plan_type(plan_lines(geometry.nx,1,INVERSION_BLOCK_SIZE,width,scratch,geometry.half_plane,row_block_flags));
+      plans.row_plan = new fftw_plan_type(plan_lines(geometry.nx,1,1,width,scratch,geometry.half_plane,line_flags));
+      FFTW_ROUTINE(free)(scratch);
+    }
+    void destroy_inversion_plans(inversion_plans & plans){
+      void * all_plans[] = {plans.column_block_plan,plans.column_plan,plans.row_block_plan,plans.row_plan};
+      for (std::size_t i = 0; i < 4; ++i){
+	FFTW_ROUTINE(destroy_plan)(*((fftw_plan_type *)all_plans[i]));
+	delete (fftw_plan_type *)all_plans[i];
+      }
+    }
+    void execute_row_plan(void * plan,std::complex<grid_base_type> * row,bool half_plane){
+      if (half_plane)
+	FFTW_ROUTINE(execute_dft_c2r)(*((fftw_plan_type *)plan),(fftw_complex_type *)row,(fftw_real_type *)row);
+      else
+	FFTW_ROUTINE(execute_dft)(*((fftw_plan_type *)plan),(fftw_complex_type *)row,(fftw_complex_type *)row);
+    }
+    /*
+     * Prepares a slice for the inversion in a single pass over its correlation grids: the normalized correlations are
+     * combined into the Stokes (or correlation) term being imaged, which is stored in the first correlation grid, and 
+     * modulated by (-1)^(u + v) if the grid is even sized.
+     * 
+     * Only a band of columns (narrow band data, or facets with cells much smaller than the resolution) or the low 
+     * frequencies (half-plane grids) of a slice usually receive any visibilities. Since this pass touches every cell
+     * anyway it also marks the columns that hold data. All-zero columns transform to zero and are skipped by the first
+     * (column) pass, turning it into an FFT with sparse input.
+     */
+    void combine_and_mark_columns(std::complex<grid_base_type> * __restrict__ slice,std::size_t correlation_stride,
+				  const grid_base_type * __restrict__ correlation_scales,std::size_t no_correlations,
+				  std::size_t width,std::size_t ny,bool modulate,std::vector<char> & column_has_data){
+      char * __restrict__ marks = &column_has_data[0];
+      for (std::size_t y = 0; y < ny; ++y){
+	std::complex<grid_base_type> * __restrict__ row = slice + y * width;
+	for (std::size_t x = 0; x < width; ++x){
+	  std::complex<grid_base_type> cell = row[x] * correlation_scales[0];
+	  for (std::size_t corr = 1; corr < no_correlations; ++corr)
+	    cell += row[corr * correlation_stride + x] * correlation_scales[corr];
+	  marks[x] |= (cell.real() != 0 || cell.imag() != 0);
+	  row[x] = (modulate && (x + y) % 2 != 0) ? -cell : cell; //same as utils::checkerboard_modulate with parity 0
+	}
+      }
+    }
+    bool any_column_has_data(const std::vector<char> & column_has_data,std::size_t first_column,std::size_t no_columns){
+      for (std::size_t x = first_column; x < first_column + no_columns; ++x)
+	if (column_has_data[x]) return true;
+      return false;
+    }
+    /*
+     * Finalizes a single image: the correlation grids of the slice are normalized and combined, inverted and the centred 
+     * output window of the real image is grid corrected and written into a compact float32 image, so that every cell is
+     * read and written only once outside of the FFTs. The lines of each pass are split over the threads when 
+     * parallel_lines is set.
+     */
+    void invert_slice(const inversion_plans & plans,const inversion_geometry & geometry,
+		      std::complex<grid_base_type> * __restrict__ slice,const grid_base_type * correlation_scales,
+		      std::size_t no_correlations,float * __restrict__ image,bool parallel_lines){
+      std::size_t width = geometry.grid_width;
+      std::vector<char> column_has_data(width,0);
+      //(-1)^(u + v) in unshifted order for half-plane grids
+      combine_and_mark_columns(slice,geometry.nx*geometry.ny,correlation_scales,no_correlations,width,geometry.ny,
+			       geometry.is_pruned,column_has_data);
+      if (!geometry.is_pruned) {
+	utils::ifftshift(slice,geometry.nx,geometry.ny,1);
+	//the shift moves centred column x to (x + ceil(nx / 2)) % nx
+	std::rotate(column_has_data.begin(),column_has_data.begin() + geometry.nx / 2,column_has_data.end());
+      }
+      std::size_t no_column_blocks = width / INVERSION_BLOCK_SIZE;
+      #pragma omp parallel for schedule(dynamic) if(parallel_lines)
+      for (std::size_t b = 0; b < no_column_blocks; ++b){
+	if (!any_column_has_data(column_has_data,b * INVERSION_BLOCK_SIZE,INVERSION_BLOCK_SIZE)) continue;
+	fftw_complex_type * column_block = (fftw_complex_type *)(slice + b * INVERSION_BLOCK_SIZE);
+	FFTW_ROUTINE(execute_dft)(*((fftw_plan_type *)plans.column_block_plan),column_block,column_block);
+      }
+      for (std::size_t x = no_column_blocks * INVERSION_BLOCK_SIZE; x < width; ++x)
+	if (column_has_data[x])
+	  FFTW_ROUTINE(execute_dft)(*((fftw_plan_type *)plans.column_plan),(fftw_complex_type *)(slice + x),(fftw_complex_type *)(slice + x));
+      std::size_t row_lbound = geometry.is_pruned ? geometry.image_y0 : 0;
+      std::size_t no_rows = geometry.is_pruned ? geometry.image_ny : geometry.ny;
+      std::size_t no_row_blocks = no_rows / INVERSION_BLOCK_SIZE;
+      #pragma omp parallel for schedule(static) if(parallel_lines)
+      for (std::size_t b = 0; b < no_row_blocks; ++b)
+	execute_row_plan(plans.row_block_plan,slice + (row_lbound + b * INVERSION_BLOCK_SIZE) * width,geometry.half_plane);
+      for (std::size_t y = row_lbound + no_row_blocks * INVERSION_BLOCK_SIZE; y < row_lbound + no_rows; ++y)
+	execute_row_plan(plans.row_plan,slice + y * width,geometry.half_plane);
+      if (!geometry.is_pruned)
+	utils::fftshift(slice,geometry.nx,geometry.ny,1);
+      /*
+       * We'll be storing 32 bit real fits files so ignore all the imaginary components and cast whatever the grid was to float32.
+       * Half-plane rows are padded to 2 x (nx / 2 + 1) reals
+       */
+      const grid_base_type * __restrict__ column_factors = &geometry.column_factors[0];
+      #pragma omp parallel for schedule(static) if(parallel_lines)
+      for (std::size_t y = 0; y < geometry.image_ny; ++y){
+	std::size_t grid_y = geometry.image_y0 + y;
+	float * __restrict__ image_row = image + y * geometry.image_nx;
+	grid_base_type row_factor = geometry.row_factors[y];
+	if (geometry.half_plane) {
+	  const fftw_real_type * __restrict__ row = (const fftw_real_type *)(slice + grid_y * width) + geometry.image_x0;
+	  for (std::size_t x = 0; x < geometry.image_nx; ++x)
+	    image_row[x] = (float)(row[x] * row_factor * column_factors[x]);
+	} else {
+	  const grid_base_type * __restrict__ row = (const grid_base_type *)(slice + grid_y * width + geometry.image_x0);
+	  for (std::size_t x = 0; x < geometry.image_nx; ++x)
+	    image_row[x] = (float)(row[x << 1] * row_factor * column_factors[x]); //extract all the reals
+	}
+      }
+    }
+    /*
+     * Finalizes no_images consecutive images, each made from no_correlations consecutive correlation grids (scaled by
+     * correlation_scales[image * no_correlations + corr]). When there are at least as many images as threads whole slices
+     * are transformed concurrently (plans may be executed from many threads at once), which scales with the number of
+     * cores even on mid-size grids. Otherwise the lines of each slice are split over the threads.
+     * 
+     * Out-of-core (memory-mapped) grids are streamed through: the correlation grids of the next image are read in while
+     * the current one is inverted and the grids of every image are discarded as soon as it has been written out, so that
+     * only a few slices are ever resident.
+     * 
+     * The images of every facet are consecutive (images_per_facet of them, starting at facet first_facet). The sink is
+     * told about each facet as soon as the last of its images is written out, which happens in any order when the slices
+     * are transformed concurrently.
+     */
+    void invert_slices(const inversion_plans & plans,const inversion_geometry & geometry,bool concurrently,
+		       std::complex<grid_base_type> * grid,const std::vector<grid_base_type> & correlation_scales,
+		       std::size_t no_correlations,float * images,std::size_t no_images,bool stream_grids,
+		       std::size_t images_per_facet,std::size_t first_facet,image_sink * sink){
+      std::size_t image_size = geometry.image_nx * geometry.image_ny;
+      std::size_t slice_size = no_correlations*geometry.nx*geometry.ny;
+      std::size_t slice_bytes = slice_size * sizeof(std::complex<grid_base_type>);
+      std::vector<std::size_t> images_outstanding(images_per_facet == 0 ? 0 : no_images / images_per_facet,images_per_facet);
+      if (stream_grids && no_images > 0)
+	utils::prefetch_pages(grid,slice_bytes);
+      #pragma omp parallel for schedule(dynamic) if(concurrently)
+      for (std::size_t s = 0; s < no_images; ++s){
+	if (stream_grids && s + 1 < no_images)
+	  utils::prefetch_pages(grid + (s + 1)*slice_size,slice_bytes);
+	invert_slice(plans,geometry,grid + s*slice_size,&correlation_scales[s*no_correlations],
+		     no_correlations,images + s * image_size,!concurrently);
+	if (stream_grids)
+	  utils::release_pages(grid + s*slice_size,slice_bytes);
+	if (sink != NULL){
+	  std::size_t facet = s / images_per_facet;
+	  std::size_t facet_images_outstanding;
+	  #pragma omp atomic capture
+	  facet_images_outstanding = --images_outstanding[facet];
+	  if (facet_images_outstanding == 0)
+	    sink->facet_complete(first_facet + facet);
+	}
+      }
+    }
+  }
   ifft_machine::ifft_machine(gridding_parameters & params){
-    int dims[] = {(int)params.ny,(int)params.nx};
-      fft_plan = (void*) new fftw_plan_type;
-      fft_psf_plan = (void*) new fftw_plan_type;
-      #ifdef SHOULD_DO_32_BIT_FFT
-	*((fftw_plan_type *)fft_plan) = fftwf_plan_many_dft(2,(int*)&dims,
-				       params.cube_channel_dim_size,
-				       (fftwf_complex *)params.output_buffer,(int*)&dims,
-				       1,(int)(params.nx*params.ny),
-				       (fftwf_complex *)params.output_buffer,(int*)&dims,
-				       1,(int)(params.nx*params.ny),
-				       FFTW_BACKWARD,FFTW_ESTIMATE | FFTW_UNALIGNED);
-	*((fftw_plan_type *)fft_psf_plan) = fftwf_plan_many_dft(2,(int*)&dims,
-					   params.sampling_function_channel_count * params.num_facet_centres,
-					   (fftwf_complex *)params.sampling_function_buffer,(int*)&dims,
-					   1,(int)(params.nx*params.ny),
-					   (fftwf_complex *)params.sampling_function_buffer,(int*)&dims,
-					   1,(int)(params.nx*params.ny),
-					   FFTW_BACKWARD,FFTW_ESTIMATE | FFTW_UNALIGNED);
-      #else
-	*((fftw_plan_type *)fft_plan) = fftw_plan_many_dft(2,(int*)&dims,
-				      params.cube_channel_dim_size,
-				      (fftw_complex *)params.output_buffer,(int*)&dims,
-				      1,(int)(params.nx*params.ny),
-				      (fftw_complex *)params.output_buffer,(int*)&dims,
-				      1,(int)(params.nx*params.ny),
-				      FFTW_BACKWARD,FFTW_ESTIMATE | FFTW_UNALIGNED);
-	*((fftw_plan_type *)fft_psf_plan) = fftw_plan_many_dft(2,(int*)&dims,
-					  params.sampling_function_channel_count * params.num_facet_centres,
-					  (fftw_complex *)params.sampling_function_buffer,(int*)&dims,
-					  1,(int)(params.nx*params.ny),
-					  (fftw_complex *)params.sampling_function_buffer,(int*)&dims,
-					  1,(int)(params.nx*params.ny),
-					  FFTW_BACKWARD,FFTW_ESTIMATE | FFTW_UNALIGNED);
-      #endif
+    inversion_geometry uv_geometry(params.nx,params.ny,params.image_nx,params.image_ny,params.should_grid_half_plane);
+    inversion_geometry psf_geometry(params.psf_nx,params.psf_ny,params.psf_image_nx,params.psf_image_ny,params.should_grid_half_plane);
+    std::size_t nthreads = omp_get_max_threads();
+    unsigned int planning_flags = fftw_planning_flags(params);
+    std::size_t uv_slices = params.num_facet_centres * params.cube_channel_dim_size;
+    std::size_t psf_slices = params.sampling_function_channel_count * params.num_facet_centres;
+    uv_slices_concurrently = uv_slices >= nthreads;
+    psf_slices_concurrently = psf_slices >= nthreads;
+    has_psf_plans = params.sampling_function_buffer != NULL; //no PSF is being made otherwise
+    std::string wisdom_filename = (params.fft_wisdom_directory != NULL && params.fft_wisdom_directory[0] != '\0') ? 
+				  fftw_wisdom_filename(params) : "";
+    if (wisdom_filename != "" && FFTW_ROUTINE(import_wisdom_from_filename)(wisdom_filename.c_str()))
+      printf(" >Imported FFTW wisdom from %s\n",wisdom_filename.c_str());
+    if (params.facet_geometries != NULL) {
+      /*
+       * Every facet gets its own plans (FFTW reuses what it measured for any earlier facet of the same size). The facets
+       * are inverted one at a time, so only the slices of a facet can be transformed concurrently
+       */
+      uv_slices_concurrently = params.cube_channel_dim_size >= nthreads;
+      psf_slices_concurrently = params.sampling_function_channel_count >= nthreads;
+      facet_uv_plans.resize(params.num_facet_centres);
+      if (has_psf_plans)
+	facet_psf_plans.resize(params.num_facet_centres);
+      for (std::size_t f = 0; f < params.num_facet_centres; ++f){
+	gridding_parameters facet_params = facet_gridding_parameters(params,f);
+	inversion_geometry facet_geometry(facet_params.nx,facet_params.ny,facet_params.image_nx,facet_params.image_ny,
+					  params.should_grid_half_plane);
+	make_inversion_plans(facet_geometry,planning_flags,
+			     slice_starts_aligned(params.output_buffer + (facet_grid_offset(params,f,0) >> 1),params.cube_channel_dim_size,
+						  facet_params.nx*facet_params.ny*params.number_of_polarization_terms_being_gridded),
+			     facet_uv_plans[f]);
+	if (has_psf_plans)
+	  make_inversion_plans(facet_geometry,planning_flags,
+			       slice_starts_aligned(params.sampling_function_buffer + (facet_sampling_function_grid_offset(params,f,0) >> 1),
+						    params.sampling_function_channel_count,facet_params.nx*facet_params.ny),
+			       facet_psf_plans[f]);
+      }
+    } else {
+      make_inversion_plans(uv_geometry,planning_flags,
+			   //images are made in the first correlation grid of every facet and cube channel
+			   slice_starts_aligned(params.output_buffer,uv_slices,
+						params.nx*params.ny*params.number_of_polarization_terms_being_gridded),
+			   uv_plans);
+      if (has_psf_plans)
+	make_inversion_plans(psf_geometry,planning_flags,
+			     slice_starts_aligned(params.sampling_function_buffer,psf_slices,params.psf_nx*params.psf_ny),
+			     psf_plans);
+    }
+    if (wisdom_filename != "" && !FFTW_ROUTINE(export_wisdom_to_filename)(wisdom_filename.c_str()))
+      printf(" >Warning: could not export FFTW wisdom to %s\n",wisdom_filename.c_str());
   }
-  void ifft_machine::repack_and_ifft_uv_grids(gridding_parameters & params){
-	std::size_t offset = params.nx*params.ny*params.cube_channel_dim_size*params.number_of_polarization_terms_being_gridded;
-	#ifdef SHOULD_DO_32_BIT_FFT
-	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) {
-	    utils::ifftshift(params.output_buffer + f*offset,params.nx,params.ny,params.cube_channel_dim_size);
-	    fftwf_execute_dft(*((fftw_plan_type *)fft_plan),
-			      (fftwf_complex *)(params.output_buffer + f*offset),
-			      (fftwf_complex *)(params.output_buffer + f*offset));
-	    utils::fftshift(params.output_buffer + f*offset,params.nx,params.ny,params.cube_channel_dim_size);
-	  }
-	#else
-	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) {
-	    utils::ifftshift(params.output_buffer + f*offset,params.nx,params.ny,params.cube_channel_dim_size);
-	    fftw_execute_dft(*((fftw_plan_type *)fft_plan),
-			   (fftw_complex *)(params.output_buffer + f*offset),
-			   (fftw_complex *)(params.output_buffer + f*offset));
-	    utils::fftshift(params.output_buffer + f*offset,params.nx,params.ny,params.cube_channel_dim_size);
-	  }
-	#endif
-	/*
-	 * We'll be storing 32 bit real fits files so ignore all the imaginary components and cast whatever the grid was to float32
-	 */
-	{
-	  grid_base_type * __restrict__ grid_ptr_gridtype = (grid_base_type *)params.output_buffer;
-	  float * __restrict__ grid_ptr_single = (float *)params.output_buffer;
-	  std::size_t image_size = (params.nx*params.ny);
-	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) {
-	      std::size_t casting_lbound = offset*f;
-	      std::size_t casting_ubound = casting_lbound + params.nx*params.ny*params.cube_channel_dim_size;
-	      for (std::size_t i = casting_lbound; i < casting_ubound; ++i){
-		  std::size_t detapering_flat_index = i % image_size;
-		  grid_ptr_single[i] = (float)(grid_ptr_gridtype[i*2]); //extract all the reals
-	      }
+  void ifft_machine::repack_and_ifft_uv_grids(gridding_parameters & params,image_sink * sink){
+	inversion_geometry uv_geometry(params.nx,params.ny,params.image_nx,params.image_ny,params.should_grid_half_plane,
+				       params.grid_correction_x,params.grid_correction_y);
+	//the correlation grids of every facet and cube channel are consecutive, each normalized by its own accumulated weight
+	std::size_t no_images = params.num_facet_centres * params.cube_channel_dim_size;
+	std::size_t no_correlations = params.number_of_polarization_terms_being_gridded;
+	std::vector<grid_base_type> correlation_scales(no_images * no_correlations);
+	for (std::size_t i = 0; i < no_images * no_correlations; ++i){
+	  std::size_t corr = i % no_correlations;
+	  normalization_base_type weight = (params.stokes_correlation_weights != NULL) ? params.stokes_correlation_weights[corr] : 
+										       (corr == 0 ? 1 : 0);
+	  correlation_scales[i] = weight / params.normalization_terms[i];
+	}
+	if (params.facet_geometries != NULL) {
+	  std::size_t facet_scales = params.cube_channel_dim_size * no_correlations;
+	  for (std::size_t f = 0; f < params.num_facet_centres; ++f){
+	    gridding_parameters facet_params = facet_gridding_parameters(params,f);
+	    inversion_geometry facet_geometry(facet_params.nx,facet_params.ny,facet_params.image_nx,facet_params.image_ny,params.should_grid_half_plane,
+					      facet_params.grid_correction_x,facet_params.grid_correction_y);
+	    invert_slices(facet_uv_plans[f],facet_geometry,uv_slices_concurrently,
+			  params.output_buffer + (facet_grid_offset(params,f,0) >> 1),
+			  std::vector<grid_base_type>(correlation_scales.begin() + f * facet_scales,
+						      correlation_scales.begin() + (f + 1) * facet_scales),
+			  no_correlations,params.image_buffer + facet_image_offset(params,f,0),params.cube_channel_dim_size,
+			  params.should_stream_grids,params.cube_channel_dim_size,f,sink);
 	  }
+	  return;
 	}
+	invert_slices(uv_plans,uv_geometry,uv_slices_concurrently,params.output_buffer,correlation_scales,no_correlations,
+		      params.image_buffer,no_images,params.should_stream_grids,params.cube_channel_dim_size,0,sink);
   }
-  void ifft_machine::repack_and_ifft_sampling_function_grids(gridding_parameters & params){
-	std::size_t offset = params.nx*params.ny*params.sampling_function_channel_count;
-	#ifdef SHOULD_DO_32_BIT_FFT
-	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) 
-	    utils::ifftshift(params.sampling_function_buffer + f*offset,params.nx,params.ny,params.sampling_function_channel_count);
-	  fftwf_execute(*((fftw_plan_type *)fft_psf_plan));
- 	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) 
-	    utils::fftshift(params.sampling_function_buffer + f*offset,params.nx,params.ny,params.sampling_function_channel_count);
-	#else
-	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) 
-	    utils::ifftshift(params.sampling_function_buffer + f*offset,params.nx,params.ny,params.sampling_function_channel_count);
-	  fftw_execute(*((fftw_plan_type *)fft_psf_plan));
- 	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) 
-	    utils::fftshift(params.sampling_function_buffer + f*offset,params.nx,params.ny,params.sampling_function_channel_count);
-	#endif
-	/*
-	 * We'll be storing 32 bit real fits files so ignore all the imaginary components and cast whatever the grid was to float32
-	 */
-	{
-	  grid_base_type * __restrict__ grid_ptr_gridtype = (grid_base_type *)params.sampling_function_buffer;
-	  float * __restrict__ grid_ptr_single = (float *)params.sampling_function_buffer;
-	  std::size_t image_size = (params.nx*params.ny);
-	  for (std::size_t f = 0; f < params.num_facet_centres; ++f) {
-	      std::size_t casting_lbound = offset*f;
-	      std::size_t casting_ubound = casting_lbound + params.nx*params.ny*params.sampling_function_channel_count;
-	      for (std::size_t i = casting_lbound; i < casting_ubound; ++i){
-		  std::size_t detapering_flat_index = i % image_size;
-		  grid_ptr_single[i] = (float)(grid_ptr_gridtype[i*2]); //extract all the reals
-	      }
+  void ifft_machine::repack_and_ifft_sampling_function_grids(gridding_parameters & params,image_sink * sink){
+	inversion_geometry psf_geometry(params.psf_nx,params.psf_ny,params.psf_image_nx,params.psf_image_ny,params.should_grid_half_plane,
+					params.psf_grid_correction_x,params.psf_grid_correction_y);
+	if (params.facet_geometries != NULL) {
+	  for (std::size_t f = 0; f < params.num_facet_centres; ++f){
+	    gridding_parameters facet_params = facet_gridding_parameters(params,f);
+	    inversion_geometry facet_geometry(facet_params.psf_nx,facet_params.psf_ny,facet_params.psf_image_nx,facet_params.psf_image_ny,
+					      params.should_grid_half_plane,facet_params.psf_grid_correction_x,facet_params.psf_grid_correction_y);
+	    invert_slices(facet_psf_plans[f],facet_geometry,psf_slices_concurrently,
+			  params.sampling_function_buffer + (facet_sampling_function_grid_offset(params,f,0) >> 1),
+			  std::vector<grid_base_type>(params.sampling_function_channel_count,1),1,
+			  params.psf_image_buffer + facet_psf_image_offset(params,f,0),params.sampling_function_channel_count,
+			  params.should_stream_grids,params.sampling_function_channel_count,f,sink);
 	  }
+	  return;
 	}
+	//the sampling function grids of all the facets are consecutive
+	std::size_t no_images = params.num_facet_centres * params.sampling_function_channel_count;
+	invert_slices(psf_plans,psf_geometry,psf_slices_concurrently,params.sampling_function_buffer,
+		      std::vector<grid_base_type>(no_images,1),1,params.psf_image_buffer,no_images,params.should_stream_grids,
+		      params.sampling_function_channel_count,0,sink);
   }
   ifft_machine::~ifft_machine(){
-    #ifdef SHOULD_DO_32_BIT_FFT
-	fftwf_destroy_plan(*((fftw_plan_type *)fft_plan));
-	fftwf_destroy_plan(*((fftw_plan_type *)fft_psf_plan));
-    #else
-	fftw_destroy_plan(*((fftw_plan_type *)fft_plan));
-	fftw_destroy_plan(*((fftw_plan_type *)fft_psf_plan));
-    #endif
-    delete (fftw_plan_type *)fft_plan;
-    delete (fftw_plan_type *)fft_psf_plan;
+    if (!facet_uv_plans.empty()) {
+      for (std::size_t f = 0; f < facet_uv_plans.size(); ++f)
+	destroy_inversion_plans(facet_uv_plans[f]);
+      for (std::size_t f = 0; f < facet_psf_plans.size(); ++f)
+	destroy_inversion_plans(facet_psf_plans[f]);
+      return;
+    }
+    destroy_inversion_plans(uv_plans);
+    if (has_psf_plans)
+      destroy_inversion_plans(psf_plans);
   }
 }
\ No newline at end of file
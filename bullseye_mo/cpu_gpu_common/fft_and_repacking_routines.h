@@ -39,15 +39,49 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #pragma once
 #include "gridding_parameters.h"
 #include "fft_shift_utils.h"
+#include <cstddef>
+#include <vector>
 namespace imaging{
+    /**
+     * Plans for inverting one set of uv grids by a row-column decomposition into 1D transforms: first along v for every
+     * column, then along u only for the rows that fall inside the centred output window (the rest of the image is padding).
+     * Lines are transformed a block of neighbouring lines at a time, with single line plans for any remainder.
+     */
+    struct inversion_plans {
+      void* column_block_plan; //bastardized workaround for a bug in the FFTW header... cant include the header from a .cu file
+      void* column_plan;
+      void* row_block_plan;
+      void* row_plan;
+    };
+    /**
+     * Notified by the inversion as soon as all the images of a facet have been written out (from whichever thread
+     * finished the last of them), so that the facet can be consumed while the remaining facets are still being inverted
+     */
+    class image_sink {
+    public:
+      virtual void facet_complete(std::size_t facet) = 0;
+      virtual ~image_sink() {}
+    };
     class ifft_machine {
     private:
-      void* fft_plan; //bastardized workaround for a bug in the FFTW header... cant include the header from a .cu file
-      void* fft_psf_plan;
+      inversion_plans uv_plans;
+      inversion_plans psf_plans;
+      bool has_psf_plans;
+      bool uv_slices_concurrently; //whole image slices transformed in parallel (otherwise the lines of each slice are split over the threads)
+      bool psf_slices_concurrently;
+      //with per-facet geometry (params.facet_geometries) every facet is inverted with its own plans instead
+      std::vector<inversion_plans> facet_uv_plans;
+      std::vector<inversion_plans> facet_psf_plans;
     public:
       ifft_machine(gridding_parameters & params);
-      void repack_and_ifft_uv_grids(gridding_parameters & params);
-      void repack_and_ifft_sampling_function_grids(gridding_parameters & params);
+      /*
+       * Normalizes and combines the correlation grids of every facet and cube channel into the Stokes term being imaged,
+       * inverts them and writes the grid corrected, cropped real images to params.image_buffer. The sink (if any) is
+       * notified of every facet as soon as all of its images are done. With per-facet geometry the facets are inverted
+       * one after the other, each with its own grid size, image size and grid corrections
+       */
+      void repack_and_ifft_uv_grids(gridding_parameters & params,image_sink * sink = NULL);
+      void repack_and_ifft_sampling_function_grids(gridding_parameters & params,image_sink * sink = NULL);
       virtual ~ifft_machine();
     };
-}
\ No newline at end of file
+}
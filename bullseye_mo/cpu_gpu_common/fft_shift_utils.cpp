@@ -110,4 +110,15 @@ namespace utils{
 	}
     }
   }
-}
\ No newline at end of file
+  void checkerboard_modulate(std::complex<grid_base_type> * __restrict__ grid,
+			     std::size_t nx, std::size_t ny,
+			     std::size_t no_slices, std::size_t parity) {
+    for (std::size_t slice = 0; slice < no_slices; ++slice) {
+	std::complex<grid_base_type> * offset_grid = grid + slice * nx * ny;
+	for (std::size_t iy = 0; iy < ny; ++iy){
+	    for (std::size_t ix = (iy + parity + 1) % 2; ix < nx; ix += 2)
+		offset_grid[iy*nx + ix] = -offset_grid[iy*nx + ix];
+	}
+    }
+  }
+}
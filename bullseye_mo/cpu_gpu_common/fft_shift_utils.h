@@ -65,4 +65,13 @@ void fftshift(std::complex<grid_base_type> * __restrict__ grid,
 void ifftshift(std::complex<grid_base_type> * __restrict__ grid,
                std::size_t nx, std::size_t ny,
                std::size_t no_slices);
-}
\ No newline at end of file
+/**
+ * For even sized grids the shifts around an inverse FFT can be folded into the data by modulating it with a checkerboard
+ * of signs, since a shift by half the grid size is a linear phase ramp of (-1)^x in the other domain:
+ *    fftshift(ifft(ifftshift(X)))[x,y] = (-1)^(x + y + nx/2 + ny/2) . ifft((-1)^(x + y) . X)[x,y]
+ * This negates every cell for which x + y + parity is odd, in a single contiguous pass over every slice
+ */
+void checkerboard_modulate(std::complex<grid_base_type> * __restrict__ grid,
+			   std::size_t nx, std::size_t ny,
+			   std::size_t no_slices, std::size_t parity);
+}
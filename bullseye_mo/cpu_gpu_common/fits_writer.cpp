@@ -0,0 +1,222 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#include "fits_writer.h"
+#include "facet_geometry.h"
+#include <fitsio.h>
+#include <algorithm>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace imaging {
+  struct pending_fits_writes {
+    std::mutex lock;
+    std::vector<std::future<void> > writes;
+  };
+  namespace {
+    const double ARCSEC_TO_DEG = 1 / 3600.0;
+    /*
+     * cfitsio only supports writing different files from many threads at once when it was built reentrant (--enable-reentrant),
+     * otherwise all the writes are serialized through this lock
+     */
+    std::mutex non_reentrant_cfitsio_lock;
+    void check_fits_status(int status,const std::string & filename){
+      if (status == 0) return;
+      char status_text[FLEN_STATUS];
+      fits_get_errstatus(status,status_text);
+      throw std::runtime_error("Could not write FITS image " + filename + ": " + status_text);
+    }
+    /*
+     * The image data is laid out as #channels x 1 (stokes) x size_m x size_l. The coordinate cards are the same as 
+     * those of fits_export.append_coordinate_cards (the field and facet centres and cell sizes are in arcsec)
+     */
+    struct fits_cube_description {
+      std::string filename;
+      long size_l;
+      long size_m;
+      double cell_l;
+      double cell_m;
+      double centre_px_l;
+      double centre_px_m;
+      double pointing_ra;
+      double pointing_dec;
+      int polarization;
+      double ref_wavelength;
+      double delta_wavelength;
+      long cube_channel_dim_size;
+    };
+    void write_key(fitsfile * file,const char * key,double value,const char * comment,int & status){
+      fits_write_key(file,TDOUBLE,key,&value,comment,&status);
+    }
+    void write_key(fitsfile * file,const char * key,int value,const char * comment,int & status){
+      fits_write_key(file,TINT,key,&value,comment,&status);
+    }
+    void write_key(fitsfile * file,const char * key,const char * value,const char * comment,int & status){
+      fits_write_key(file,TSTRING,key,const_cast<char *>(value),comment,&status);
+    }
+    void write_coordinate_cards(fitsfile * file,const fits_cube_description & cube,int & status){
+      write_key(file,"CRPIX1",cube.centre_px_l,"Pixel coordinate of reference point",status);
+      write_key(file,"CDELT1",-cube.cell_m * ARCSEC_TO_DEG,"step per m pixel",status);
+      write_key(file,"CTYPE1","RA---SIN","Orthog projection",status);
+      write_key(file,"CRVAL1",cube.pointing_ra * ARCSEC_TO_DEG,"RA value",status);
+      write_key(file,"CUNIT1","deg","units are always degrees",status);
+      write_key(file,"CRPIX2",cube.centre_px_m,"Pixel coordinate of reference point",status);
+      write_key(file,"CDELT2",cube.cell_l * ARCSEC_TO_DEG,"step per l pixel",status);
+      write_key(file,"CTYPE2","DEC--SIN","Orthog projection",status);
+      write_key(file,"CRVAL2",cube.pointing_dec * ARCSEC_TO_DEG,"DEC value",status);
+      write_key(file,"CUNIT2","deg","units are always degrees",status);
+      write_key(file,"CRPIX3",1,"Pixel coordinate of reference point",status);
+      write_key(file,"CDELT3",1,"dummy value",status);
+      write_key(file,"CTYPE3","STOKES","Polarization",status);
+      write_key(file,"CRVAL3",cube.polarization,"Polarization identifier",status);
+      write_key(file,"CUNIT3"," ","Polarization term is unitless",status);
+      write_key(file,"CRPIX4",1,"Pixel coordinate of reference point",status);
+      write_key(file,"CDELT4",cube.delta_wavelength,"dummy velocity value",status);
+      write_key(file,"CTYPE4","WAVELENGTH","Wavelength in metres",status);
+      write_key(file,"CRVAL4",cube.ref_wavelength,"first wavelength in the cube",status);
+      write_key(file,"CUNIT4","m","wavelength in m",status);
+    }
+    /*
+     * Writes no_channels planes starting at first_channel. The file is (re)created when writing the first channel and
+     * opened for update otherwise. Compressed images are split into one Rice compressed tile per plane, so that the 
+     * groups of channels are always written as whole tiles, in order.
+     */
+    void write_fits_channels(const fits_cube_description & cube,bool compress,std::size_t first_channel,
+			     std::size_t no_channels,float * data){
+      fitsfile * file;
+      int status = 0;
+      if (first_channel == 0) {
+	long naxes[4] = {cube.size_l,cube.size_m,1,cube.cube_channel_dim_size};
+	fits_create_file(&file,("!" + cube.filename).c_str(),&status); //'!' overwrites any existing file
+	if (compress) {
+	  long tile[4] = {cube.size_l,cube.size_m,1,1};
+	  fits_set_compression_type(file,RICE_1,&status);
+	  fits_set_tile_dim(file,4,tile,&status);
+	}
+	fits_create_img(file,FLOAT_IMG,4,naxes,&status);
+	write_coordinate_cards(file,cube,status);
+      } else {
+	fits_open_image(&file,cube.filename.c_str(),READWRITE,&status); //moves to the compressed image extension if need be
+      }
+      check_fits_status(status,cube.filename);
+      long first_pixel[4] = {1,1,1,(long)first_channel + 1};
+      fits_write_pix(file,TFLOAT,first_pixel,(LONGLONG)(no_channels * cube.size_l * cube.size_m),data,&status);
+      int write_status = status;
+      status = 0;
+      fits_close_file(file,&status);
+      check_fits_status(write_status != 0 ? write_status : status,cube.filename);
+    }
+    void normalize_peak(float * image,std::size_t image_size){
+      float peak = *std::max_element(image,image + image_size);
+      if (peak == 0) return;
+      for (std::size_t i = 0; i < image_size; ++i)
+	image[i] /= peak;
+    }
+  }
+  fits_image_writer::fits_image_writer(const gridding_parameters & params,image_type type):
+    params(params),type(type),pending_writes(new pending_fits_writes()) {}
+  void fits_image_writer::write_facet(std::size_t facet){
+    fits_cube_description cube;
+    gridding_parameters facet_params = facet_gridding_parameters(params,facet); //every facet may have its own size and resolution
+    //same layout as the Python export: l is the first axis of the images (image_ny), m the second (image_nx)
+    cube.size_l = type == DIRTY_IMAGES ? facet_params.image_ny : facet_params.psf_image_ny;
+    cube.size_m = type == DIRTY_IMAGES ? facet_params.image_nx : facet_params.psf_image_nx;
+    cube.cell_l = facet_params.cell_size_y;
+    cube.cell_m = facet_params.cell_size_x;
+    cube.centre_px_l = (cube.size_l * 0.5 + 1) + (params.fits_image_centres[facet*2] - params.phase_centre_ra) / cube.cell_l;
+    cube.centre_px_m = (cube.size_m * 0.5 + 1) - (params.fits_image_centres[facet*2 + 1] - params.phase_centre_dec) / cube.cell_m;
+    cube.pointing_ra = params.phase_centre_ra;
+    cube.pointing_dec = params.phase_centre_dec;
+    cube.polarization = params.fits_polarization;
+    std::size_t image_size = cube.size_l * cube.size_m;
+    std::unique_lock<std::mutex> serialized_writes(non_reentrant_cfitsio_lock,std::defer_lock);
+    if (!fits_is_reentrant())
+      serialized_writes.lock();
+    if (type == DIRTY_IMAGES) {
+      cube.filename = params.fits_image_names[facet];
+      cube.ref_wavelength = params.fits_reference_wavelength;
+      cube.delta_wavelength = params.fits_delta_wavelength;
+      cube.cube_channel_dim_size = params.fits_cube_channel_dim_size;
+      write_fits_channels(cube,params.should_compress_fits,params.fits_first_cube_channel,params.cube_channel_dim_size,
+			  params.image_buffer + facet_image_offset(params,facet,params.cube_channel_dim_size * image_size));
+    } else {
+      cube.delta_wavelength = 0;
+      cube.cube_channel_dim_size = 1;
+      float * facet_psfs = params.psf_image_buffer + 
+			   facet_psf_image_offset(params,facet,params.sampling_function_channel_count * image_size);
+      for (std::size_t c = 0; c < params.sampling_function_channel_count; ++c){
+	std::size_t psf_index = facet * params.sampling_function_channel_count + c;
+	float * psf = facet_psfs + c * image_size;
+	normalize_peak(psf,image_size);
+	cube.filename = params.fits_psf_names[psf_index];
+	cube.ref_wavelength = params.fits_psf_wavelengths[c];
+	write_fits_channels(cube,params.should_compress_fits,0,1,psf);
+      }
+    }
+  }
+  void fits_image_writer::facet_complete(std::size_t facet){
+    std::lock_guard<std::mutex> queue_lock(pending_writes->lock);
+    pending_writes->writes.push_back(std::async(std::launch::async,&fits_image_writer::write_facet,this,facet));
+  }
+  void fits_image_writer::wait(){
+    std::vector<std::future<void> > writes;
+    {
+      std::lock_guard<std::mutex> queue_lock(pending_writes->lock);
+      writes.swap(pending_writes->writes);
+    }
+    //every write has to finish before the image buffers may be reused, so only the first failure is rethrown
+    std::exception_ptr first_failure;
+    for (std::size_t i = 0; i < writes.size(); ++i){
+      try {
+	writes[i].get();
+      } catch (...) {
+	if (!first_failure) first_failure = std::current_exception();
+      }
+    }
+    if (first_failure)
+      std::rethrow_exception(first_failure);
+  }
+  fits_image_writer::~fits_image_writer(){
+    //the futures returned by std::async block until their writes are done when they are destroyed
+    delete pending_writes;
+  }
+}
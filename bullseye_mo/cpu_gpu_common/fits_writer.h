@@ -0,0 +1,76 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <cstddef>
+#include "gridding_parameters.h"
+#include "fft_and_repacking_routines.h"
+
+namespace imaging {
+  struct pending_fits_writes; //kept out of the header, so that it can be included from .cu files
+  /**
+   * Writes the finalized float32 images of every facet straight from the image buffers to FITS files, with the same 
+   * layout and coordinate cards as the Python FITS export (see helpers/fits_export.py). Each facet is written out by
+   * its own thread as soon as the inversion has finished all of its images (the writer is the image_sink of the 
+   * inversion), so that the writes overlap the inversion of the remaining facets.
+   * 
+   * Dirty image cubes may be written a group of channels at a time (params.fits_first_cube_channel): the first group
+   * creates the files and the later groups are written into them. PSFs are written to one file per facet and channel, 
+   * normalized to a peak of 1.
+   */
+  class fits_image_writer : public image_sink {
+  public:
+    enum image_type {DIRTY_IMAGES,PSF_IMAGES};
+  private:
+    gridding_parameters params;
+    image_type type;
+    pending_fits_writes * pending_writes;
+    void write_facet(std::size_t facet);
+  public:
+    fits_image_writer(const gridding_parameters & params,image_type type);
+    /*
+     * Starts writing out the facet in the background
+     */
+    void facet_complete(std::size_t facet);
+    /*
+     * Blocks until every facet handed to the writer has been written out. Any failure to write is rethrown here
+     */
+    void wait();
+    virtual ~fits_image_writer();
+  };
+}
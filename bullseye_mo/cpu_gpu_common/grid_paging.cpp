@@ -0,0 +1,79 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#include "grid_paging.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdint>
+
+namespace utils {
+  namespace {
+    /*
+     * madvise only accepts page aligned ranges: round the start up and the end down to whole pages
+     */
+    bool whole_pages(void * start, std::size_t bytes, void ** page_start, std::size_t * page_bytes){
+      std::uintptr_t page_size = sysconf(_SC_PAGESIZE);
+      std::uintptr_t begin = ((std::uintptr_t)start + page_size - 1) / page_size * page_size;
+      std::uintptr_t end = ((std::uintptr_t)start + bytes) / page_size * page_size;
+      if (start == NULL || end <= begin) return false;
+      *page_start = (void *)begin;
+      *page_bytes = end - begin;
+      return true;
+    }
+    void advise(void * start, std::size_t bytes, int advice){
+      void * page_start;
+      std::size_t page_bytes;
+      if (whole_pages(start,bytes,&page_start,&page_bytes))
+	madvise(page_start,page_bytes,advice);
+    }
+  }
+  void advise_random_access(void * start, std::size_t bytes){
+    advise(start,bytes,MADV_RANDOM);
+  }
+  void prefetch_pages(void * start, std::size_t bytes){
+    advise(start,bytes,MADV_WILLNEED);
+  }
+  void release_pages(void * start, std::size_t bytes){
+    void * page_start;
+    std::size_t page_bytes;
+    if (!whole_pages(start,bytes,&page_start,&page_bytes)) return;
+    //dropping dirty pages of a shared file mapping would only unmap them: they stay in the page cache until written back
+    if (madvise(page_start,page_bytes,MADV_REMOVE) != 0)
+      madvise(page_start,page_bytes,MADV_DONTNEED);
+  }
+}
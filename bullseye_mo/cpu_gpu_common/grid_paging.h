@@ -0,0 +1,63 @@
+/********************************************************************************************
+Bullseye:
+An accelerated targeted facet imager
+Category: Radio Astronomy / Widefield synthesis imaging
+
+Authors: Benjamin Hugo, Oleg Smirnov, Cyril Tasse, James Gain
+Contact: hgxben001@myuct.ac.za
+
+Copyright (C) 2014-2015 Rhodes Centre for Radio Astronomy Techniques and Technologies
+Department of Physics and Electronics
+Rhodes University
+Artillery Road P O Box 94
+Grahamstown
+6140
+Eastern Cape South Africa
+
+Copyright (C) 2014-2015 Department of Computer Science
+University of Cape Town
+18 University Avenue
+University of Cape Town
+Rondebosch
+Cape Town
+South Africa
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+********************************************************************************************/
+#pragma once
+#include <cstddef>
+
+namespace utils {
+/**
+ * Paging hints for grids that live in memory-mapped files (out-of-core facet sets that do not fit in RAM). All the
+ * hints are restricted to the whole pages that lie inside [start, start + bytes), so neighbouring data sharing the
+ * first and last pages is never affected. Errors are ignored: without them the grids are simply paged by the kernel.
+ */
+/**
+ * Gridding scatters into a window of tiles around each visibility: read-ahead of neighbouring pages only evicts the
+ * working set
+ */
+void advise_random_access(void * start, std::size_t bytes);
+/**
+ * Starts reading in the given range in the background (eg. the next slice to be inverted)
+ */
+void prefetch_pages(void * start, std::size_t bytes);
+/**
+ * Discards the given range once it holds nothing worth keeping (slices are inverted in place, so their grids are gone
+ * once the image has been written out). The pages of file mappings are punched out of the file without being written
+ * back, anonymous pages are dropped. Either way the range reads back as zeros.
+ */
+void release_pages(void * start, std::size_t bytes);
+}
@@ -41,9 +41,31 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "uvw_coord.h"
 #include "base_types.h"
 
+/**
+ * Geometry of a single facet, for imaging facets of different sizes and resolutions together (eg. small targeted facets
+ * around calibrators along with a coarse facet over the whole field). The offsets place every facet in the shared buffers,
+ * whose facets are otherwise all laid out at the same stride.
+ */
+struct facet_geometry {
+    size_t nx; //padded grid size
+    size_t ny;
+    uvw_base_type cell_size_x; //arcsec
+    uvw_base_type cell_size_y;
+    size_t image_nx; //centred window of the inverted grid that is written out (the PSF is the same size)
+    size_t image_ny;
+    grid_base_type * grid_correction_x; //image_nx long (NULL disables grid correction), also applied to the PSF
+    grid_base_type * grid_correction_y; //image_ny long
+    //Offset table: where the facet starts in each of the buffers
+    size_t grid_offset; //cells into output_buffer
+    size_t sampling_function_grid_offset; //cells into sampling_function_buffer
+    size_t image_offset; //pixels into image_buffer
+    size_t psf_image_offset; //pixels into psf_image_buffer
+};
+
 struct gridding_parameters {
     //Mandatory data necessary for gridding:
     std::complex<visibility_base_type> * __restrict__  visibilities;
+    std::complex<visibility_base_type> * __restrict__  model_visibilities; //optional: subtracted from the visibilities as they are read (residual imaging), NULL to disable
     imaging::uvw_coord<uvw_base_type> * __restrict__  uvw_coords;
     reference_wavelengths_base_type * __restrict__  reference_wavelengths;
     visibility_weights_base_type * __restrict__  visibility_weights;
@@ -96,6 +118,8 @@ struct gridding_parameters {
     std::complex<grid_base_type> * __restrict__ sampling_function_buffer;
     std::size_t * __restrict__ sampling_function_channel_grid_indicies;
     size_t sampling_function_channel_count;
+    size_t psf_nx; //dimensions of the sampling function grids (smaller than nx x ny when only a PSF cutout is required)
+    size_t psf_ny;
     //Finalization steps
     bool is_final_data_chunk;
     //w-projection related terms
@@ -106,4 +130,59 @@ struct gridding_parameters {
     size_t * antenna_jones_starting_indexes; //this has to be n + 1 long because we need to be able to compute the number of jones terms at the last antenna
     size_t * jones_time_indicies_per_antenna; //this will be the same length as the repacked jones matrix array
     normalization_base_type * normalization_terms; //this has to be threads_bins x #facets x #channel_accumulation_grids x #polarization_being_gridded
+    //Baseline dependent averaging (optional compression of each chunk before gridding)
+    uvw_base_type averaging_smearing_tolerance; //maximum phase drift (radians) allowed at the edge of the imaged field
+    uvw_base_type averaging_field_radius; //radius (arcsec) of the imaged field around the phase centre, including all facets
+    bool should_average_per_facet; //average after rotating to each facet centre (the tolerance then only has to hold over a facet)
+    //Coalescing of visibilities with the same kernel placement before convolution
+    bool should_coalesce_visibilities;
+    //Data-major faceting (each block of rows is read once and gridded into a batch of facets)
+    bool should_block_facets;
+    //Grid memory layout (tiled grids are converted back to row-major when finalizing)
+    bool should_tile_grids;
+    bool should_use_planar_grids; //seperate real and imaginary planes per grid slice (re-interleaved when finalizing)
+    //Imaging weights (uniform / robust / super-uniform), computed per visibility ahead of gridding
+    bool should_use_robust_weighting; //Briggs weighting, otherwise uniform
+    uvw_base_type weighting_robustness; //Briggs robustness parameter R (-2 ~ uniform, 2 ~ natural)
+    size_t weighting_density_scale; //each density cell spans this many uv cells per axis (super-uniform weighting when > 1)
+    //Grid the sampling function in the same pass as the visibilities (grid_sampling_function / facet_sampling_function then do nothing)
+    bool should_fuse_sampling_function;
+    //FFTW planning (the inversion plans are made once, when the library is initialized)
+    size_t fft_planning_rigour; //0: estimate, 1: measure, 2: patient
+    const char * fft_wisdom_directory; //plans are imported from and exported to wisdom files in this directory (NULL disables)
+    //Hermitian half-plane grids (nx / 2 + 1 columns in unshifted FFT order at the start of each slice, inverted with complex-to-real FFTs)
+    bool should_grid_half_plane;
+    //Dirty images and PSFs (float32), only the centred image_nx x image_ny window of each inverted grid is written out
+    float * image_buffer; //this has to be #facets x cube_channel_dim_size x image_ny x image_nx
+    size_t image_nx;
+    size_t image_ny;
+    float * psf_image_buffer; //this has to be #facets x sampling_function_channel_count x psf_image_ny x psf_image_nx
+    size_t psf_image_nx;
+    size_t psf_image_ny;
+    //Finalization of the images (applied by the inversion, in the same pass that writes out the images)
+    normalization_base_type * stokes_correlation_weights; //each image is sum_corr(weight[corr] * grid[corr] / normalization_term[corr]), NULL images the first correlation
+    grid_base_type * grid_correction_x; //image_nx long, the inverse of the image-space taper of the anti-aliasing kernel (NULL disables grid correction)
+    grid_base_type * grid_correction_y; //image_ny long
+    grid_base_type * psf_grid_correction_x; //psf_image_nx long
+    grid_base_type * psf_grid_correction_y; //psf_image_ny long
+    //Out-of-core grids: output_buffer and sampling_function_buffer are memory-mapped files, which are paged in and discarded slice by slice during the inversion
+    bool should_stream_grids;
+    //Native FITS export: the images of each facet are written out by the library as soon as they have been inverted (same layout and coordinate cards as the Python FITS export)
+    const char ** fits_image_names; //#facets long, NULL leaves the dirty images to the caller
+    const char ** fits_psf_names; //#facets x sampling_function_channel_count long, NULL leaves the PSFs to the caller
+    bool should_compress_fits; //Rice tile-compressed images, one tile per image plane
+    int fits_polarization; //FITS STOKES axis code of the term being imaged
+    uvw_base_type * fits_image_centres; //#facets x 2 (RA,DEC in arcsec), the reference point of every facet image
+    double fits_reference_wavelength; //wavelength of the first channel of the whole cube
+    double fits_delta_wavelength;
+    size_t fits_cube_channel_dim_size; //channels in the whole cube, images are written out a group of cube_channel_dim_size channels at a time
+    size_t fits_first_cube_channel; //of the group being imaged, the files are created with the first group
+    double * fits_psf_wavelengths; //sampling_function_channel_count long (float64)
+    //Facet mosaicking: the dirty images of all the facets are resampled onto the (coplanar) facet plane of the phase centre and blended together
+    float * mosaic_buffer; //this has to be cube_channel_dim_size x mosaic_ny x mosaic_nx
+    size_t mosaic_nx; //set by compute_mosaic_size, the phase centre lands on pixel (mosaic_nx / 2, mosaic_ny / 2)
+    size_t mosaic_ny;
+    size_t mosaic_feather_width; //the blending weight of every facet ramps up over this many pixels from its edges
+    //Per-facet geometry: #facets long, NULL when every facet has the grid size, cell size and image size given above
+    facet_geometry * facet_geometries;
 };
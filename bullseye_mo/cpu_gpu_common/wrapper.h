@@ -41,14 +41,20 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 extern "C" {
     double get_gridding_walltime();
     double get_inversion_walltime();
+    double get_fft_planning_walltime();
     void gridding_barrier();
     void initLibrary(gridding_parameters & params);
     void releaseLibrary();
     void weight_uniformly(gridding_parameters & params);
     void normalize(gridding_parameters & params);
     void repack_input_data(gridding_parameters & params);
+    void average_baselines(gridding_parameters & params);
+    void accumulate_imaging_weight_densities(gridding_parameters & params);
+    void apply_imaging_weights(gridding_parameters & params);
     void finalize(gridding_parameters & params);
     void finalize_psf(gridding_parameters & params);
+    void compute_mosaic_size(gridding_parameters & params);
+    void mosaic_facets(gridding_parameters & params);
     void grid_single_pol(gridding_parameters & params);
     void facet_single_pol(gridding_parameters & params);
     void grid_duel_pol(gridding_parameters & params);
@@ -39,6 +39,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include <vector>
 #include <numeric>
 #include <cstring>
+#include <omp.h>
 
 #include "gpu_wrapper.h"
 #include "dft.h"
@@ -53,12 +54,15 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #include "jones_2x2.h"
 
 #include "fft_and_repacking_routines.h"
+#include "fits_writer.h"
+#include "facet_mosaic.h"
 #define NO_THREADS_PER_BLOCK_DIM 256
 
 extern "C" {
     utils::timer * gridding_walltime;
     utils::timer * inversion_timer;
     imaging::ifft_machine * fftw_ifft_machine;
+    double fft_planning_walltime = 0; //FFTW planning runs on the host, so it can't be timed with stream events
     cudaStream_t compute_stream;
     gridding_parameters gpu_params;
     bool initialized = false;
@@ -75,11 +79,16 @@ extern "C" {
     double get_inversion_walltime() {
       return inversion_timer->duration();
     }
+    double get_fft_planning_walltime() {
+      return fft_planning_walltime;
+    }
     void gridding_barrier(){
       cudaSafeCall(cudaStreamSynchronize(compute_stream));
     }
     void initLibrary(gridding_parameters & params) {
 	if (initialized) return;
+	if (params.facet_geometries != NULL)
+	    throw std::runtime_error("Unimplemented: per-facet geometry is only available in the CPU library");
 	initialized = true;
 	size_t padded_full_support = params.conv_support * 2 + 1 + 2;
 	size_t size_of_convolution_function = (padded_full_support) + (padded_full_support - 1) * (params.conv_oversample - 1);
@@ -140,7 +149,9 @@ extern "C" {
 	cudaSafeCall(cudaStreamCreateWithFlags(&compute_stream,cudaStreamNonBlocking));
 	gridding_walltime = new utils::timer(compute_stream);
 	inversion_timer = new utils::timer(compute_stream);
+	double planning_start = omp_get_wtime();
 	fftw_ifft_machine = new imaging::ifft_machine(params);
+	fft_planning_walltime += omp_get_wtime() - planning_start;
 	//alloc memory for all the arrays on the gpu at the beginning of execution...
 	gpu_params = params;
 	cudaSafeCall(cudaMalloc((void**)&gpu_params.visibilities, sizeof(std::complex<visibility_base_type>) * params.chunk_max_row_count*params.channel_count*params.number_of_polarization_terms_being_gridded));
@@ -272,6 +283,15 @@ extern "C" {
       delete[] normalization_counts;
       cudaDeviceReset(); //leave the device in a safe state
     }
+    void average_baselines(gridding_parameters & params){
+      throw std::runtime_error("Unimplemented: baseline dependent averaging is only available in the CPU library");
+    }
+    void accumulate_imaging_weight_densities(gridding_parameters & params){
+      throw std::runtime_error("Unimplemented: per visibility imaging weights are only available in the CPU library");
+    }
+    void apply_imaging_weights(gridding_parameters & params){
+      throw std::runtime_error("Unimplemented: per visibility imaging weights are only available in the CPU library");
+    }
     void weight_uniformly(gridding_parameters & params){
       #define EPSILON 0.0000001f
       gridding_barrier();
@@ -316,33 +336,27 @@ extern "C" {
       gridding_barrier();
       size_t no_reduction_bins = (params.conv_support * 2 + 1) * (params.conv_support * 2 + 1);
       /*
-       * Now normalize per facet, per channel accumulator grid and correlation
+       * Reduce the normalization terms per facet, per channel accumulator grid and correlation. The inversion expects 
+       * them at the start of the buffer (see ifft_machine), where they are applied in the same pass that combines the 
+       * correlations into the Stokes term being imaged. Term i is only stored after all the bins it is reduced from 
+       * have been read, so this can be done in place.
        */
-      for (size_t f = 0; f < params.num_facet_centres; ++f){
-	 for (size_t ch = 0; ch < params.cube_channel_dim_size; ++ch){
-	    for (size_t corr = 0; corr < params.number_of_polarization_terms_being_gridded; ++corr){
-	      normalization_base_type norm_val = 0;
-	      for (size_t thid = 0; thid < no_reduction_bins; ++thid){
-		norm_val += params.normalization_terms[((f * params.cube_channel_dim_size + ch) * 
-							params.number_of_polarization_terms_being_gridded + corr) * no_reduction_bins + thid];
-	      }
-	      printf("Normalizing cube slice @ facet %lu, channel slice %lu, correlation term %lu with val %f\n",
-		     f,ch,corr,norm_val);
-	      std::complex<grid_base_type> * __restrict__ grid_ptr = params.output_buffer + 
-								     ((f * params.cube_channel_dim_size + ch) * 
-								     params.number_of_polarization_terms_being_gridded + corr) * params.ny * params.nx;
-	      for (size_t i = 0; i < params.ny * params.nx; ++i)
-		grid_ptr[i] /= norm_val;
-	    }
-	  }
-	}
+      size_t no_terms = params.num_facet_centres * params.cube_channel_dim_size * params.number_of_polarization_terms_being_gridded;
+      for (size_t i = 0; i < no_terms; ++i){
+	normalization_base_type norm_val = 0;
+	for (size_t thid = 0; thid < no_reduction_bins; ++thid)
+	  norm_val += params.normalization_terms[i * no_reduction_bins + thid];
+	params.normalization_terms[i] = norm_val;
+      }
     }
     void finalize(gridding_parameters & params) {
         gridding_barrier();
 	cudaStream_t inversion_timing_stream;
 	cudaSafeCall(cudaStreamCreateWithFlags(&inversion_timing_stream,cudaStreamNonBlocking));
 	inversion_timer->start();
-        fftw_ifft_machine->repack_and_ifft_uv_grids(params);
+	imaging::fits_image_writer image_writer(params,imaging::fits_image_writer::DIRTY_IMAGES);
+        fftw_ifft_machine->repack_and_ifft_uv_grids(params,params.fits_image_names != NULL ? &image_writer : NULL);
+	image_writer.wait();
 	inversion_timer->stop();
 	cudaSafeCall(cudaStreamDestroy(inversion_timing_stream));
     }
@@ -351,10 +365,18 @@ extern "C" {
 	cudaStream_t inversion_timing_stream;
 	cudaSafeCall(cudaStreamCreateWithFlags(&inversion_timing_stream,cudaStreamNonBlocking));
 	inversion_timer->start();
-	fftw_ifft_machine->repack_and_ifft_sampling_function_grids(params);
+	imaging::fits_image_writer psf_writer(params,imaging::fits_image_writer::PSF_IMAGES);
+	fftw_ifft_machine->repack_and_ifft_sampling_function_grids(params,params.fits_psf_names != NULL ? &psf_writer : NULL);
+	psf_writer.wait();
 	inversion_timer->stop();
 	cudaSafeCall(cudaStreamDestroy(inversion_timing_stream));
     }
+    void compute_mosaic_size(gridding_parameters & params){
+	imaging::compute_mosaic_size(params);
+    }
+    void mosaic_facets(gridding_parameters & params){
+	imaging::mosaic_facets(params);
+    }
     long compute_baseline_index(long a1, long a2, long no_antennae){
       //There is a quadratic series expression relating a1 and a2 to a unique baseline index (can be found by the double difference method)
       //Let slow varying index be S = min(a1,a2)
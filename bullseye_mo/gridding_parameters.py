@@ -41,11 +41,35 @@ from ctypes import *
 
 if base_types.uvw_ctypes_convert_type == None:
   raise Exception("Please import base_types.py first and select a precision mode before importing gridding_parameters.py")
+'''
+Geometry of a single facet, for imaging facets of different sizes and resolutions together (eg. small targeted facets
+around calibrators along with a coarse facet over the whole field). The offsets place every facet in the shared buffers,
+whose facets are otherwise all laid out at the same stride.
+'''
+class facet_geometry(Structure):
+  pass
+facet_geometry._fields_ = [
+  ("nx",c_size_t), #padded grid size
+  ("ny",c_size_t),
+  ("cell_size_x",base_types.uvw_ctypes_convert_type), #arcsec
+  ("cell_size_y",base_types.uvw_ctypes_convert_type),
+  ("image_nx",c_size_t), #centred window of the inverted grid that is written out (the PSF is the same size)
+  ("image_ny",c_size_t),
+  ("grid_correction_x",c_void_p), #image_nx long (None disables grid correction), also applied to the PSF
+  ("grid_correction_y",c_void_p), #image_ny long
+  #Offset table: where the facet starts in each of the buffers
+  ("grid_offset",c_size_t), #cells into output_buffer
+  ("sampling_function_grid_offset",c_size_t), #cells into sampling_function_buffer
+  ("image_offset",c_size_t), #pixels into image_buffer
+  ("psf_image_offset",c_size_t) #pixels into psf_image_buffer
+]
+
 class gridding_parameters(Structure):
   pass
 gridding_parameters._fields_ = [
   #Mandatory data necessary for gridding:
   ("visibilities",c_void_p),
+  ("model_visibilities",c_void_p), #optional: subtracted from the visibilities as they are read (residual imaging), None to disable
   ("uvw_coords",c_void_p),
   ("reference_wavelengths",c_void_p),
   ("visibility_weights",c_void_p),
@@ -98,6 +122,8 @@ gridding_parameters._fields_ = [
   ("sampling_function_buffer",c_void_p),
   ("sampling_function_channel_grid_indicies",c_void_p),
   ("sampling_function_channel_count",c_size_t),
+  ("psf_nx",c_size_t), #dimensions of the sampling function grids (smaller than nx x ny when only a PSF cutout is required)
+  ("psf_ny",c_size_t),
   #Finalization steps
   ("is_final_data_chunk",c_bool),
   #w-projection related terms
@@ -108,5 +134,60 @@ gridding_parameters._fields_ = [
   #The following will be allocated and released in the C libraries
   ("antenna_jones_starting_indexes",c_void_p), #this has to be n + 1 long because we need to be able to compute the number of jones terms at the last antenna
   ("jones_time_indicies_per_antenna",c_void_p), #this will be the same length as the repacked jones matrix array
-  ("normalization_terms",c_void_p) #this has to be threads_bins x #facets x #channel_accumulation_grids x #polarization_being_gridded
+  ("normalization_terms",c_void_p), #this has to be threads_bins x #facets x #channel_accumulation_grids x #polarization_being_gridded
+  #Baseline dependent averaging (optional compression of each chunk before gridding)
+  ("averaging_smearing_tolerance",base_types.uvw_ctypes_convert_type), #maximum phase drift (radians) allowed at the edge of the imaged field
+  ("averaging_field_radius",base_types.uvw_ctypes_convert_type), #radius (arcsec) of the imaged field around the phase centre, including all facets
+  ("should_average_per_facet",c_bool), #average after rotating to each facet centre (the tolerance then only has to hold over a facet)
+  #Coalescing of visibilities with the same kernel placement before convolution
+  ("should_coalesce_visibilities",c_bool),
+  #Data-major faceting (each block of rows is read once and gridded into a batch of facets)
+  ("should_block_facets",c_bool),
+  #Grid memory layout (tiled grids are converted back to row-major when finalizing)
+  ("should_tile_grids",c_bool),
+  ("should_use_planar_grids",c_bool), #seperate real and imaginary planes per grid slice (re-interleaved when finalizing)
+  #Imaging weights (uniform / robust / super-uniform), computed per visibility ahead of gridding
+  ("should_use_robust_weighting",c_bool), #Briggs weighting, otherwise uniform
+  ("weighting_robustness",base_types.uvw_ctypes_convert_type), #Briggs robustness parameter R (-2 ~ uniform, 2 ~ natural)
+  ("weighting_density_scale",c_size_t), #each density cell spans this many uv cells per axis (super-uniform weighting when > 1)
+  #Grid the sampling function in the same pass as the visibilities (grid_sampling_function / facet_sampling_function then do nothing)
+  ("should_fuse_sampling_function",c_bool),
+  #FFTW planning (the inversion plans are made once, when the library is initialized)
+  ("fft_planning_rigour",c_size_t), #0: estimate, 1: measure, 2: patient
+  ("fft_wisdom_directory",c_char_p), #plans are imported from and exported to wisdom files in this directory (NULL disables)
+  #Hermitian half-plane grids (nx / 2 + 1 columns in unshifted FFT order at the start of each slice, inverted with complex-to-real FFTs)
+  ("should_grid_half_plane",c_bool),
+  #Dirty images and PSFs (float32), only the centred image_nx x image_ny window of each inverted grid is written out
+  ("image_buffer",c_void_p), #this has to be #facets x cube_channel_dim_size x image_ny x image_nx
+  ("image_nx",c_size_t),
+  ("image_ny",c_size_t),
+  ("psf_image_buffer",c_void_p), #this has to be #facets x sampling_function_channel_count x psf_image_ny x psf_image_nx
+  ("psf_image_nx",c_size_t),
+  ("psf_image_ny",c_size_t),
+  #Finalization of the images (applied by the inversion, in the same pass that writes out the images)
+  ("stokes_correlation_weights",c_void_p), #each image is sum_corr(weight[corr] * grid[corr] / normalization_term[corr]), NULL images the first correlation
+  ("grid_correction_x",c_void_p), #image_nx long, the inverse of the image-space taper of the anti-aliasing kernel (NULL disables grid correction)
+  ("grid_correction_y",c_void_p), #image_ny long
+  ("psf_grid_correction_x",c_void_p), #psf_image_nx long
+  ("psf_grid_correction_y",c_void_p), #psf_image_ny long
+  #Out-of-core grids: output_buffer and sampling_function_buffer are memory-mapped files, which are paged in and discarded slice by slice during the inversion
+  ("should_stream_grids",c_bool),
+  #Native FITS export: the images of each facet are written out by the library as soon as they have been inverted (same layout and coordinate cards as the Python FITS export)
+  ("fits_image_names",c_void_p), #facets long, NULL leaves the dirty images to the caller
+  ("fits_psf_names",c_void_p), #facets x sampling_function_channel_count long, NULL leaves the PSFs to the caller
+  ("should_compress_fits",c_bool), #Rice tile-compressed images, one tile per image plane
+  ("fits_polarization",c_int), #FITS STOKES axis code of the term being imaged
+  ("fits_image_centres",c_void_p), #facets x 2 (RA,DEC in arcsec), the reference point of every facet image
+  ("fits_reference_wavelength",c_double), #wavelength of the first channel of the whole cube
+  ("fits_delta_wavelength",c_double),
+  ("fits_cube_channel_dim_size",c_size_t), #channels in the whole cube, images are written out a group of cube_channel_dim_size channels at a time
+  ("fits_first_cube_channel",c_size_t), #of the group being imaged, the files are created with the first group
+  ("fits_psf_wavelengths",c_void_p), #sampling_function_channel_count long (float64)
+  #Facet mosaicking: the dirty images of all the facets are resampled onto the (coplanar) facet plane of the phase centre and blended together
+  ("mosaic_buffer",c_void_p), #this has to be cube_channel_dim_size x mosaic_ny x mosaic_nx
+  ("mosaic_nx",c_size_t), #set by compute_mosaic_size, the phase centre lands on pixel (mosaic_nx / 2, mosaic_ny / 2)
+  ("mosaic_ny",c_size_t),
+  ("mosaic_feather_width",c_size_t), #the blending weight of every facet ramps up over this many pixels from its edges
+  #Per-facet geometry: #facets long, None when every facet has the grid size, cell size and image size given above
+  ("facet_geometries",c_void_p)
 ]